@@ -0,0 +1,157 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <functional>
+
+// Move-only type-erased callable with inline storage.
+// Callables up to Capacity bytes are stored in place, larger ones fall back to the heap.
+template<typename Signature, size_t Capacity = 64>
+class InplaceFunction;
+
+template<typename R, typename... Args, size_t Capacity>
+class InplaceFunction<R(Args...), Capacity>
+{
+public:
+	InplaceFunction() noexcept = default;
+	InplaceFunction(std::nullptr_t) noexcept {}
+
+	template<typename F, typename D = std::decay_t<F>,
+		typename = std::enable_if_t<!std::is_same_v<D, InplaceFunction> && std::is_invocable_r_v<R, D&, Args...>>>
+	InplaceFunction(F&& f)
+	{
+		if constexpr (FitsInline<D>)
+		{
+			::new (static_cast<void*>(m_storage)) D(std::forward<F>(f));
+			m_ops = &InlineOps<D>;
+		}
+		else
+		{
+			*reinterpret_cast<D**>(m_storage) = new D(std::forward<F>(f));
+			m_ops = &HeapOps<D>;
+		}
+	}
+
+	InplaceFunction(InplaceFunction&& other) noexcept
+	{
+		MoveFrom(other);
+	}
+
+	InplaceFunction& operator=(InplaceFunction&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Reset();
+			MoveFrom(other);
+		}
+		return *this;
+	}
+
+	InplaceFunction& operator=(std::nullptr_t) noexcept
+	{
+		Reset();
+		return *this;
+	}
+
+	InplaceFunction(const InplaceFunction&) = delete;
+	InplaceFunction& operator=(const InplaceFunction&) = delete;
+
+	~InplaceFunction()
+	{
+		Reset();
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return m_ops != nullptr;
+	}
+
+	R operator()(Args... args)
+	{
+		if (!m_ops) throw std::bad_function_call();
+		return m_ops->Invoke(m_storage, std::forward<Args>(args)...);
+	}
+
+private:
+	struct Ops
+	{
+		R(*Invoke)(void*, Args&&...);
+		void(*Move)(void* dst, void* src) noexcept;
+		void(*Destroy)(void*) noexcept;
+	};
+
+	template<typename D>
+	static constexpr bool FitsInline = sizeof(D) <= Capacity
+		&& alignof(D) <= alignof(std::max_align_t)
+		&& std::is_nothrow_move_constructible_v<D>;
+
+	template<typename D>
+	static R InvokeInline(void* p, Args&&... args)
+	{
+		if constexpr (std::is_void_v<R>)
+			std::invoke(*static_cast<D*>(p), std::forward<Args>(args)...);
+		else
+			return std::invoke(*static_cast<D*>(p), std::forward<Args>(args)...);
+	}
+
+	template<typename D>
+	static R InvokeHeap(void* p, Args&&... args)
+	{
+		return InvokeInline<D>(*static_cast<D**>(p), std::forward<Args>(args)...);
+	}
+
+	template<typename D>
+	static void MoveInline(void* dst, void* src) noexcept
+	{
+		::new (dst) D(std::move(*static_cast<D*>(src)));
+		static_cast<D*>(src)->~D();
+	}
+
+	static void MoveHeap(void* dst, void* src) noexcept
+	{
+		*static_cast<void**>(dst) = *static_cast<void**>(src);
+	}
+
+	template<typename D>
+	static void DestroyInline(void* p) noexcept
+	{
+		static_cast<D*>(p)->~D();
+	}
+
+	template<typename D>
+	static void DestroyHeap(void* p) noexcept
+	{
+		delete *static_cast<D**>(p);
+	}
+
+	template<typename D>
+	static constexpr Ops InlineOps = { &InvokeInline<D>, &MoveInline<D>, &DestroyInline<D> };
+
+	template<typename D>
+	static constexpr Ops HeapOps = { &InvokeHeap<D>, &MoveHeap, &DestroyHeap<D> };
+
+	void MoveFrom(InplaceFunction& other) noexcept
+	{
+		if (other.m_ops)
+		{
+			other.m_ops->Move(m_storage, other.m_storage);
+			m_ops = other.m_ops;
+			other.m_ops = nullptr;
+		}
+	}
+
+	void Reset() noexcept
+	{
+		if (m_ops)
+		{
+			m_ops->Destroy(m_storage);
+			m_ops = nullptr;
+		}
+	}
+
+	static_assert(Capacity >= sizeof(void*), "Capacity must at least hold a pointer");
+
+	alignas(std::max_align_t) unsigned char m_storage[Capacity];
+	const Ops* m_ops = nullptr;
+};
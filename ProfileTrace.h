@@ -0,0 +1,693 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <optional>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+enum class ProfileArgType : uint8_t
+{
+	Int,
+	UInt,
+	Double,
+	Bool,
+	String
+};
+
+// One event argument, kept typed so the writer formats it and numbers stay numbers
+struct ProfileArg
+{
+	ProfileArgType Type;
+	uint8_t KeyLength;
+	uint8_t StringLength;
+	uint16_t TextOffset; // Key in ProfileEventInfo::ArgText, a string value follows right after it
+	union
+	{
+		int64_t Int;
+		uint64_t UInt;
+		double Double;
+		bool Bool;
+	};
+};
+
+// Fixed-size, trivially copyable event record, so recording never allocates.
+// Names longer than the buffers are truncated, args that don't fit whole are dropped.
+// The buffers are not zeroed, so an event that ends up not recorded costs nothing: set
+// the name and category before writing, args are only read up to ArgCount
+struct ProfileEventInfo
+{
+	static constexpr size_t MaxArgs = 6;
+
+	char EventName[64];
+	char Category[16];
+	uint32_t ProcessID = 0;
+	uint32_t ThreadID = 0;
+	char EventType = 0;
+	long long TimePoint = 0; // Nanoseconds
+	ProfileArg Args[MaxArgs];
+	uint8_t ArgCount = 0;
+	uint16_t ArgTextLength = 0;
+	char ArgText[96]; // Keys and string values of Args, copied so they may come from temporaries
+	std::optional<long long> TimeDuration;
+	std::optional<char> Scope; // Used for instant event
+	std::optional<std::uintptr_t> Id; //Used for custom event
+	bool BindToEnclosing = false; // A flow end attached to the slice around it rather than the next one
+
+	void SetName(const char* name) { CopyText(EventName, name); }
+	void SetCategory(const char* category) { CopyText(Category, category); }
+	void ClearArgs() { ArgCount = 0; ArgTextLength = 0; }
+
+	void AddInt(std::string_view key, int64_t value)
+	{
+		if (ProfileArg* arg = NewArg(ProfileArgType::Int, key, {}))
+			arg->Int = value;
+	}
+
+	void AddUInt(std::string_view key, uint64_t value)
+	{
+		if (ProfileArg* arg = NewArg(ProfileArgType::UInt, key, {}))
+			arg->UInt = value;
+	}
+
+	void AddDouble(std::string_view key, double value)
+	{
+		if (ProfileArg* arg = NewArg(ProfileArgType::Double, key, {}))
+			arg->Double = value;
+	}
+
+	void AddBool(std::string_view key, bool value)
+	{
+		if (ProfileArg* arg = NewArg(ProfileArgType::Bool, key, {}))
+			arg->Bool = value;
+	}
+
+	void AddString(std::string_view key, std::string_view value)
+	{
+		NewArg(ProfileArgType::String, key, value);
+	}
+
+	std::string_view ArgKey(const ProfileArg& arg) const
+	{
+		return { ArgText + arg.TextOffset, arg.KeyLength };
+	}
+
+	std::string_view ArgString(const ProfileArg& arg) const
+	{
+		return { ArgText + arg.TextOffset + arg.KeyLength, arg.StringLength };
+	}
+
+private:
+	ProfileArg* NewArg(ProfileArgType type, std::string_view key, std::string_view value)
+	{
+		size_t text = key.size() + value.size();
+		if (ArgCount == MaxArgs || key.size() > 255 || value.size() > 255 || ArgTextLength + text > sizeof(ArgText))
+			return nullptr;
+
+		ProfileArg& arg = Args[ArgCount++];
+		arg.Type = type;
+		arg.KeyLength = static_cast<uint8_t>(key.size());
+		arg.StringLength = static_cast<uint8_t>(value.size());
+		arg.TextOffset = ArgTextLength;
+		std::memcpy(ArgText + ArgTextLength, key.data(), key.size());
+		if (value.size() > 0) // Numeric args pass an empty view, its data() may be null
+			std::memcpy(ArgText + ArgTextLength + key.size(), value.data(), value.size());
+		ArgTextLength += static_cast<uint16_t>(text);
+		return &arg;
+	}
+
+	template<size_t N>
+	static void CopyText(char (&destination)[N], const char* source)
+	{
+		CopyText(destination, source, std::strlen(source));
+	}
+
+	template<size_t N>
+	static void CopyText(char (&destination)[N], const char* source, size_t length)
+	{
+		length = std::min(length, N - 1);
+		std::memcpy(destination, source, length);
+		destination[length] = '\0';
+	}
+
+	friend class BinaryTraceReader;
+};
+
+enum class TraceFormat
+{
+	Json,	// Chrome trace JSON, open it straight in chrome://tracing
+	Binary	// Compact .satrace file, turn it into JSON offline with trace_convert
+};
+
+// Output file written in large blocks. Nothing reaches the OS until a block is full,
+// Flush() is called or the file is closed
+class TraceFileWriter
+{
+public:
+	static constexpr size_t BufferSize = size_t(1) << 20;
+
+	TraceFileWriter() = default;
+	TraceFileWriter(const TraceFileWriter&) = delete;
+	TraceFileWriter& operator=(const TraceFileWriter&) = delete;
+	~TraceFileWriter() { Close(); }
+
+	bool Open(const std::string& path)
+	{
+		Close();
+		m_file = std::fopen(path.c_str(), "wb");
+		m_buffer.resize(BufferSize);
+		m_used = 0;
+		return m_file != nullptr;
+	}
+
+	bool IsOpen() const { return m_file != nullptr; }
+
+	void Write(const void* data, size_t size)
+	{
+		if (!m_file)
+			return;
+
+		if (m_used + size > m_buffer.size())
+		{
+			Flush();
+			if (size > m_buffer.size())
+			{
+				std::fwrite(data, 1, size, m_file);
+				return;
+			}
+		}
+
+		std::memcpy(m_buffer.data() + m_used, data, size);
+		m_used += size;
+	}
+
+	template<typename T>
+	void WriteValue(const T& value)
+	{
+		Write(&value, sizeof(T));
+	}
+
+	void Flush()
+	{
+		if (m_file && m_used > 0)
+		{
+			std::fwrite(m_buffer.data(), 1, m_used, m_file);
+			std::fflush(m_file);
+		}
+		m_used = 0;
+	}
+
+	void Close()
+	{
+		if (!m_file)
+			return;
+
+		Flush();
+		std::fclose(m_file);
+		m_file = nullptr;
+	}
+
+private:
+	FILE* m_file = nullptr;
+	std::vector<char> m_buffer;
+	size_t m_used = 0;
+};
+
+// Turns the events of one session into a file. Close() must be called to finish the file
+class TraceWriter
+{
+public:
+	virtual ~TraceWriter() = default;
+
+	static std::unique_ptr<TraceWriter> Create(TraceFormat format);
+
+	bool Open(const std::string& path)
+	{
+		if (!m_file.Open(path))
+			return false;
+
+		WriteHeader();
+		return true;
+	}
+
+	void Close()
+	{
+		if (!m_file.IsOpen())
+			return;
+
+		WriteFooter();
+		m_file.Close();
+	}
+
+	void Flush() { m_file.Flush(); }
+
+	virtual void Write(const ProfileEventInfo& info) = 0;
+	virtual const char* Extension() const = 0;
+
+protected:
+	virtual void WriteHeader() {}
+	virtual void WriteFooter() {}
+
+	TraceFileWriter m_file;
+};
+
+// Chrome trace JSON array, one object per event
+class JsonTraceWriter : public TraceWriter
+{
+public:
+	void Write(const ProfileEventInfo& info) override
+	{
+		m_length = 0;
+		if (m_writeComma)
+			Append(",\n");
+
+		Append("{\"name\": \"");
+		AppendEscaped(info.EventName);
+		Append("\",\"cat\": \"");
+		AppendEscaped(info.Category);
+
+		// Chrome takes microseconds, the fraction keeps the nanoseconds
+		Format("\",\"ph\": \"%c\",\"pid\": %u,\"tid\": %u,\"ts\": %lld.%03lld",
+			info.EventType, info.ProcessID, info.ThreadID, info.TimePoint / 1000, info.TimePoint % 1000);
+
+		if (info.Id.has_value())
+			Format(", \"id\": %llu", static_cast<unsigned long long>(info.Id.value()));
+
+		if (info.Scope.has_value())
+			Format(", \"s\": \"%c\"", info.Scope.value());
+
+		if (info.BindToEnclosing)
+			Append(", \"bp\": \"e\"");
+
+		if (info.ArgCount > 0)
+		{
+			Append(",\"args\": {");
+			for (uint8_t i = 0; i < info.ArgCount; i++)
+			{
+				const ProfileArg& arg = info.Args[i];
+				Append(i > 0 ? ",\"" : "\"");
+				AppendEscaped(info.ArgKey(arg));
+				Append("\": ");
+				AppendValue(info, arg);
+			}
+			Append("}");
+		}
+
+		Append("}");
+
+		m_file.Write(m_line, m_length);
+		m_writeComma = true;
+	}
+
+	const char* Extension() const override { return ".json"; }
+
+protected:
+	void WriteHeader() override
+	{
+		m_writeComma = false;
+		m_file.Write("[", 1);
+	}
+
+	void WriteFooter() override
+	{
+		m_file.Write("]", 1);
+	}
+
+private:
+	// Numbers unquoted so Chrome tracing can plot them. JSON has no NaN or infinity, those become strings
+	void AppendValue(const ProfileEventInfo& info, const ProfileArg& arg)
+	{
+		switch (arg.Type)
+		{
+		case ProfileArgType::Int:
+			Format("%lld", static_cast<long long>(arg.Int));
+			break;
+		case ProfileArgType::UInt:
+			Format("%llu", static_cast<unsigned long long>(arg.UInt));
+			break;
+		case ProfileArgType::Double:
+			Format(std::isfinite(arg.Double) ? "%.15g" : "\"%g\"", arg.Double);
+			break;
+		case ProfileArgType::Bool:
+			Append(arg.Bool ? "true" : "false");
+			break;
+		case ProfileArgType::String:
+			Append("\"");
+			AppendEscaped(info.ArgString(arg));
+			Append("\"");
+			break;
+		}
+	}
+
+	// The line is cut at the end of the buffer, which a record can't reach
+	void Append(std::string_view text)
+	{
+		size_t size = std::min(text.size(), sizeof(m_line) - m_length);
+		std::memcpy(m_line + m_length, text.data(), size);
+		m_length += size;
+	}
+
+	void AppendEscaped(std::string_view text)
+	{
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				char escaped[2] = { '\\', c };
+				Append({ escaped, 2 });
+			}
+			else if (static_cast<unsigned char>(c) < 0x20)
+				Format("\\u%04x", static_cast<unsigned>(c));
+			else
+				Append({ &c, 1 });
+		}
+	}
+
+	template<typename... T>
+	void Format(const char* format, T... values)
+	{
+		int written = std::snprintf(m_line + m_length, sizeof(m_line) - m_length, format, values...);
+		if (written > 0)
+			m_length = std::min(m_length + static_cast<size_t>(written), sizeof(m_line) - 1);
+	}
+
+	char m_line[2048];
+	size_t m_length = 0;
+	bool m_writeComma = false;
+};
+
+// Compact binary session, in the recording machine's byte order. An 8 byte header "SATRACE" + version,
+// then records that each start with a tag byte:
+//
+//   'S'  u32 id, u16 length, bytes                            defines a string, before its first use
+//   'E'  u32 name, u32 category, char phase, u8 flags,        one event. Names and categories are string ids,
+//        u32 pid, u32 tid, i64 ts (ns), [u64 id], [char s],   id and s follow only when their flag is set,
+//                                                             flag 4 binds a flow end to its enclosing slice
+//        u8 arg count, then per arg:
+//          u32 key, u8 type, value                          key is a string id. The value is 8 bytes for numbers,
+//                                                           1 for bools, u16 length + bytes for strings
+//
+// An event is about 30 bytes before args, instead of well over 100 as JSON
+namespace BinaryTrace
+{
+	inline constexpr char Magic[7] = { 'S', 'A', 'T', 'R', 'A', 'C', 'E' };
+	inline constexpr uint8_t Version = 3; // 2: ts in nanoseconds, 3: typed args
+
+	inline constexpr char StringTag = 'S';
+	inline constexpr char EventTag = 'E';
+
+	inline constexpr uint8_t HasId = 1;
+	inline constexpr uint8_t HasScope = 2;
+	inline constexpr uint8_t BindToEnclosing = 4; // No payload
+}
+
+class BinaryTraceWriter : public TraceWriter
+{
+public:
+	void Write(const ProfileEventInfo& info) override
+	{
+		// Strings are defined before the event that uses them starts
+		uint32_t name = Intern(info.EventName);
+		uint32_t category = Intern(info.Category);
+		uint32_t keys[ProfileEventInfo::MaxArgs];
+		for (uint8_t i = 0; i < info.ArgCount; i++)
+			keys[i] = Intern(info.ArgKey(info.Args[i]));
+
+		uint8_t flags = 0;
+		if (info.Id.has_value())
+			flags |= BinaryTrace::HasId;
+		if (info.Scope.has_value())
+			flags |= BinaryTrace::HasScope;
+		if (info.BindToEnclosing)
+			flags |= BinaryTrace::BindToEnclosing;
+
+		m_file.WriteValue(BinaryTrace::EventTag);
+		m_file.WriteValue(name);
+		m_file.WriteValue(category);
+		m_file.WriteValue(info.EventType);
+		m_file.WriteValue(flags);
+		m_file.WriteValue(info.ProcessID);
+		m_file.WriteValue(info.ThreadID);
+		m_file.WriteValue(static_cast<int64_t>(info.TimePoint));
+		if (info.Id.has_value())
+			m_file.WriteValue(static_cast<uint64_t>(info.Id.value()));
+		if (info.Scope.has_value())
+			m_file.WriteValue(info.Scope.value());
+		m_file.WriteValue(info.ArgCount);
+		for (uint8_t i = 0; i < info.ArgCount; i++)
+		{
+			const ProfileArg& arg = info.Args[i];
+			m_file.WriteValue(keys[i]);
+			m_file.WriteValue(arg.Type);
+			switch (arg.Type)
+			{
+			case ProfileArgType::Int:
+				m_file.WriteValue(arg.Int);
+				break;
+			case ProfileArgType::UInt:
+				m_file.WriteValue(arg.UInt);
+				break;
+			case ProfileArgType::Double:
+				m_file.WriteValue(arg.Double);
+				break;
+			case ProfileArgType::Bool:
+				m_file.WriteValue(static_cast<uint8_t>(arg.Bool));
+				break;
+			case ProfileArgType::String:
+			{
+				std::string_view value = info.ArgString(arg);
+				m_file.WriteValue(static_cast<uint16_t>(value.size()));
+				m_file.Write(value.data(), value.size());
+				break;
+			}
+			}
+		}
+	}
+
+	const char* Extension() const override { return ".satrace"; }
+
+protected:
+	void WriteHeader() override
+	{
+		m_ids.clear();
+		m_strings.clear();
+		m_file.Write(BinaryTrace::Magic, sizeof(BinaryTrace::Magic));
+		m_file.WriteValue(BinaryTrace::Version);
+	}
+
+private:
+	// Id of the string, writing its definition the first time it is seen
+	uint32_t Intern(std::string_view view)
+	{
+		auto it = m_ids.find(view);
+		if (it != m_ids.end())
+			return it->second;
+
+		uint32_t id = static_cast<uint32_t>(m_strings.size());
+		m_strings.emplace_back(view);
+		m_ids.emplace(m_strings.back(), id);
+
+		m_file.WriteValue(BinaryTrace::StringTag);
+		m_file.WriteValue(id);
+		m_file.WriteValue(static_cast<uint16_t>(view.size()));
+		m_file.Write(view.data(), view.size());
+		return id;
+	}
+
+	std::deque<std::string> m_strings; // Keys of m_ids point in here, a deque never moves them
+	std::unordered_map<std::string_view, uint32_t> m_ids;
+};
+
+inline std::unique_ptr<TraceWriter> TraceWriter::Create(TraceFormat format)
+{
+	if (format == TraceFormat::Binary)
+		return std::make_unique<BinaryTraceWriter>();
+	return std::make_unique<JsonTraceWriter>();
+}
+
+// Reads back a session written by BinaryTraceWriter
+class BinaryTraceReader
+{
+public:
+	BinaryTraceReader() = default;
+	BinaryTraceReader(const BinaryTraceReader&) = delete;
+	BinaryTraceReader& operator=(const BinaryTraceReader&) = delete;
+	~BinaryTraceReader()
+	{
+		if (m_file)
+			std::fclose(m_file);
+	}
+
+	// False if the file can't be read or is not a binary session
+	bool Open(const std::string& path)
+	{
+		m_file = std::fopen(path.c_str(), "rb");
+		if (!m_file)
+			return false;
+
+		std::setvbuf(m_file, nullptr, _IOFBF, TraceFileWriter::BufferSize);
+
+		char magic[sizeof(BinaryTrace::Magic)];
+		uint8_t version = 0;
+		return Read(magic, sizeof(magic)) && std::memcmp(magic, BinaryTrace::Magic, sizeof(magic)) == 0 &&
+			ReadValue(version) && version == BinaryTrace::Version;
+	}
+
+	// Next event, false at the end of the file. Corrupt() tells whether it ended inside a record
+	bool Next(ProfileEventInfo& info)
+	{
+		char tag;
+		while (ReadValue(tag))
+		{
+			if (tag == BinaryTrace::StringTag && ReadString())
+				continue;
+
+			if (tag == BinaryTrace::EventTag && ReadEvent(info))
+				return true;
+
+			// Unknown tag or a record cut short, e.g. the recording process died mid block
+			m_corrupt = true;
+			return false;
+		}
+		return false;
+	}
+
+	bool Corrupt() const { return m_corrupt; }
+
+private:
+	bool Read(void* data, size_t size)
+	{
+		return std::fread(data, 1, size, m_file) == size;
+	}
+
+	template<typename T>
+	bool ReadValue(T& value)
+	{
+		return Read(&value, sizeof(T));
+	}
+
+	bool ReadString()
+	{
+		uint32_t id;
+		uint16_t length;
+		if (!ReadValue(id) || !ReadValue(length))
+			return false;
+
+		std::string text(length, '\0');
+		if (!Read(text.data(), length))
+			return false;
+
+		if (id >= m_strings.size())
+			m_strings.resize(id + 1);
+		m_strings[id] = std::move(text);
+		return true;
+	}
+
+	bool ReadEvent(ProfileEventInfo& info)
+	{
+		uint32_t name, category;
+		uint8_t flags;
+		int64_t timePoint;
+		if (!ReadValue(name) || !ReadValue(category) || !ReadValue(info.EventType) || !ReadValue(flags) ||
+			!ReadValue(info.ProcessID) || !ReadValue(info.ThreadID) || !ReadValue(timePoint))
+			return false;
+
+		if (name >= m_strings.size() || category >= m_strings.size())
+			return false;
+
+		info.TimePoint = timePoint;
+		ProfileEventInfo::CopyText(info.EventName, m_strings[name].data(), m_strings[name].size());
+		ProfileEventInfo::CopyText(info.Category, m_strings[category].data(), m_strings[category].size());
+
+		info.Id.reset();
+		if (flags & BinaryTrace::HasId)
+		{
+			uint64_t id;
+			if (!ReadValue(id))
+				return false;
+			info.Id = static_cast<std::uintptr_t>(id);
+		}
+
+		info.Scope.reset();
+		if (flags & BinaryTrace::HasScope)
+		{
+			char scope;
+			if (!ReadValue(scope))
+				return false;
+			info.Scope = scope;
+		}
+
+		info.BindToEnclosing = (flags & BinaryTrace::BindToEnclosing) != 0;
+
+		uint8_t argCount;
+		if (!ReadValue(argCount))
+			return false;
+
+		info.ClearArgs();
+		for (uint8_t i = 0; i < argCount; i++)
+		{
+			uint32_t key;
+			ProfileArgType type;
+			if (!ReadValue(key) || !ReadValue(type) || key >= m_strings.size())
+				return false;
+
+			switch (type)
+			{
+			case ProfileArgType::Int:
+			{
+				int64_t value;
+				if (!ReadValue(value))
+					return false;
+				info.AddInt(m_strings[key], value);
+				break;
+			}
+			case ProfileArgType::UInt:
+			{
+				uint64_t value;
+				if (!ReadValue(value))
+					return false;
+				info.AddUInt(m_strings[key], value);
+				break;
+			}
+			case ProfileArgType::Double:
+			{
+				double value;
+				if (!ReadValue(value))
+					return false;
+				info.AddDouble(m_strings[key], value);
+				break;
+			}
+			case ProfileArgType::Bool:
+			{
+				uint8_t value;
+				if (!ReadValue(value))
+					return false;
+				info.AddBool(m_strings[key], value != 0);
+				break;
+			}
+			case ProfileArgType::String:
+			{
+				uint16_t length;
+				char value[sizeof(ProfileEventInfo::ArgText)];
+				if (!ReadValue(length) || length > sizeof(value) || !Read(value, length))
+					return false;
+				info.AddString(m_strings[key], { value, length });
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+		return true;
+	}
+
+	FILE* m_file = nullptr;
+	std::vector<std::string> m_strings;
+	bool m_corrupt = false;
+};
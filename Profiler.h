@@ -5,77 +5,508 @@
 #include <map>
 #include <optional>
 #include <sstream>
-#include <queue>
 #include <condition_variable>
 #include <mutex>
 #include <iostream>
 #include <ctime>
-#include <Windows.h> //TODO: cross platform
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <chrono>
+#include <tuple>
+#include <type_traits>
+#include <functional>
+#include "ProfileTrace.h"
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define PROFILE_HAS_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+#endif
 #define PROFILE_ON //Comment this out to disable all profiling
 
-struct ProfileEventInfo
+// Event timestamps in nanoseconds. With an invariant TSC the counter is read directly and scaled by a
+// rate measured when a session starts, a few nanoseconds per event. Otherwise the monotonic OS clock is used
+class ProfileClock
 {
-	std::string EventName;
-	std::string Category;
-	uint32_t ProcessID;
-	uint32_t ThreadID;
-	char EventType;
-	long long TimePoint;
-	std::map<std::string, std::string> Args;
-	std::optional<long long> TimeDuration;
-	std::optional<char> Scope; // Used for instant event
-	std::optional<std::uintptr_t> Id; //Used for custom event
+public:
+	static long long Now()
+	{
+#ifdef PROFILE_HAS_TSC
+		double nanosecondsPerTick = s_nanosecondsPerTick.load(std::memory_order_relaxed);
+		if (nanosecondsPerTick > 0)
+		{
+			int64_t ticks = static_cast<int64_t>(__rdtsc() - s_anchorTicks.load(std::memory_order_relaxed));
+			return s_anchorNanoseconds.load(std::memory_order_relaxed) + static_cast<long long>(static_cast<double>(ticks) * nanosecondsPerTick);
+		}
+#endif
+		return SteadyNanoseconds();
+	}
+
+	// Called by StartSession before recording begins. Spins for 10ms to measure the TSC rate
+	static void Calibrate()
+	{
+#ifdef PROFILE_HAS_TSC
+		if (!HasInvariantTsc())
+			return;
+
+		ReadBoth(); // The first clock read of a process can be slow
+		auto [startTicks, startNanoseconds] = ReadBoth();
+		uint64_t ticks;
+		long long nanoseconds;
+		do
+		{
+			std::tie(ticks, nanoseconds) = ReadBoth();
+		} while (nanoseconds - startNanoseconds < 10000000);
+
+		// Anchor on the end of the measurement so timestamps continue the steady clock
+		s_anchorTicks.store(ticks, std::memory_order_relaxed);
+		s_anchorNanoseconds.store(nanoseconds, std::memory_order_relaxed);
+		s_nanosecondsPerTick.store(static_cast<double>(nanoseconds - startNanoseconds) / static_cast<double>(ticks - startTicks), std::memory_order_relaxed);
+#endif
+	}
+
+private:
+	static long long SteadyNanoseconds()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+#ifdef PROFILE_HAS_TSC
+	// A TSC that ticks at a constant rate through frequency changes and sleep states
+	static bool HasInvariantTsc()
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0x80000000);
+		if (static_cast<unsigned>(info[0]) < 0x80000007)
+			return false;
+		__cpuid(info, 0x80000007);
+		return (info[3] & (1 << 8)) != 0;
+#else
+		unsigned a, b, c, d;
+		if (!__get_cpuid(0x80000007, &a, &b, &c, &d))
+			return false;
+		return (d & (1u << 8)) != 0;
+#endif
+	}
+
+	// The TSC at the middle of a steady clock read, so the pair describes one instant
+	static std::pair<uint64_t, long long> ReadBoth()
+	{
+		uint64_t before = __rdtsc();
+		long long nanoseconds = SteadyNanoseconds();
+		uint64_t after = __rdtsc();
+		return { before + (after - before) / 2, nanoseconds };
+	}
+
+	inline static std::atomic<uint64_t> s_anchorTicks{ 0 };
+	inline static std::atomic<long long> s_anchorNanoseconds{ 0 };
+	inline static std::atomic<double> s_nanosecondsPerTick{ 0 }; // 0 until calibrated, or when the TSC can't be used
+#endif
 };
 
-class ProfileEvent
+// Ids of the calling process and thread, looked up from the OS once
+struct ProfileThread
+{
+	static uint32_t ProcessId()
+	{
+#ifdef _WIN32
+		static const uint32_t id = static_cast<uint32_t>(GetCurrentProcessId());
+#else
+		static const uint32_t id = static_cast<uint32_t>(getpid());
+#endif
+		return id;
+	}
+
+	// The OS thread id, so events line up with debuggers and system profilers
+	static uint32_t ThreadId()
+	{
+		thread_local const uint32_t id = LookUpThreadId();
+		return id;
+	}
+
+	// The name given to the thread (e.g. by ThreadPool::SetThreadName), empty if none
+	static std::string Name()
+	{
+#ifdef _WIN32
+		std::string name;
+		PWSTR wide = nullptr;
+		if (SUCCEEDED(GetThreadDescription(GetCurrentThread(), &wide)))
+		{
+			int size = WideCharToMultiByte(CP_UTF8, 0, wide, -1, nullptr, 0, nullptr, nullptr);
+			if (size > 1)
+			{
+				name.resize(size - 1);
+				WideCharToMultiByte(CP_UTF8, 0, wide, -1, name.data(), size, nullptr, nullptr);
+			}
+			LocalFree(wide);
+		}
+		return name;
+#elif defined(__linux__) || defined(__APPLE__)
+		char name[64] = {};
+		pthread_getname_np(pthread_self(), name, sizeof(name));
+		return name;
+#else
+		return {};
+#endif
+	}
+
+private:
+	static uint32_t LookUpThreadId()
+	{
+#ifdef _WIN32
+		return static_cast<uint32_t>(GetCurrentThreadId());
+#elif defined(__linux__)
+		return static_cast<uint32_t>(syscall(SYS_gettid));
+#elif defined(__APPLE__)
+		uint64_t id = 0;
+		pthread_threadid_np(nullptr, &id);
+		return static_cast<uint32_t>(id);
+#else
+		return static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+#endif
+	}
+};
+
+// Time, process and thread of an event happening now
+inline void StampEvent(ProfileEventInfo& info)
+{
+	info.TimePoint = ProfileClock::Now();
+	info.ProcessID = ProfileThread::ProcessId();
+	info.ThreadID = ProfileThread::ThreadId();
+}
+
+// Bits for Profiler::SetCategoryMask. Scope, custom and instant events are also subject to sampling
+namespace ProfileCategory
+{
+	enum : uint32_t
+	{
+		Scope = 1 << 0,		// PROFILE_SCOPE, PROFILE_FUNC
+		Custom = 1 << 1,	// PROFILE_CUSTOM_START / PROFILE_CUSTOM_ASYNC_START
+		Instant = 1 << 2,	// PROFILE_INSTANT
+		Counter = 1 << 3,	// Profiler::WriteCounter
+		Task = 1 << 4,		// SimpleAsync task tracing
+		Flow = 1 << 5,		// PROFILE_FLOW_START / STEP / END
+		All = 0x7fffffff
+	};
+}
+
+// Keeps a part of the sampled events, decided per thread when an event starts so begin/end pairs stay whole
+struct ProfileSampling
+{
+	uint32_t EveryN = 1;		// Record one event in N, 1 records all
+	uint32_t MaxPerSecond = 0;	// Cap on recorded events per thread and second, 0 for no cap
+};
+
+// Single producer, single consumer ring of event records. The owning thread pushes,
+// the profiler's writer thread drains, neither takes a lock
+class ProfileEventRing
 {
 public:
-	template<typename T, typename... Args>
-	void AddArgs(T firstArg, Args... args)
+	static constexpr size_t Capacity = 2048; // Power of two
+
+	// Owning thread. False when full
+	bool TryPush(const ProfileEventInfo& info)
 	{
-		auto tid = static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+			return false;
 
-		std::stringstream ss;
-		ss << firstArg;
+		m_records[tail & (Capacity - 1)] = info;
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	size_t Size() const
+	{
+		return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+	}
+
+	// Writer thread. Slots are handed back once every record visible now was passed to func
+	template<typename Func>
+	size_t Drain(Func&& func)
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		size_t tail = m_tail.load(std::memory_order_acquire);
+		for (size_t i = head; i != tail; i++)
+			func(m_records[i & (Capacity - 1)]);
+
+		m_head.store(tail, std::memory_order_release);
+		return tail - head;
+	}
+
+	std::atomic<bool> InUse{ true }; // Cleared when the owning thread exits, the ring is then reused
+
+private:
+	std::unique_ptr<ProfileEventInfo[]> m_records = std::make_unique<ProfileEventInfo[]>(Capacity);
+	alignas(64) std::atomic<size_t> m_head{ 0 };
+	alignas(64) std::atomic<size_t> m_tail{ 0 };
+};
 
-		if (m_counter % 2 == 0)
-			m_currentKey = ss.str();
+// Key/value pairs. Numbers, bools and strings are stored as they are, anything else that can be
+// streamed is turned into a string first, which allocates
+struct ProfileArgs
+{
+	template<typename K, typename V, typename... Rest>
+	static void Add(ProfileEventInfo& info, const K& key, const V& value, const Rest&... rest)
+	{
+		if constexpr (std::is_convertible_v<const K&, std::string_view>)
+			AddArg(info, std::string_view(key), value);
 		else
-			m_info.Args[m_currentKey] = ss.str();
-		m_counter++;
-		AddArgs(args...);
+			AddArg(info, ToString(key), value);
+		Add(info, rest...);
 	}
 
-	template <typename T>
-	void AddArgs(T t)
+	template<typename K>
+	static void Add(ProfileEventInfo&, const K&)
 	{
-		auto tid = static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+		static_assert(sizeof(K) == 0, "Added a key with no value!");
+	}
+
+	static void Add(ProfileEventInfo&) {}
+
+private:
+	template<typename V>
+	static void AddArg(ProfileEventInfo& info, std::string_view key, const V& value)
+	{
+		if constexpr (std::is_same_v<V, bool>)
+			info.AddBool(key, value);
+		else if constexpr (std::is_same_v<V, char>)
+			info.AddString(key, std::string_view(&value, 1));
+		else if constexpr (std::is_integral_v<V> && std::is_signed_v<V>)
+			info.AddInt(key, static_cast<int64_t>(value));
+		else if constexpr (std::is_integral_v<V>)
+			info.AddUInt(key, static_cast<uint64_t>(value));
+		else if constexpr (std::is_floating_point_v<V>)
+			info.AddDouble(key, static_cast<double>(value));
+		else if constexpr (std::is_convertible_v<const V&, std::string_view>)
+			info.AddString(key, std::string_view(value));
+		else
+			info.AddString(key, ToString(value));
+	}
 
-		if (m_counter % 2 == 0)
-			throw std::runtime_error("Added a key with no value!");
+	template<typename T>
+	static std::string ToString(const T& value)
+	{
 		std::stringstream ss;
-		ss << t;
-		m_info.Args[m_currentKey] = ss.str();
-		m_counter++;
+		ss << value;
+		return ss.str();
+	}
+};
+
+// Identifies a custom event between its begin and its end. A default one, or one whose event
+// was filtered out, can still be ended and writes nothing
+struct ProfileEventHandle
+{
+	uint32_t Index = 0;
+	uint32_t Generation = 0; // Odd while the event is in flight
+};
+
+// Storage of the in-flight custom events, so a handle finds its event by index. Slots sit in
+// chunks that are never moved or freed while the pool lives, free ones are kept in a lock-free
+// list. A slot's generation is bumped at begin and at end, so a stale handle or a second end of
+// the same event finds a different one and does nothing
+class ProfileEventPool
+{
+public:
+	static constexpr uint32_t ChunkSize = 256;
+	static constexpr uint32_t MaxChunks = 1024; // Beyond this many events in flight new ones are dropped
+
+	ProfileEventPool() = default;
+	ProfileEventPool(const ProfileEventPool&) = delete;
+	ProfileEventPool& operator=(const ProfileEventPool&) = delete;
+
+	~ProfileEventPool()
+	{
+		for (auto& chunk : m_chunks)
+			delete[] chunk.load(std::memory_order_relaxed);
+	}
+
+	// The slot stays unreachable by handles until Publish
+	ProfileEventInfo* Acquire(ProfileEventHandle& handle)
+	{
+		uint64_t head = m_freeHead.load(std::memory_order_acquire);
+		while (static_cast<uint32_t>(head) != 0)
+		{
+			uint32_t index = static_cast<uint32_t>(head) - 1;
+			uint64_t next = ((head >> 32) + 1) << 32 | At(index).NextFree.load(std::memory_order_relaxed);
+			if (m_freeHead.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire))
+				return Take(index, handle);
+		}
+
+		uint32_t chunk = m_chunkCount.fetch_add(1, std::memory_order_relaxed);
+		if (chunk >= MaxChunks)
+		{
+			m_chunkCount.store(MaxChunks, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		// The caller keeps the first slot, the others go to the free list in one go
+		Slot* slots = new Slot[ChunkSize];
+		uint32_t first = chunk * ChunkSize;
+		for (uint32_t i = 1; i + 1 < ChunkSize; i++)
+			slots[i].NextFree.store(first + i + 2, std::memory_order_relaxed);
+		m_chunks[chunk].store(slots, std::memory_order_release);
+		PushFree(first + 1, slots[ChunkSize - 1]);
+		return Take(first, handle);
+	}
+
+	// Makes an acquired slot reachable by its handle
+	void Publish(const ProfileEventHandle& handle)
+	{
+		At(handle.Index).Generation.store(handle.Generation, std::memory_order_release);
+	}
+
+	// Only one caller gets the event of a live handle, nullptr for anyone else
+	ProfileEventInfo* Claim(const ProfileEventHandle& handle)
+	{
+		if ((handle.Generation & 1) == 0 || handle.Index >= MaxChunks * ChunkSize)
+			return nullptr;
+
+		Slot* chunk = m_chunks[handle.Index / ChunkSize].load(std::memory_order_acquire);
+		if (!chunk)
+			return nullptr;
+
+		Slot& slot = chunk[handle.Index % ChunkSize];
+		uint32_t expected = handle.Generation;
+		if (!slot.Generation.compare_exchange_strong(expected, expected + 1, std::memory_order_acquire, std::memory_order_relaxed))
+			return nullptr;
+		return &slot.Info;
+	}
+
+	// Hands a claimed slot back
+	void Release(const ProfileEventHandle& handle)
+	{
+		PushFree(handle.Index, At(handle.Index));
+	}
+
+private:
+	struct Slot
+	{
+		ProfileEventInfo Info;
+		std::atomic<uint32_t> Generation{ 0 };
+		std::atomic<uint32_t> NextFree{ 0 }; // Index + 1 of the next free slot, 0 ends the list
+	};
+
+	Slot& At(uint32_t index)
+	{
+		return m_chunks[index / ChunkSize].load(std::memory_order_acquire)[index % ChunkSize];
 	}
 
-	void AddArgs() {}
+	ProfileEventInfo* Take(uint32_t index, ProfileEventHandle& handle)
+	{
+		Slot& slot = At(index);
+		handle.Index = index;
+		handle.Generation = slot.Generation.load(std::memory_order_relaxed) + 1;
+		return &slot.Info;
+	}
+
+	// Links the run of free slots from first to last in front of the list
+	void PushFree(uint32_t first, Slot& last)
+	{
+		// The low half holds the first free index + 1, the high half counts changes so a pop
+		// can't succeed on a head that was popped and pushed back in between
+		uint64_t head = m_freeHead.load(std::memory_order_relaxed);
+		uint64_t next;
+		do
+		{
+			last.NextFree.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+			next = ((head >> 32) + 1) << 32 | (first + 1);
+		} while (!m_freeHead.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	std::atomic<Slot*> m_chunks[MaxChunks] = {};
+	std::atomic<uint32_t> m_chunkCount{ 0 };
+	std::atomic<uint64_t> m_freeHead{ 0 };
+};
+
+class ProfileEvent
+{
+public:
+	// False when the event was filtered out by the runtime switches, it then writes nothing
+	bool Recording() const { return m_recording; }
+
+	template<typename... KeyValues>
+	void AddArgs(const KeyValues&... keyValues)
+	{
+		if (m_recording)
+			ProfileArgs::Add(m_info, keyValues...);
+	}
 
 protected:
 	ProfileEventInfo m_info;
+	bool m_recording = false;
+};
+
+// Returned by Profiler::BeginCustomEvent, the begin is written at the end of the statement.
+// Args adds key/value pairs and gives back the handle to end the event with
+class CustomEventBegin
+{
+public:
+	CustomEventBegin(const CustomEventBegin&) = delete;
+	CustomEventBegin& operator=(const CustomEventBegin&) = delete;
+	~CustomEventBegin();
+
+	bool Recording() const { return m_info != nullptr; }
+
+	template<typename... KeyValues>
+	ProfileEventHandle Args(const KeyValues&... keyValues)
+	{
+		if (m_info)
+			ProfileArgs::Add(*m_info, keyValues...);
+		return m_handle;
+	}
+
+	operator ProfileEventHandle() const { return m_handle; }
 
 private:
-	int m_counter = 0;
-	std::string m_currentKey;
+	friend class Profiler;
+	CustomEventBegin(const char* name, bool async);
+
+	ProfileEventInfo* m_info = nullptr; // Pool slot, kept until the end
+	ProfileEventHandle m_handle;
 };
 
-class CustomEvent : public ProfileEvent
+// Returned by Profiler::EndCustomEvent, the end is written at the end of the statement
+class CustomEventEnd
 {
 public:
-	CustomEvent(const char* name, bool async = false);
-	~CustomEvent();
+	CustomEventEnd(const CustomEventEnd&) = delete;
+	CustomEventEnd& operator=(const CustomEventEnd&) = delete;
+	~CustomEventEnd();
+
+	bool Recording() const { return m_info != nullptr; }
+
+	template<typename... KeyValues>
+	void Args(const KeyValues&... keyValues)
+	{
+		if (m_info)
+			ProfileArgs::Add(*m_info, keyValues...);
+	}
+
 private:
-	bool m_isAsync = false;
+	friend class Profiler;
+	CustomEventEnd(const ProfileEventHandle& handle);
+
+	ProfileEventInfo* m_info = nullptr;
+	ProfileEventHandle m_handle;
 };
 
 class InstantEvent : public ProfileEvent
@@ -99,7 +530,48 @@ public:
 	Profiler(const Profiler&) = delete;
 	Profiler& operator=(const Profiler&) = delete;
 
-	void StartSession(const std::string& sessionName = "Profile", bool useInfoConsoleLogs = false)
+	// Runtime switches, callable from any thread at any time. Recording happens while a session runs, the
+	// profiler is enabled and the event's category is in the mask. Disabled events cost one relaxed load
+	void SetEnabled(bool enabled)
+	{
+		std::lock_guard l(m_settingsMutex);
+		m_enabled = enabled;
+		UpdateRecordMask();
+	}
+
+	void SetCategoryMask(uint32_t categories)
+	{
+		std::lock_guard l(m_settingsMutex);
+		m_categoryMask = categories & ProfileCategory::All;
+		UpdateRecordMask();
+	}
+
+	void SetSampling(const ProfileSampling& sampling)
+	{
+		std::lock_guard l(m_settingsMutex);
+		s_sampleEveryN.store(std::max<uint32_t>(1, sampling.EveryN), std::memory_order_relaxed);
+		s_sampleMaxPerSecond.store(sampling.MaxPerSecond, std::memory_order_relaxed);
+		UpdateRecordMask();
+	}
+
+	// Whether events of the category are recorded, for instrumentation that writes its own events
+	static bool IsEnabled(uint32_t category)
+	{
+		return (s_recordMask.load(std::memory_order_relaxed) & category) != 0;
+	}
+
+	// IsEnabled, then the sampling decision for one more event on this thread
+	static bool Sample(uint32_t category)
+	{
+		uint32_t mask = s_recordMask.load(std::memory_order_relaxed);
+		if ((mask & category) == 0)
+			return false;
+
+		return (mask & SamplingBit) == 0 || SampleOnThread();
+	}
+
+	// Binary sessions are smaller and cheaper to write, convert them with trace_convert to open them in chrome://tracing
+	void StartSession(const std::string& sessionName = "Profile", bool useInfoConsoleLogs = false, TraceFormat format = TraceFormat::Json)
 	{
 		m_useInternalCommandLogs = useInfoConsoleLogs;
 		if (m_useInternalCommandLogs) std::cout << "PROFILER: Starting session " << sessionName << "\n";
@@ -112,17 +584,32 @@ public:
 			m_thread.reset();
 		}
 
+		// No writer runs now, so this thread can drain: events recorded since the last session are not part of this one
+		DrainRings([](const ProfileEventInfo&) {});
+
+		ProfileClock::Calibrate();
+		m_sessionNumber.fetch_add(1, std::memory_order_relaxed);
+
 		m_threadRunning = true;
-		m_writeComma = false;
+		{
+			std::lock_guard l(m_settingsMutex);
+			m_isSessionActive.store(true);
+			UpdateRecordMask();
+		}
 		if (m_useInternalCommandLogs) std::cout << "PROFILER: Starting writing thread\n";
-		m_thread = std::make_unique<std::thread>(&Profiler::ThreadJob, this, sessionName);
+		m_thread = std::make_unique<std::thread>(&Profiler::ThreadJob, this, sessionName, format);
 	}
 	void EndSession()
 	{
 		if (m_useInternalCommandLogs) std::cout << "PROFILER: Ending session\n";
 
-		//Notify the thread we want to end the session
+		//Stop recording, then notify the thread we want to end the session
 		//Wrap in scope so the lock is released
+		{
+			std::lock_guard l(m_settingsMutex);
+			m_isSessionActive.store(false);
+			UpdateRecordMask();
+		}
 		{
 			std::lock_guard l(m_outstreamMutex);
 			m_threadRunning = false;
@@ -137,255 +624,486 @@ public:
 			m_thread.reset();
 		}
 	}
+	// Lock-free and allocation-free once the calling thread has its ring. Dropped when no session is running
 	void WriteInfo(const ProfileEventInfo& info)
 	{
-		std::unique_lock<std::mutex> l(m_outstreamMutex);
-		m_eventQueue.push(info);
-		m_waitCondition.notify_one();
+		if (!m_isSessionActive.load(std::memory_order_relaxed))
+			return;
+
+		ProfileEventRing& ring = LocalRing();
+
+		// A thread's first event in a session is preceded by its name, shown on its timeline track
+		thread_local uint32_t namedInSession = 0;
+		uint32_t session = m_sessionNumber.load(std::memory_order_relaxed);
+		if (namedInSession != session)
+		{
+			namedInSession = session;
+			std::string name = ProfileThread::Name();
+			if (!name.empty())
+			{
+				ProfileEventInfo metadata;
+				metadata.SetName("thread_name");
+				metadata.SetCategory("__metadata");
+				metadata.EventType = 'M';
+				StampEvent(metadata);
+				metadata.AddString("name", name);
+				Push(ring, metadata);
+			}
+		}
+
+		Push(ring, info);
+	}
+
+	// Writes one event of the given phase at the current time, for instrumented code that tracks
+	// its own begin/end pairs (e.g. SimpleAsync task tracing). The id links async and flow events.
+	// Only the session is checked, the caller checks IsEnabled for its category
+	void WriteEvent(const char* eventName, const char* category, char eventType, std::optional<std::uintptr_t> id = std::nullopt)
+	{
+		ProfileEventInfo info;
+		info.SetName(eventName);
+		info.SetCategory(category);
+		info.EventType = eventType;
+		StampEvent(info);
+		info.Id = id;
+
+		WriteInfo(info);
 	}
 
-	CustomEvent* StartCustomAsyncEvent(const std::string& eventName)
+	// Chrome tracing counter event, each value is drawn as one series of the counter named eventName
+	void WriteCounter(const std::string& eventName, std::initializer_list<std::pair<const char*, double>> values)
 	{
-		std::lock_guard l(m_asyncEventMapMutex);
-		auto ce = new CustomEvent(eventName.c_str(), true);
-		m_customAsyncEvents[eventName] = ce;
-		return ce;
+		WriteCounter(eventName.c_str(), values);
 	}
 
-	void EndCustomAsyncEvent(const std::string& eventName)
+	void WriteCounter(const char* eventName, std::initializer_list<std::pair<const char*, double>> values)
 	{
-		std::lock_guard l(m_asyncEventMapMutex);
-		if (m_customAsyncEvents.find(eventName) != m_customAsyncEvents.end())
-		{
-			delete m_customAsyncEvents[eventName];
-			m_customAsyncEvents.erase(eventName);
-		}
+		if (!IsEnabled(ProfileCategory::Counter))
+			return;
+
+		ProfileEventInfo info;
+		info.SetName(eventName);
+		info.SetCategory("Counter");
+		info.EventType = 'C';
+		StampEvent(info);
+		for (const auto& [key, value] : values)
+			info.AddDouble(key, value);
+
+		WriteInfo(info);
 	}
-	CustomEvent* GetCustomAsyncEvent(const std::string& eventName)
+
+	// Arrow between slices, possibly on different threads. Start, steps and end of one flow share its name
+	// and id, each attaches to the slice it is written in, so write them inside a scope
+	void WriteFlow(const char* eventName, char eventType, std::uintptr_t id)
 	{
-		std::lock_guard l(m_asyncEventMapMutex);
-		if (m_customAsyncEvents.find(eventName) != m_customAsyncEvents.end())
-			return m_customAsyncEvents[eventName];
+		if (!IsEnabled(ProfileCategory::Flow))
+			return;
 
-		throw std::runtime_error("Could not find async event!");
+		ProfileEventInfo info;
+		info.SetName(eventName);
+		info.SetCategory("Flow");
+		info.EventType = eventType;
+		StampEvent(info);
+		info.Id = id;
+		info.BindToEnclosing = eventType == 'f';
+
+		WriteInfo(info);
 	}
 
-	CustomEvent* StartCustomEvent(const std::string& eventName)
+	// Calls sample on the writer thread every intervalMilliseconds while a session runs (at 2ms resolution),
+	// to record counters of something that has no events of its own. It must not add or remove samplers
+	uint32_t AddSampler(std::function<void()> sample, float intervalMilliseconds = 10.0f)
 	{
-		auto ce = new CustomEvent(eventName.c_str());
-		m_customEvents[eventName] = ce;
-		return ce;
+		std::lock_guard l(m_samplersMutex);
+		uint32_t id = ++m_lastSamplerId;
+		m_samplers.push_back({ id, std::move(sample),
+			std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float, std::milli>(intervalMilliseconds)), {} });
+		return id;
+	}
 
+	// Once it returns the sampler is not running and won't run again
+	void RemoveSampler(uint32_t id)
+	{
+		std::lock_guard l(m_samplersMutex);
+		std::erase_if(m_samplers, [id](const Sampler& sampler) { return sampler.Id == id; });
 	}
-	CustomEvent* GetCustomEvent(const std::string& eventName)
+
+	// Custom events begin and end in separate places, possibly on different threads, and the handle
+	// is all the end needs. Any number may be in flight at once, also under the same name. Async
+	// events get their own track and may overlap freely, sync ones are drawn on the beginning
+	// thread's track, so they should end in the reverse order they began there
+	CustomEventBegin BeginCustomEvent(const char* eventName, bool async = false)
 	{
-		if (m_customEvents.find(eventName) != m_customEvents.end())
-			return m_customEvents[eventName];
+		return CustomEventBegin(eventName, async);
+	}
 
-		return nullptr;
+	CustomEventBegin BeginCustomEvent(const std::string& eventName, bool async = false)
+	{
+		return CustomEventBegin(eventName.c_str(), async);
 	}
-	void EndCustomEvent(const std::string& eventName)
+
+	// Ends the event even if recording was switched off since it began. A stale handle, or one
+	// already ended, does nothing
+	CustomEventEnd EndCustomEvent(const ProfileEventHandle& handle)
 	{
-		if (m_customEvents.find(eventName) != m_customEvents.end())
-		{
-			delete m_customEvents[eventName];
-			m_customEvents.erase(eventName);
-		}
+		return CustomEventEnd(handle);
 	}
 
 private:
+	friend class CustomEventBegin;
+	friend class CustomEventEnd;
 
-	std::map<std::string, CustomEvent*> m_customAsyncEvents; //In a separate map, as we need to lock if events are started/ended in different threads
-	std::map<std::string, CustomEvent*> m_customEvents;
-	void ThreadJob(const std::string& sessionName)
+	void ThreadJob(const std::string& sessionName, TraceFormat format)
 	{
-		std::ofstream m_outStream;
+		std::unique_ptr<TraceWriter> writer = TraceWriter::Create(format);
 
 		std::time_t t = std::time(0);   // get time now
 		std::tm* now = std::localtime(&t);
 
 		std::stringstream ss;
 		ss << sessionName << "_" << now->tm_mday << "-" << now->tm_mon << "-" << (now->tm_year + 1900) <<
-			"_" << now->tm_hour << "-" << now->tm_min << "-" << now->tm_sec << ".json";
+			"_" << now->tm_hour << "-" << now->tm_min << "-" << now->tm_sec << writer->Extension();
 
-		m_outStream.open(ss.str());
-		m_outStream << "[";
-		m_outStream.flush();
-		m_isSessionActive = true;
+		// Still drain when the file can't be opened, so recording threads never wait on a full ring
+		if (!writer->Open(ss.str()) && m_useInternalCommandLogs)
+			std::cout << "PROFILER: Could not open " << ss.str() << "\n";
 
+		// Events go out in large blocks. A block is also pushed out once a second when events keep
+		// coming slowly, so a process that dies loses at most the last second
+		auto lastFlush = std::chrono::steady_clock::now();
 		while (true)
 		{
-			if (m_isSessionActive)
+			bool stopping;
 			{
+				// Woken early when a ring fills up, otherwise drains at a steady pace
 				std::unique_lock<std::mutex> l(m_outstreamMutex);
-				m_waitCondition.wait(l, [&] {return !m_eventQueue.empty() || !m_threadRunning; });
-
-				if (!m_threadRunning && m_eventQueue.empty()) break;
-				if (m_eventQueue.empty()) continue;
-				auto localQueue = std::move(m_eventQueue);
-				l.unlock(); //Unlock queue
-				while (!localQueue.empty())
-				{
-					auto info = localQueue.front();
-					localQueue.pop();
-
-					if (!m_threadRunning && m_useInternalCommandLogs)
-						std::cout << "PROFILER: Logs left " << localQueue.size() << std::endl;
-
-					if (m_writeComma)
-						m_outStream << ",\n";
-
-					m_outStream << "{";
-					m_outStream << "\"name\": \"" << info.EventName << "\",";
-					m_outStream << "\"cat\": \"" << info.Category << "\",";
-					m_outStream << "\"ph\": \"" << info.EventType << "\",";
-					m_outStream << "\"pid\": " << info.ProcessID << ",";
-					m_outStream << "\"tid\": " << info.ThreadID << ",";
-					m_outStream << "\"ts\": " << info.TimePoint;
-
-					if (info.Id.has_value())
-						m_outStream << ", \"id\": " << info.Id.value();
-
-					if (info.Scope.has_value())
-						m_outStream << ", \"s\": \"" << info.Scope.value() << "\"";
-
-					if (info.Args.size() > 0)
-					{
-						m_outStream << ",\"args\": {";
-
-						bool first = true;
-						for (auto it = info.Args.begin(); it != info.Args.end(); it++)
-						{
-							if (!first)
-								m_outStream << ",";
-							m_outStream << "\"" << it->first << "\": \"" << it->second << "\"";
-							first = false;
-						}
-						m_outStream << "}";
-					}
-
-					m_outStream << "}";
-					m_writeComma = true;
-					m_outStream.flush();
-				}
+				m_waitCondition.wait_for(l, std::chrono::milliseconds(2), [&] { return !m_threadRunning || m_drainRequested.load(); });
+				stopping = !m_threadRunning;
+			}
+			m_drainRequested.store(false);
+
+			// Recording stopped before m_threadRunning was cleared, so the last pass gets everything
+			size_t written = DrainRings([&](const ProfileEventInfo& info) { writer->Write(info); });
+
+			if (stopping)
+			{
+				if (m_useInternalCommandLogs)
+					std::cout << "PROFILER: Wrote last " << written << " logs" << std::endl;
+				break;
+			}
+
+			auto time = std::chrono::steady_clock::now();
+			RunSamplers(time);
+
+			if (time - lastFlush > std::chrono::seconds(1))
+			{
+				writer->Flush();
+				lastFlush = time;
 			}
-			else
-				m_outStream << "Error: no session was started!\n";
 		}
 
-		m_isSessionActive = false;
-		m_outStream << "]";
-		m_outStream.flush();
-		m_outStream.close();
+		writer->Close();
 	}
 
-	bool m_isSessionActive = false;
-	bool m_writeComma = false;
+	// Writer thread. What they record lands in its own ring, drained on the next pass
+	void RunSamplers(std::chrono::steady_clock::time_point time)
+	{
+		std::lock_guard l(m_samplersMutex);
+		for (Sampler& sampler : m_samplers)
+		{
+			if (time < sampler.Next)
+				continue;
+
+			sampler.Next = time + sampler.Interval;
+			sampler.Sample();
+		}
+	}
+
+	void Push(ProfileEventRing& ring, const ProfileEventInfo& info)
+	{
+		while (!ring.TryPush(info))
+		{
+			// Wait for the writer rather than losing one half of a begin/end pair
+			WakeWriter();
+			if (!m_isSessionActive.load(std::memory_order_relaxed))
+				return;
+			std::this_thread::yield();
+		}
+
+		if (ring.Size() == ProfileEventRing::Capacity / 2)
+			WakeWriter();
+	}
+
+	// Without the mutex, so a wakeup can be missed. The writer then drains on its next 2ms tick
+	void WakeWriter()
+	{
+		if (!m_drainRequested.exchange(true))
+			m_waitCondition.notify_one();
+	}
+
+	void UpdateRecordMask()
+	{
+		uint32_t mask = 0;
+		if (m_enabled && m_isSessionActive.load())
+		{
+			mask = m_categoryMask;
+			if (s_sampleEveryN.load(std::memory_order_relaxed) > 1 || s_sampleMaxPerSecond.load(std::memory_order_relaxed) > 0)
+				mask |= SamplingBit;
+		}
+		s_recordMask.store(mask, std::memory_order_relaxed);
+	}
+
+	static bool SampleOnThread()
+	{
+		thread_local uint32_t seen = 0;
+		thread_local long long windowStart = 0;
+		thread_local uint32_t keptInWindow = 0;
+
+		uint32_t everyN = s_sampleEveryN.load(std::memory_order_relaxed);
+		if (everyN > 1 && seen++ % everyN != 0)
+			return false;
+
+		uint32_t maxPerSecond = s_sampleMaxPerSecond.load(std::memory_order_relaxed);
+		if (maxPerSecond == 0)
+			return true;
+
+		long long now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		if (now - windowStart >= 1000)
+		{
+			windowStart = now;
+			keptInWindow = 0;
+		}
+		return keptInWindow++ < maxPerSecond;
+	}
+
+	// The calling thread's ring, taken from the pool on its first event and given back when it exits
+	ProfileEventRing& LocalRing()
+	{
+		struct Lease
+		{
+			ProfileEventRing* Ring = nullptr;
+			~Lease()
+			{
+				if (Ring)
+					Ring->InUse.store(false, std::memory_order_release);
+			}
+		};
+
+		thread_local Lease lease;
+		if (!lease.Ring)
+			lease.Ring = AcquireRing();
+		return *lease.Ring;
+	}
+
+	ProfileEventRing* AcquireRing()
+	{
+		std::lock_guard l(m_ringsMutex);
+		for (auto& ring : m_rings)
+		{
+			// A ring left by an exited thread is reused once its last events were written
+			if (!ring->InUse.load(std::memory_order_acquire) && ring->Size() == 0)
+			{
+				ring->InUse.store(true, std::memory_order_relaxed);
+				return ring.get();
+			}
+		}
+
+		m_rings.push_back(std::make_unique<ProfileEventRing>());
+		return m_rings.back().get();
+	}
+
+	// Only one thread drains at a time: the writer thread, or StartSession while none runs
+	template<typename Func>
+	size_t DrainRings(Func&& func)
+	{
+		std::vector<ProfileEventRing*> rings;
+		{
+			std::lock_guard l(m_ringsMutex);
+			for (auto& ring : m_rings)
+				rings.push_back(ring.get());
+		}
+
+		size_t drained = 0;
+		for (ProfileEventRing* ring : rings)
+			drained += ring->Drain(func);
+		return drained;
+	}
+
+	static constexpr uint32_t SamplingBit = 0x80000000; // In s_recordMask when sampling is configured
+
+	inline static std::atomic<uint32_t> s_recordMask{ 0 }; // Categories recorded right now, 0 when off or no session runs
+	inline static std::atomic<uint32_t> s_sampleEveryN{ 1 };
+	inline static std::atomic<uint32_t> s_sampleMaxPerSecond{ 0 };
+	struct Sampler
+	{
+		uint32_t Id;
+		std::function<void()> Sample;
+		std::chrono::steady_clock::duration Interval;
+		std::chrono::steady_clock::time_point Next;
+	};
+
+	std::vector<Sampler> m_samplers;
+	uint32_t m_lastSamplerId = 0;
+	std::mutex m_samplersMutex; // Held while samplers run, so RemoveSampler waits for a running one
+	std::atomic<uint32_t> m_sessionNumber{ 0 }; // Counts sessions, so each thread names itself once in each
+	std::atomic<bool> m_isSessionActive = false; // Events are written only while set, so a started event still gets its end
+	bool m_enabled = true;
+	uint32_t m_categoryMask = ProfileCategory::All;
+	std::mutex m_settingsMutex; // Guards the runtime switches while s_recordMask is rebuilt
 	bool m_threadRunning = false;
 	bool m_useInternalCommandLogs = false;
 	std::unique_ptr<std::thread> m_thread; // Writing thread
-	std::queue< ProfileEventInfo> m_eventQueue; // List of events to write
-	std::mutex m_outstreamMutex; // Used to lock list of events to write
-	std::mutex m_asyncEventMapMutex; // Used to lock the map of async events
-	std::condition_variable m_waitCondition; // Synchronize the list of events};
+	std::vector<std::unique_ptr<ProfileEventRing>> m_rings; // One per recording thread, never freed while the profiler lives
+	std::mutex m_ringsMutex; // Only taken when a thread gets its ring and to list them
+	std::mutex m_outstreamMutex; // Guards m_threadRunning, the writer waits on it
+	ProfileEventPool m_customEvents; // Custom events in flight
+	std::condition_variable m_waitCondition; // Wakes the writer early
+	std::atomic<bool> m_drainRequested = false; // Set by a recording thread whose ring is filling up
 };
 
 class ScopeEvent : public ProfileEvent
 {
 public:
+	// Kept small so the check inlines, a filtered out scope costs one relaxed load
 	ScopeEvent(const char* name)
 	{
-		auto now = std::chrono::high_resolution_clock::now();
+		if (Profiler::Sample(ProfileCategory::Scope))
+			Begin(name);
+	}
+	~ScopeEvent()
+	{
+		if (m_recording)
+			End();
+	}
 
-		m_info.Category = "Scope";
-		m_info.EventName = name;
+private:
+	void Begin(const char* name)
+	{
+		m_recording = true;
+		m_info.SetCategory("Scope");
+		m_info.SetName(name);
 		m_info.EventType = 'B';
-		m_info.TimePoint = std::chrono::time_point_cast<std::chrono::microseconds>(now).time_since_epoch().count();
-		m_info.ProcessID = static_cast<uint32_t>(GetCurrentProcessId());
-		m_info.ThreadID = static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+		StampEvent(m_info);
 
 		Profiler::Instance().WriteInfo(m_info);
 	}
-	~ScopeEvent()
-	{
-		auto now = std::chrono::high_resolution_clock::now();
 
-		m_info.Category = "Scope";
+	void End()
+	{
+		m_info.SetCategory("Scope");
 		m_info.EventType = 'E';
-		m_info.TimePoint = std::chrono::time_point_cast<std::chrono::microseconds>(now).time_since_epoch().count();
-		m_info.ProcessID = static_cast<uint32_t>(GetCurrentProcessId());
-		m_info.ThreadID = static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+		StampEvent(m_info);
 		Profiler::Instance().WriteInfo(m_info);
 	}
 };
 
-// Custom event
-inline CustomEvent::CustomEvent(const char* name, bool async) : m_isAsync(async)
+// Custom events
+inline CustomEventBegin::CustomEventBegin(const char* name, bool async)
 {
-	auto now = std::chrono::high_resolution_clock::now();
+	if (!Profiler::Sample(ProfileCategory::Custom))
+		return;
 
-	m_info.Category = "Custom";
-	m_info.EventName = name;
-	m_info.EventType = async ? 'b' : 'B';
-	m_info.TimePoint = std::chrono::time_point_cast<std::chrono::microseconds>(now).time_since_epoch().count();
-	m_info.ProcessID = static_cast<uint32_t>(GetCurrentProcessId());
-	m_info.ThreadID = static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
-	m_info.Id = reinterpret_cast<std::uintptr_t>(this);
+	m_info = Profiler::Instance().m_customEvents.Acquire(m_handle);
+	if (!m_info)
+		return;
 
-	Profiler::Instance().WriteInfo(m_info);
+	m_info->SetCategory("Custom");
+	m_info->SetName(name);
+	m_info->EventType = async ? 'b' : 'B';
+	m_info->ClearArgs();
+	StampEvent(*m_info);
+	if (async)
+		m_info->Id = static_cast<std::uintptr_t>(static_cast<uint64_t>(m_handle.Generation) << 32 | m_handle.Index);
+	else
+		m_info->Id.reset();
 }
 
-inline CustomEvent::~CustomEvent()
+inline CustomEventBegin::~CustomEventBegin()
 {
-	auto now = std::chrono::high_resolution_clock::now();
-
-	m_info.Category = "Custom";
-	m_info.EventType = m_isAsync ? 'e' : 'E';
-	m_info.TimePoint = std::chrono::time_point_cast<std::chrono::microseconds>(now).time_since_epoch().count();
-	m_info.ProcessID = static_cast<uint32_t>(GetCurrentProcessId());
-	m_info.ThreadID = static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
-	Profiler::Instance().WriteInfo(m_info);
+	if (!m_info)
+		return;
+
+	Profiler& profiler = Profiler::Instance();
+	profiler.WriteInfo(*m_info);
+	m_info->ClearArgs(); // The end only carries its own
+	profiler.m_customEvents.Publish(m_handle);
+}
+
+inline CustomEventEnd::CustomEventEnd(const ProfileEventHandle& handle) : m_handle(handle)
+{
+	m_info = Profiler::Instance().m_customEvents.Claim(handle);
+	if (!m_info)
+		return;
+
+	// Keeps the begin's thread, the viewer pairs a sync end with the begin on that track
+	m_info->EventType = m_info->EventType == 'b' ? 'e' : 'E';
+	m_info->TimePoint = ProfileClock::Now();
+}
+
+inline CustomEventEnd::~CustomEventEnd()
+{
+	if (!m_info)
+		return;
+
+	Profiler& profiler = Profiler::Instance();
+	profiler.WriteInfo(*m_info);
+	profiler.m_customEvents.Release(m_handle);
 }
 
 // Instant Event
 inline InstantEvent::InstantEvent(const char* name)
 {
-	auto now = std::chrono::high_resolution_clock::now();
+	if (!Profiler::Sample(ProfileCategory::Instant))
+		return;
 
-	m_info.EventName = name;
-	m_info.Category = "Instant";
+	m_recording = true;
+	m_info.SetName(name);
+	m_info.SetCategory("Instant");
 	m_info.EventType = 'i';
 
-	m_info.ProcessID = static_cast<uint32_t>(GetCurrentProcessId());
-	m_info.ThreadID = static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
-	m_info.TimePoint = std::chrono::time_point_cast<std::chrono::microseconds>(now).time_since_epoch().count();
+	StampEvent(m_info);
 	m_info.Scope = 't'; //Default is thread scope
 }
 
 inline InstantEvent::~InstantEvent()
 {
-	Profiler::Instance().WriteInfo(m_info);
+	if (m_recording)
+		Profiler::Instance().WriteInfo(m_info);
 }
 
 #ifdef PROFILE_ON
 #define PROFILE_BEGIN(fileName) Profiler::Instance().StartSession(fileName)
 #define PROFILE_BEGIN_WLOGS(fileName) Profiler::Instance().StartSession(fileName,true)
+#define PROFILE_BEGIN_BINARY(fileName) Profiler::Instance().StartSession(fileName,false,TraceFormat::Binary)
 #define PROFILE_END() Profiler::Instance().EndSession()
-#define PROFILE_FUNC(...) ScopeEvent __event__(__FUNCSIG__); __event__.AddArgs(__VA_ARGS__)
-#define PROFILE_SCOPE(eventName,...) ScopeEvent __event__(eventName); __event__.AddArgs(__VA_ARGS__)
-#define PROFILE_CUSTOM_ASYNC_START(eventName,...) Profiler::Instance().StartCustomAsyncEvent(eventName)->AddArgs(__VA_ARGS__)
-#define PROFILE_CUSTOM_ASYNC_END(eventName,...){ Profiler::Instance().GetCustomAsyncEvent(eventName)->AddArgs(__VA_ARGS__);  Profiler::Instance().EndCustomAsyncEvent(eventName);}
-#define PROFILE_CUSTOM_START(eventName,...) Profiler::Instance().StartCustomEvent(eventName)->AddArgs(__VA_ARGS__)
-#define PROFILE_CUSTOM_END(eventName,...) {Profiler::Instance().GetCustomEvent(eventName)->AddArgs(__VA_ARGS__); Profiler::Instance().EndCustomEvent(eventName); }
-#define PROFILE_INSTANT(eventName,...) {InstantEvent __event__(eventName); __event__.AddArgs(__VA_ARGS__);}
+#ifdef _MSC_VER
+#define PROFILE_FUNCTION_SIGNATURE __FUNCSIG__
+#else
+#define PROFILE_FUNCTION_SIGNATURE __PRETTY_FUNCTION__
+#endif
+#define PROFILE_FUNC(...) ScopeEvent __event__(PROFILE_FUNCTION_SIGNATURE); if (__event__.Recording()) __event__.AddArgs(__VA_ARGS__)
+#define PROFILE_SCOPE(eventName,...) ScopeEvent __event__(eventName); if (__event__.Recording()) __event__.AddArgs(__VA_ARGS__)
+#define PROFILE_CUSTOM_ASYNC_START(eventName,...) Profiler::Instance().BeginCustomEvent(eventName, true).Args(__VA_ARGS__)
+#define PROFILE_CUSTOM_ASYNC_END(handle,...) Profiler::Instance().EndCustomEvent(handle).Args(__VA_ARGS__)
+#define PROFILE_CUSTOM_START(eventName,...) Profiler::Instance().BeginCustomEvent(eventName).Args(__VA_ARGS__)
+#define PROFILE_CUSTOM_END(handle,...) Profiler::Instance().EndCustomEvent(handle).Args(__VA_ARGS__)
+#define PROFILE_INSTANT(eventName,...) {InstantEvent __event__(eventName); if (__event__.Recording()) __event__.AddArgs(__VA_ARGS__);}
+#define PROFILE_COUNTER(eventName,...) Profiler::Instance().WriteCounter(eventName, { __VA_ARGS__ })
+#define PROFILE_FLOW_START(eventName,id) Profiler::Instance().WriteFlow(eventName, 's', static_cast<std::uintptr_t>(id))
+#define PROFILE_FLOW_STEP(eventName,id) Profiler::Instance().WriteFlow(eventName, 't', static_cast<std::uintptr_t>(id))
+#define PROFILE_FLOW_END(eventName,id) Profiler::Instance().WriteFlow(eventName, 'f', static_cast<std::uintptr_t>(id))
 #else
 #define PROFILE_BEGIN(fileName)
+#define PROFILE_BEGIN_BINARY(fileName)
 #define PROFILE_END()
 #define PROFILE_FUNC(...)
 #define PROFILE_SCOPE(eventName,...)
-#define PROFILE_CUSTOM_ASYNC_START(eventName,...)
-#define PROFILE_CUSTOM_ASYNC_END(eventName,...)
-#define PROFILE_CUSTOM_START(eventName,...)
-#define PROFILE_CUSTOM_END(eventName,...)
+#define PROFILE_CUSTOM_ASYNC_START(eventName,...) ProfileEventHandle{}
+#define PROFILE_CUSTOM_ASYNC_END(handle,...) ((void)(handle))
+#define PROFILE_CUSTOM_START(eventName,...) ProfileEventHandle{}
+#define PROFILE_CUSTOM_END(handle,...) ((void)(handle))
 #define PROFILE_INSTANT(eventName,...)
+#define PROFILE_COUNTER(eventName,...)
+#define PROFILE_FLOW_START(eventName,id)
+#define PROFILE_FLOW_STEP(eventName,id)
+#define PROFILE_FLOW_END(eventName,id)
 #endif
\ No newline at end of file
@@ -3,328 +3,3417 @@
 #include <future>
 #include <unordered_map>
 #include <mutex>
+#include <shared_mutex>
 #include <functional>
 #include <chrono>
+#include <optional>
+#include <queue>
+#include <list>
+#include <typeindex>
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <coroutine>
 #include "ThreadPool.h"
+#ifdef SIMPLEASYNC_TRACE
+#include "Profiler.h"
+#endif
 
 namespace 
 {
 	const std::string DefaultPoolName = "DefaultPool";
 }
 
+// Identifies a task. The generation tells apart tasks that reused the same slot
+struct TaskHandle
+{
+	static constexpr uint32_t InvalidIndex = 0xFFFFFFFF;
+
+	uint32_t Index = InvalidIndex;
+	uint32_t Generation = 0;
+
+	bool IsValid() const { return Index != InvalidIndex; }
+	bool operator==(const TaskHandle& other) const = default;
+};
+
+struct AsyncOptions;
+
+// Handle that also knows the task's result type, returned by CreateTask and used to chain dependent tasks
+template<class T>
+struct TypedTaskHandle : TaskHandle
+{
+	TypedTaskHandle() = default;
+	explicit TypedTaskHandle(TaskHandle handle) : TaskHandle(handle) {}
+
+	// Runs task(token, progress, result) on a worker as soon as this task finishes
+	template<typename Func, typename Callback>
+	auto Then(Func&& task, Callback&& resultCB, const AsyncOptions& opt) const;
+
+	template<typename Func, typename Callback>
+	auto Then(Func&& task, Callback&& resultCB) const;
+
+	template<typename Func>
+	auto Then(Func&& task) const;
+
+	// co_await from a coroutine resumes it on a pool with the result, without holding a worker meanwhile
+	auto operator co_await() const;
+};
+
+// Error a task resolves with when it was canceled before a worker started it
+struct TaskCanceledError : std::runtime_error
+{
+	TaskCanceledError() : std::runtime_error("Task was canceled before it started") {}
+};
+
+// Error a task resolves with when a full pool dropped it, see OverflowPolicy::DropOldest
+struct TaskDroppedError : std::runtime_error
+{
+	TaskDroppedError() : std::runtime_error("Task was dropped from a full queue") {}
+};
+
+class CancellationCallback;
+
+struct CancellationState
+{
+	CancellationState() = default;
+	CancellationState(const CancellationState&) = delete;
+	CancellationState& operator=(const CancellationState&) = delete;
+	~CancellationState();
+
+	std::atomic<bool> Canceled{ false };
+
+	// Sets the flag and runs the registered callbacks on this thread, only the first call has an effect
+	void Cancel();
+
+private:
+	friend class CancellationCallback;
+
+	// Returns false if already canceled, the caller then runs the callback itself
+	bool Register(CancellationCallback* callback);
+	// Returns false if Cancel() is running the callback on another thread, it clears the callback's token once done
+	bool Unregister(CancellationCallback* callback);
+
+	void Lock()
+	{
+		while (m_lock.test_and_set(std::memory_order_acquire))
+			std::this_thread::yield();
+	}
+
+	void Unlock()
+	{
+		m_lock.clear(std::memory_order_release);
+	}
+
+	// Serializes a callback detaching with its token being destroyed, e.g. a parent and a child task retired on two threads.
+	// Picked by the token's address, so it can be taken without touching a token that may be gone already
+	static std::mutex& DetachLock(const CancellationState* state)
+	{
+		return s_detachLocks[(reinterpret_cast<std::uintptr_t>(state) >> 6) % DetachLockCount];
+	}
+
+	static constexpr size_t DetachLockCount = 64;
+	inline static std::mutex s_detachLocks[DetachLockCount];
+
+	std::atomic_flag m_lock;
+	CancellationCallback* m_callbacks = nullptr;
+	bool m_hadCallbacks = false; // A callback may still refer to the token
+	CancellationCallback* m_running = nullptr; // Callback Cancel() is invoking right now, outside the lock
+	std::thread::id m_runningThread;
+};
+
+// Runs a function when the token gets canceled, like std::stop_callback. Runs immediately if it already was.
+// Used to interrupt blocking work (close a socket, notify a condition variable) instead of waiting for the next poll.
+// The destructor unregisters it and waits if the callback is running on another thread
+class CancellationCallback
+{
+public:
+	template<typename F>
+	CancellationCallback(CancellationState* token, F&& callback)
+		: m_callback(std::forward<F>(callback)), m_state(token)
+	{
+		if (token && !token->Register(this))
+		{
+			m_state.store(nullptr, std::memory_order_relaxed);
+			m_callback();
+		}
+	}
+
+	~CancellationCallback()
+	{
+		CancellationState* state = m_state.load(std::memory_order_acquire);
+		if (!state)
+			return;
+
+		{
+			// The token's destructor clears m_state under the same lock before the token goes away
+			std::lock_guard<std::mutex> lock(CancellationState::DetachLock(state));
+			if (m_state.load(std::memory_order_relaxed) != state || state->Unregister(this))
+				return;
+		}
+
+		// Running on another thread. Waits on our own state, the token may be gone once Cancel() returned
+		while (m_state.load(std::memory_order_acquire))
+			std::this_thread::yield();
+	}
+
+	CancellationCallback(const CancellationCallback&) = delete;
+	CancellationCallback& operator=(const CancellationCallback&) = delete;
+
+private:
+	friend struct CancellationState;
+
+	InplaceFunction<void(), 32> m_callback;
+	std::atomic<CancellationState*> m_state;
+	CancellationCallback* m_prev = nullptr;
+	CancellationCallback* m_next = nullptr;
+	bool m_linked = false; // Still in the token's list, Cancel() has not taken it
+};
+
+inline CancellationState::~CancellationState()
+{
+	// Callbacks outliving their token (a child linked to a parent that is freed first) simply detach
+	Lock();
+	bool hadCallbacks = m_hadCallbacks;
+	Unlock();
+	if (!hadCallbacks)
+		return;
+
+	std::lock_guard<std::mutex> detach(DetachLock(this));
+	Lock();
+	CancellationCallback* callback = m_callbacks;
+	while (callback)
+	{
+		// Last access, its destructor may free it as soon as it sees the token gone
+		CancellationCallback* next = callback->m_next;
+		callback->m_state.store(nullptr, std::memory_order_release);
+		callback = next;
+	}
+	m_callbacks = nullptr;
+	Unlock();
+}
+
+inline void CancellationState::Cancel()
+{
+	if (Canceled.exchange(true))
+		return;
+
+	Lock();
+	while (CancellationCallback* callback = m_callbacks)
+	{
+		m_callbacks = callback->m_next;
+		if (m_callbacks)
+			m_callbacks->m_prev = nullptr;
+		callback->m_linked = false;
+
+		m_running = callback;
+		m_runningThread = std::this_thread::get_id();
+		Unlock();
+
+		try
+		{
+			callback->m_callback();
+		}
+		catch (...)
+		{
+		}
+
+		// It no longer refers to this token, unless it destroyed itself while running
+		Lock();
+		if (m_running == callback)
+			callback->m_state.store(nullptr, std::memory_order_release);
+		m_running = nullptr;
+	}
+	Unlock();
+}
+
+inline bool CancellationState::Register(CancellationCallback* callback)
+{
+	Lock();
+	if (Canceled.load(std::memory_order_relaxed))
+	{
+		Unlock();
+		return false;
+	}
+
+	callback->m_next = m_callbacks;
+	if (m_callbacks)
+		m_callbacks->m_prev = callback;
+	m_callbacks = callback;
+	callback->m_linked = true;
+	m_hadCallbacks = true;
+	Unlock();
+	return true;
+}
+
+inline bool CancellationState::Unregister(CancellationCallback* callback)
+{
+	Lock();
+	if (callback->m_linked)
+	{
+		if (callback->m_prev)
+			callback->m_prev->m_next = callback->m_next;
+		else
+			m_callbacks = callback->m_next;
+		if (callback->m_next)
+			callback->m_next->m_prev = callback->m_prev;
+		Unlock();
+		return true;
+	}
+
+	// Already taken by Cancel(). Destroying itself from its own callback, Cancel() must not touch it afterwards
+	bool done = m_running != callback || m_runningThread == std::this_thread::get_id();
+	if (m_running == callback && done)
+		m_running = nullptr;
+	Unlock();
+	return done;
+}
+
+// A task's progress. The task calls Report(), and Update() hands each change to the progress callback once
+class ProgressValue
+{
+public:
+	// Only a changed value flags the task, and only the first change since Update() last picked it up takes a lock
+	void Report(float value)
+	{
+		if (m_value.exchange(value, std::memory_order_relaxed) == value)
+			return;
+
+		if (m_notify && !m_dirty.exchange(true, std::memory_order_acq_rel))
+			m_notify(m_owner);
+	}
+
+	float Get() const
+	{
+		return m_value.load(std::memory_order_relaxed);
+	}
+
+private:
+	friend class SimpleAsync;
+
+	// Set once at registration, before any worker can report
+	void Watch(TaskHandle owner, void(*notify)(TaskHandle))
+	{
+		m_owner = owner;
+		m_notify = notify;
+	}
+
+	// A change Update() has not picked up yet
+	bool Pending() const
+	{
+		return m_dirty.load(std::memory_order_acquire);
+	}
+
+	// Flags the current value again, false when it still was
+	bool Reflag()
+	{
+		return !m_dirty.exchange(true, std::memory_order_acq_rel);
+	}
+
+	// Clears the flag before reading, so a report racing with it flags the task again
+	float Consume()
+	{
+		m_dirty.exchange(false, std::memory_order_acq_rel);
+		return m_value.load(std::memory_order_relaxed);
+	}
+
+	std::atomic<float> m_value{ 0 };
+	std::atomic<bool> m_dirty{ false };
+	TaskHandle m_owner;
+	void(*m_notify)(TaskHandle) = nullptr;
+};
+
+// Both point into the task's own storage and stay valid while the task runs
+using CancellationToken = CancellationState*;
+using Progress = ProgressValue*;
+
+// Where a task's result callback runs
+enum class CallbackExecutor
+{
+	Update,	// Queued for the thread calling SimpleAsync::Update(), the default
+	Inline,	// On the worker that finished the task, right after it
+	Pool	// Enqueued on AsyncOptions::CallbackPool
+};
+
+class AsyncTaskWrapper;
+class TaskSlab;
+
+// Task lifecycle events for the Profiler, compiled in when SIMPLEASYNC_TRACE is defined before including SimpleAsync.h.
+// Each task gets an async span from submission until it finished, a slice on the worker while it runs,
+// and a flow arrow from its submission to its callback
+struct TaskTrace
+{
+	static std::uintptr_t Id(TaskHandle handle)
+	{
+		return (static_cast<std::uintptr_t>(handle.Generation) << 32) | handle.Index;
+	}
+
+#ifdef SIMPLEASYNC_TRACE
+	// Recorded while the profiler's Task category is on. Switching it while tasks run can cut a pair in half
+	static void Submitted(const char* name, TaskHandle handle)
+	{
+		if (!Profiler::IsEnabled(ProfileCategory::Task))
+			return;
+
+		Profiler::Instance().WriteEvent(name, "Task", 'b', Id(handle));
+		Profiler::Instance().WriteEvent(name, "TaskFlow", 's', Id(handle));
+	}
+
+	static void RunStarted(const char* name)
+	{
+		if (!Profiler::IsEnabled(ProfileCategory::Task))
+			return;
+
+		Profiler::Instance().WriteEvent(name, "TaskRun", 'B');
+	}
+
+	static void RunFinished(const char* name)
+	{
+		if (!Profiler::IsEnabled(ProfileCategory::Task))
+			return;
+
+		Profiler::Instance().WriteEvent(name, "TaskRun", 'E');
+	}
+
+	static void Completed(const char* name, TaskHandle handle)
+	{
+		if (!Profiler::IsEnabled(ProfileCategory::Task))
+			return;
+
+		Profiler::Instance().WriteEvent(name, "Task", 'e', Id(handle));
+	}
+
+	// The flow end comes first, so it binds to the callback slice that follows
+	static void CallbackStarted(const char* name, TaskHandle handle)
+	{
+		if (!Profiler::IsEnabled(ProfileCategory::Task))
+			return;
+
+		Profiler::Instance().WriteEvent(name, "TaskFlow", 'f', Id(handle));
+		Profiler::Instance().WriteEvent(name, "TaskCallback", 'B');
+	}
+
+	static void CallbackFinished(const char* name)
+	{
+		if (!Profiler::IsEnabled(ProfileCategory::Task))
+			return;
+
+		Profiler::Instance().WriteEvent(name, "TaskCallback", 'E');
+	}
+#else
+	static void Submitted(const char*, TaskHandle) {}
+	static void RunStarted(const char*) {}
+	static void RunFinished(const char*) {}
+	static void Completed(const char*, TaskHandle) {}
+	static void CallbackStarted(const char*, TaskHandle) {}
+	static void CallbackFinished(const char*) {}
+#endif
+};
+
+// Something waiting on a task's result, resolved exactly once by the thread that completes the task
+class TaskContinuation
+{
+public:
+	virtual ~TaskContinuation() = default;
+	virtual void Resolve(AsyncTaskWrapper* parent) = 0;
+
+	TaskContinuation* NextContinuation = nullptr;
+};
+
 class AsyncTaskWrapper 
 {
 public:
 	virtual ~AsyncTaskWrapper() = default;
 	virtual bool CheckAndExecuteCallback() = 0;
 	virtual void ForceWait() = 0;
-	virtual uint32_t GetId() const = 0;
+	virtual void Run() = 0; // Worker thread
+
+	TaskHandle GetId() const { return ID; }
+
+	TaskHandle ID;
+	CancellationState TokenState;
+	ProgressValue ProgressState;
+	std::exception_ptr Error; // Set instead of a result when the task threw or one of its inputs failed
+	bool CallbackInvoked = false;
+	bool Drained = false; // Picked up by Update() or ForceWait(), continuations can no longer read the result
+	TaskSlab* Slab = nullptr; // Slab the storage comes from, null when heap allocated
+	uint8_t SlabClass = 0; // Size class of the slab block
+	std::unique_ptr<CancellationCallback> ParentLink; // Cancels this task along with AsyncOptions::Parent
+	CallbackExecutor Executor = CallbackExecutor::Update;
+	ThreadPool* ExecutorPool = nullptr;
+	ThreadPool* Pool = nullptr; // Runs the task, outcomes like cancellation are counted in its metrics
+	const char* TraceName = "Task";
+	AsyncTaskWrapper* NextCompleted = nullptr; // Intrusive link for the completion queue
+
+	// Returns false if the task already completed, the caller then resolves the continuation itself
+	bool AddContinuation(TaskContinuation* continuation)
+	{
+		TaskContinuation* head = m_continuations.load(std::memory_order_acquire);
+		do
+		{
+			if (head == Sealed())
+				return false;
+
+			continuation->NextContinuation = head;
+		} while (!m_continuations.compare_exchange_weak(head, continuation, std::memory_order_acq_rel, std::memory_order_acquire));
+		return true;
+	}
+
+	// Called once the result is stored, before anything else can consume it
+	void RunContinuations()
+	{
+		TaskContinuation* continuation = m_continuations.exchange(Sealed(), std::memory_order_acq_rel);
+		while (continuation)
+		{
+			TaskContinuation* next = continuation->NextContinuation;
+			continuation->Resolve(this);
+			continuation = next;
+		}
+	}
+
+	void MarkDone()
+	{
+		m_done.store(true, std::memory_order_release);
+	}
+
+	// Static so that signaling never touches a wrapper that may already be freed
+	static void NotifyWaiters()
+	{
+		if (s_waiters.load() > 0)
+		{
+			{ std::scoped_lock l(s_doneMutex); }
+			s_doneCondition.notify_all();
+		}
+	}
+
+protected:
+	bool IsDone() const
+	{
+		return m_done.load(std::memory_order_acquire);
+	}
+
+	void WaitUntilDone()
+	{
+		if (IsDone()) return;
+
+		s_waiters.fetch_add(1);
+		{
+			std::unique_lock l(s_doneMutex);
+			s_doneCondition.wait(l, [this]() { return IsDone(); });
+		}
+		s_waiters.fetch_sub(1);
+	}
+
+private:
+	static TaskContinuation* Sealed()
+	{
+		return reinterpret_cast<TaskContinuation*>(static_cast<std::uintptr_t>(1));
+	}
+
+	std::atomic<bool> m_done{ false };
+	std::atomic<TaskContinuation*> m_continuations{ nullptr };
+
+	inline static std::mutex s_doneMutex;
+	inline static std::condition_variable s_doneCondition;
+	inline static std::atomic<uint32_t> s_waiters{ 0 };
+};
+
+// Intrusive lock-free multi-producer single-consumer list of finished tasks.
+// Workers push with a CAS, the consumer takes everything with a single exchange
+class CompletionQueue
+{
+public:
+	// Last access to the task from the worker, the consumer may free it right after
+	void Push(AsyncTaskWrapper* task)
+	{
+		AsyncTaskWrapper* head = m_head.load(std::memory_order_relaxed);
+		do
+		{
+			task->NextCompleted = head;
+		} while (!m_head.compare_exchange_weak(head, task, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	// Returns the drained tasks linked in completion order
+	AsyncTaskWrapper* PopAll()
+	{
+		AsyncTaskWrapper* head = m_head.exchange(nullptr, std::memory_order_acquire);
+
+		AsyncTaskWrapper* ordered = nullptr;
+		while (head)
+		{
+			AsyncTaskWrapper* next = head->NextCompleted;
+			head->NextCompleted = ordered;
+			ordered = head;
+			head = next;
+		}
+		return ordered;
+	}
+
+private:
+	std::atomic<AsyncTaskWrapper*> m_head{ nullptr };
+};
+
+enum class TimeoutDispatch
+{
+	Update,		// Timeout callback runs on the thread calling SimpleAsync::Update()
+	TimerThread	// Timeout callback runs on a dedicated timer thread, no Update() needed
+};
+
+struct AsyncOptions
+{
+	float TimeoutMilliseconds;
+	std::function<void(TaskHandle)> TimeoutCallback;
+	std::function<void(float)> ProgressCallback;
+	float ProgressMinDelta = 0; // Changes smaller than this are skipped, except reaching 1 or the task's last value
+	float ProgressMinIntervalMilliseconds = 0; // Between two progress callbacks, a newer value waits for the next Update() unless the task finished
+	TimeoutDispatch TimeoutMode = TimeoutDispatch::Update;
+	TaskPriority Priority = TaskPriority::Normal;
+	TaskHandle Parent; // Canceling the parent (a task or a group) cancels this task too
+	CallbackExecutor Executor = CallbackExecutor::Update;
+	std::string CallbackPool; // Pool name for CallbackExecutor::Pool, empty means the default pool
+	const char* Name = "Task"; // Label of the task's trace events with SIMPLEASYNC_TRACE, must outlive the task
+};
+
+// Limits for a single SimpleAsync::Update() call, 0 means no limit
+struct UpdateBudget
+{
+	float MaxMilliseconds = 0;
+	uint32_t MaxCallbacks = 0;
+};
+
+struct TimeoutEntry
+{
+	std::chrono::steady_clock::time_point Deadline;
+	TaskHandle Handle;
+
+	bool operator>(const TimeoutEntry& other) const { return Deadline > other.Deadline; }
+};
+
+// Min-heap on deadline. Entries of tasks retired before their deadline are skipped if they expire,
+// and removed in bulk by their owner once they make up half of the heap
+class TimeoutHeap
+{
+public:
+	bool Empty() const { return m_entries.empty(); }
+	size_t Size() const { return m_entries.size(); }
+	const TimeoutEntry& Top() const { return m_entries.front(); }
+
+	void Push(const TimeoutEntry& entry)
+	{
+		m_entries.push_back(entry);
+		std::push_heap(m_entries.begin(), m_entries.end(), std::greater<TimeoutEntry>());
+	}
+
+	void Pop()
+	{
+		std::pop_heap(m_entries.begin(), m_entries.end(), std::greater<TimeoutEntry>());
+		m_entries.pop_back();
+	}
+
+	template<typename Predicate>
+	void RemoveIf(Predicate&& stale)
+	{
+		m_entries.erase(std::remove_if(m_entries.begin(), m_entries.end(), std::forward<Predicate>(stale)), m_entries.end());
+		std::make_heap(m_entries.begin(), m_entries.end(), std::greater<TimeoutEntry>());
+	}
+
+	void Clear()
+	{
+		m_entries.clear();
+	}
+
+private:
+	std::vector<TimeoutEntry> m_entries;
 };
 
-struct AsyncOptions
-{
-	float TimeoutMilliseconds;
-	std::function<void(uint32_t)> TimeoutCallback;
-	std::function<void(float)> ProgressCallback;
-};
+// Owns the thread serving TimeoutDispatch::TimerThread, started on first use
+class TimeoutThread
+{
+public:
+	using FireFunction = void(*)(TaskHandle);
+
+	~TimeoutThread()
+	{
+		Stop();
+	}
+
+	void Add(const TimeoutEntry& entry, FireFunction fire)
+	{
+		{
+			std::scoped_lock l(m_mutex);
+			m_fire = fire;
+			if (!m_thread.joinable())
+			{
+				m_stop = false;
+				m_thread = std::thread([this]() { ThreadJob(); });
+			}
+			m_heap.Push(entry);
+		}
+		m_condition.notify_one();
+	}
+
+	// The task retired before its deadline. Such entries are removed together once they are half of the heap
+	void Forget(TaskHandle handle)
+	{
+		std::scoped_lock l(m_mutex);
+		m_forgotten.push_back(handle);
+		if (m_forgotten.size() * 2 <= m_heap.Size())
+			return;
+
+		auto before = [](TaskHandle a, TaskHandle b) { return a.Index != b.Index ? a.Index < b.Index : a.Generation < b.Generation; };
+		std::sort(m_forgotten.begin(), m_forgotten.end(), before);
+		m_heap.RemoveIf([&](const TimeoutEntry& entry) { return std::binary_search(m_forgotten.begin(), m_forgotten.end(), entry.Handle, before); });
+		m_forgotten.clear();
+	}
+
+	size_t Size()
+	{
+		std::scoped_lock l(m_mutex);
+		return m_heap.Size();
+	}
+
+	void Stop()
+	{
+		{
+			std::scoped_lock l(m_mutex);
+			m_stop = true;
+		}
+		m_condition.notify_one();
+		if (m_thread.joinable())
+			m_thread.join();
+
+		m_heap.Clear();
+		m_forgotten.clear();
+	}
+
+private:
+	void ThreadJob()
+	{
+		ThreadPool::SetThreadName("AsyncTimer", 0);
+
+		std::unique_lock l(m_mutex);
+		while (!m_stop)
+		{
+			if (m_heap.Empty())
+			{
+				m_condition.wait(l);
+				continue;
+			}
+
+			auto deadline = m_heap.Top().Deadline;
+			if (std::chrono::steady_clock::now() < deadline)
+			{
+				m_condition.wait_until(l, deadline);
+				continue;
+			}
+
+			TaskHandle handle = m_heap.Top().Handle;
+			FireFunction fire = m_fire;
+			m_heap.Pop();
+
+			l.unlock();
+			fire(handle);
+			l.lock();
+		}
+	}
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	TimeoutHeap m_heap;
+	std::vector<TaskHandle> m_forgotten; // Retired tasks whose entries may still be in the heap
+	FireFunction m_fire = nullptr;
+	bool m_stop = false;
+};
+
+template<class T>
+class ConcreteAsyncTaskWrapper : public AsyncTaskWrapper 
+{
+public:
+	InplaceFunction<T(CancellationToken, Progress), 64> Work;
+	InplaceFunction<void(T), 48> Callback;
+	std::optional<T> Result;
+
+	template<typename W, typename C>
+	ConcreteAsyncTaskWrapper(W&& work, C&& callback)
+		: Work(std::forward<W>(work)), Callback(std::forward<C>(callback)) {}
+
+	void Run() override
+	{
+		if (!Error && TokenState.Canceled.load(std::memory_order_relaxed))
+		{
+			Error = std::make_exception_ptr(TaskCanceledError());
+			if (Pool)
+				Pool->RecordCanceled();
+		}
+
+		if (Error)
+		{
+			// An input failed or the task was canceled while queued, the work never runs
+			Work = nullptr;
+			return;
+		}
+
+		try
+		{
+			Result.emplace(Work(&TokenState, &ProgressState));
+		}
+		catch (...)
+		{
+			Error = std::current_exception();
+		}
+		Work = nullptr;
+	}
+
+	void ForceWait() override {
+		if (!CallbackInvoked) 
+		{
+			WaitUntilDone();
+			CallbackInvoked = true;
+			InvokeCallback();
+		}
+	}
+
+	bool CheckAndExecuteCallback() override 
+	{
+		if (!IsDone())
+			return false;
+
+		if (!CallbackInvoked) 
+		{
+			CallbackInvoked = true;
+			InvokeCallback();
+		}
+		return true;
+	}
+
+private:
+	void InvokeCallback()
+	{
+		try
+		{
+			if (!Error && Callback) Callback(std::move(*Result));
+		}
+		catch (...)
+		{
+			// std::cerr << "AsyncTask Exception: " << e.what() << std::endl;
+		}
+	}
+};
+
+// Block allocator for task wrappers, steady-state submission reuses blocks instead of hitting the heap.
+// A wrapper takes the smallest size class it fits, results and group items grow it past the base task.
+// Tasks can be created from workers and coroutines, so the free lists have their own short lock
+class TaskSlab
+{
+public:
+	static constexpr size_t ClassSizes[] = { 384, 512, 768 };
+	static constexpr size_t ClassCount = std::size(ClassSizes);
+	static constexpr size_t BlocksPerChunk = 64;
+
+	// ClassCount when the size fits none, the wrapper then comes from the heap
+	static constexpr size_t ClassFor(size_t size)
+	{
+		size_t sizeClass = 0;
+		while (sizeClass < ClassCount && ClassSizes[sizeClass] < size)
+			sizeClass++;
+		return sizeClass;
+	}
+
+	void* Allocate(size_t sizeClass)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_freeLists[sizeClass])
+			Grow(sizeClass);
+
+		Block* b = m_freeLists[sizeClass];
+		m_freeLists[sizeClass] = b->Next;
+		return b;
+	}
+
+	void Free(void* p, size_t sizeClass)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Push(static_cast<Block*>(p), sizeClass);
+	}
+
+private:
+	struct Block
+	{
+		Block* Next;
+	};
+
+	// Class sizes are multiples of max_align_t, so every block in a chunk is aligned like the chunk
+	void Grow(size_t sizeClass)
+	{
+		size_t blockSize = ClassSizes[sizeClass];
+		auto& chunk = m_chunks.emplace_back(std::make_unique<unsigned char[]>(blockSize * BlocksPerChunk));
+		for (size_t i = 0; i < BlocksPerChunk; i++)
+			Push(::new (chunk.get() + i * blockSize) Block, sizeClass);
+	}
+
+	void Push(Block* b, size_t sizeClass)
+	{
+		b->Next = m_freeLists[sizeClass];
+		m_freeLists[sizeClass] = b;
+	}
+
+	std::mutex m_mutex;
+	std::vector<std::unique_ptr<unsigned char[]>> m_chunks;
+	Block* m_freeLists[ClassCount] = {};
+};
+
+static_assert(std::all_of(std::begin(TaskSlab::ClassSizes), std::end(TaskSlab::ClassSizes),
+	[](size_t size) { return size % alignof(std::max_align_t) == 0; }), "Slab blocks must stay aligned");
+
+// Tasks with the common result types are allocated from the slab
+static_assert(TaskSlab::ClassFor(sizeof(ConcreteAsyncTaskWrapper<int>)) < TaskSlab::ClassCount, "Task wrappers outgrew the slab");
+static_assert(TaskSlab::ClassFor(sizeof(ConcreteAsyncTaskWrapper<std::string>)) < TaskSlab::ClassCount, "Task wrappers outgrew the slab");
+static_assert(TaskSlab::ClassFor(sizeof(ConcreteAsyncTaskWrapper<std::vector<int>>)) < TaskSlab::ClassCount, "Task wrappers outgrew the slab");
+
+// State shared by every CoTask promise, whatever the result type
+struct CoPromiseBase
+{
+	ThreadPool* Pool = nullptr; // Where awaits resume the coroutine
+	std::coroutine_handle<> Continuation; // Coroutine awaiting this one, if nested
+	AsyncTaskWrapper* Owner = nullptr; // Top level only, the registered task this coroutine completes
+	void(*Finish)(AsyncTaskWrapper* owner, std::exception_ptr error) = nullptr;
+	std::exception_ptr Error;
+
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept { return false; }
+
+		template<typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+		{
+			CoPromiseBase& promise = handle.promise();
+			if (promise.Continuation)
+				return promise.Continuation;
+
+			// The frame may be freed by Update() as soon as Finish publishes the task, nothing touches it afterwards
+			if (promise.Owner)
+				promise.Finish(promise.Owner, promise.Error);
+			return std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept {}
+	};
+};
+
+// Coroutine returned by functions using co_await/co_return. It starts suspended: launch it with
+// SimpleAsync::CreateCoroutine, or co_await it from another coroutine to run it inline
+template<class T>
+class CoTask
+{
+	static_assert(!std::is_void_v<T>, "CoTask needs a result type, like any other task");
+
+public:
+	struct promise_type : CoPromiseBase
+	{
+		std::optional<T> Result;
+
+		CoTask get_return_object() { return CoTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		FinalAwaiter final_suspend() noexcept { return {}; }
+
+		template<typename V>
+		void return_value(V&& value) { Result.emplace(std::forward<V>(value)); }
+
+		void unhandled_exception() { Error = std::current_exception(); }
+	};
+
+	CoTask(CoTask&& other) noexcept : m_coroutine(std::exchange(other.m_coroutine, nullptr)) {}
+	CoTask(const CoTask&) = delete;
+	CoTask& operator=(const CoTask&) = delete;
+
+	CoTask& operator=(CoTask&& other) noexcept
+	{
+		if (this != &other)
+		{
+			if (m_coroutine)
+				m_coroutine.destroy();
+			m_coroutine = std::exchange(other.m_coroutine, nullptr);
+		}
+		return *this;
+	}
+
+	~CoTask()
+	{
+		if (m_coroutine)
+			m_coroutine.destroy();
+	}
+
+	// Hands the frame over, the caller is now responsible for destroying it
+	std::coroutine_handle<promise_type> Release()
+	{
+		return std::exchange(m_coroutine, nullptr);
+	}
+
+	// Runs the awaited coroutine right away on the awaiting thread, then resumes the awaiter with its result
+	auto operator co_await() && noexcept
+	{
+		return Awaiter{ m_coroutine };
+	}
+
+private:
+	struct Awaiter
+	{
+		std::coroutine_handle<promise_type> Coroutine;
+
+		bool await_ready() const noexcept { return false; }
+
+		template<typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> awaiting) noexcept
+		{
+			Coroutine.promise().Continuation = awaiting;
+			if constexpr (std::is_base_of_v<CoPromiseBase, Promise>)
+				Coroutine.promise().Pool = awaiting.promise().Pool;
+			return Coroutine;
+		}
+
+		T await_resume()
+		{
+			if (Coroutine.promise().Error)
+				std::rethrow_exception(Coroutine.promise().Error);
+			return std::move(*Coroutine.promise().Result);
+		}
+	};
+
+	explicit CoTask(std::coroutine_handle<promise_type> coroutine) : m_coroutine(coroutine) {}
+
+	std::coroutine_handle<promise_type> m_coroutine;
+};
+
+class SimpleAsync
+{
+public:
+	
+	template<typename Func, typename Callback, typename... Args>
+	static auto CreateTask(Func&& task,	Callback&& callback, AsyncOptions opt , Args&&... args)
+	{
+		return CreateTaskInPool(
+			m_defaultPoolName,
+			std::forward<Func>(task),
+			std::forward<Callback>(callback),
+			opt,
+			std::forward<Args>(args)...);
+	}
+
+	template<typename Func, typename... Args>
+	static auto CreateTask(Func&& task, AsyncOptions opt, Args&&... args)
+	{
+		return CreateTaskInPool(
+			m_defaultPoolName,
+			std::forward<Func>(task),
+			[](auto&&) {},
+			opt,
+			std::forward<Args>(args)...);
+	}
+
+	template<typename Func, typename... Args>
+	static auto CreateTaskInPool(const std::string& poolName, Func&& task, AsyncOptions opt, Args&&... args)
+	{
+		return CreateTaskInPool(
+			poolName,
+			std::forward<Func>(task),
+			[](auto&&) {},
+			opt,
+			std::forward<Args>(args)...);
+	}
+
+	// In a full bounded pool the pool's overflow policy applies. With OverflowPolicy::Fail the returned
+	// handle resolves with QueueFullError, with DropOldest a dropped task resolves with TaskDroppedError
+	template<typename Func, typename Callback, typename... Args>
+	static auto CreateTaskInPool(const std::string& poolName, Func&& task, Callback resultCB, AsyncOptions opt, Args&&... args)
+	{
+		return SubmitTask<false>(false, poolName, std::string(), std::forward<Func>(task), std::move(resultCB), opt, std::forward<Args>(args)...);
+	}
+
+	// Never waits for room, drops or runs inline: when the pool's bounded queue is full no task is created
+	// and the returned handle is invalid, whatever the overflow policy
+	template<typename Func, typename Callback, typename... Args>
+	static auto TryCreateTask(Func&& task, Callback&& callback, AsyncOptions opt, Args&&... args)
+	{
+		return TryCreateTaskInPool(
+			m_defaultPoolName,
+			std::forward<Func>(task),
+			std::forward<Callback>(callback),
+			opt,
+			std::forward<Args>(args)...);
+	}
+
+	template<typename Func, typename... Args>
+	static auto TryCreateTask(Func&& task, AsyncOptions opt, Args&&... args)
+	{
+		return TryCreateTaskInPool(
+			m_defaultPoolName,
+			std::forward<Func>(task),
+			[](auto&&) {},
+			opt,
+			std::forward<Args>(args)...);
+	}
+
+	template<typename Func, typename... Args>
+	static auto TryCreateTaskInPool(const std::string& poolName, Func&& task, AsyncOptions opt, Args&&... args)
+	{
+		return TryCreateTaskInPool(
+			poolName,
+			std::forward<Func>(task),
+			[](auto&&) {},
+			opt,
+			std::forward<Args>(args)...);
+	}
+
+	template<typename Func, typename Callback, typename... Args>
+	static auto TryCreateTaskInPool(const std::string& poolName, Func&& task, Callback resultCB, AsyncOptions opt, Args&&... args)
+	{
+		return SubmitTask<false>(true, poolName, std::string(), std::forward<Func>(task), std::move(resultCB), opt, std::forward<Args>(args)...);
+	}
+
+	// Like CreateTask, but submissions with the same key and result type share one run. While one is in flight the others
+	// wait for it and get a copy of its result, see SetResultCacheCapacity. The result type must be copyable
+	template<typename Func, typename Callback, typename... Args>
+	static auto CreateSharedTask(const std::string& key, Func&& task, Callback&& callback, AsyncOptions opt, Args&&... args)
+	{
+		return CreateSharedTaskInPool(
+			m_defaultPoolName,
+			key,
+			std::forward<Func>(task),
+			std::forward<Callback>(callback),
+			opt,
+			std::forward<Args>(args)...);
+	}
+
+	template<typename Func, typename... Args>
+	static auto CreateSharedTask(const std::string& key, Func&& task, AsyncOptions opt, Args&&... args)
+	{
+		return CreateSharedTaskInPool(
+			m_defaultPoolName,
+			key,
+			std::forward<Func>(task),
+			[](auto&&) {},
+			opt,
+			std::forward<Args>(args)...);
+	}
+
+	template<typename Func, typename... Args>
+	static auto CreateSharedTaskInPool(const std::string& poolName, const std::string& key, Func&& task, AsyncOptions opt, Args&&... args)
+	{
+		return CreateSharedTaskInPool(
+			poolName,
+			key,
+			std::forward<Func>(task),
+			[](auto&&) {},
+			opt,
+			std::forward<Args>(args)...);
+	}
+
+	// If the run being shared is canceled, a submission still waiting runs the task itself and the others follow it
+	template<typename Func, typename Callback, typename... Args>
+	static auto CreateSharedTaskInPool(const std::string& poolName, const std::string& key, Func&& task, Callback resultCB, AsyncOptions opt, Args&&... args)
+	{
+		return SubmitTask<true>(false, poolName, key, std::forward<Func>(task), std::move(resultCB), opt, std::forward<Args>(args)...);
+	}
+
+	// Runs task(token, progress, parentResult) on a worker of the pool as soon as the parent finishes, without going through Update().
+	// Has to be attached before the parent's own callback ran, as that callback consumes the result
+	template<typename T, typename Func, typename Callback>
+	static auto ThenInPool(const std::string& poolName, TypedTaskHandle<T> parent, Func&& task, Callback resultCB, AsyncOptions opt = {})
+	{
+		ThreadPool* pool = GetPool(poolName);
+
+		using ReturnType = decltype(task(std::declval<CancellationToken>(), std::declval<Progress>(), std::declval<T>()));
+		static_assert(std::is_invocable_r_v<void, Callback, ReturnType>, "Callback must have one argument of the same type as the returned type of the task");
+
+		auto* child = AllocateTask<ThenTaskWrapper<T, ReturnType>>(std::forward<Func>(task), std::forward<Callback>(resultCB), pool, opt.Priority);
+		TaskPtr owned(child);
+
+		TaskHandle handle;
+		bool ready;
+		{
+			uint32_t shard = HomeShard();
+			RegistryLock lock(RegistrationMask(shard, opt) | ShardMask(parent));
+			AsyncTaskWrapper* parentTask = FindUnconsumedTask(parent);
+			handle = RegisterTask(std::move(owned), pool, opt, shard);
+
+			// Parent already finished, its result is copied under the lock
+			ready = !parentTask->AddContinuation(child);
+			if (ready)
+				child->Take(parentTask);
+		}
+
+		// Scheduled without the locks, a failed input delivers right away and an inline callback takes them again
+		if (ready)
+			child->Start();
+
+		return TypedTaskHandle<ReturnType>(handle);
+	}
+
+	template<typename T, typename Func, typename Callback>
+	static auto Then(TypedTaskHandle<T> parent, Func&& task, Callback resultCB, AsyncOptions opt = {})
+	{
+		return ThenInPool(m_defaultPoolName, parent, std::forward<Func>(task), std::forward<Callback>(resultCB), opt);
+	}
+
+	template<typename T, typename Func>
+	static auto Then(TypedTaskHandle<T> parent, Func&& task, AsyncOptions opt = {})
+	{
+		return ThenInPool(m_defaultPoolName, parent, std::forward<Func>(task), [](auto&&) {}, opt);
+	}
+
+	// Runs task(token, progress, std::vector<T> results) once every parent finished, results in the order of parents.
+	// If any parent threw, the task does not run and its callback is skipped
+	template<typename T, typename Func, typename Callback>
+	static auto WhenAllInPool(const std::string& poolName, const std::vector<TypedTaskHandle<T>>& parents, Func&& task, Callback resultCB, AsyncOptions opt = {})
+	{
+		ThreadPool* pool = GetPool(poolName);
+
+		using ReturnType = decltype(task(std::declval<CancellationToken>(), std::declval<Progress>(), std::declval<std::vector<T>>()));
+		static_assert(std::is_invocable_r_v<void, Callback, ReturnType>, "Callback must have one argument of the same type as the returned type of the task");
+
+		auto* child = AllocateTask<WhenAllTaskWrapper<T, ReturnType>>(std::forward<Func>(task), std::forward<Callback>(resultCB), pool, opt.Priority, parents.size());
+		TaskPtr owned(child);
+
+		uint32_t shard = HomeShard();
+		uint32_t shards = RegistrationMask(shard, opt);
+		for (const auto& parent : parents)
+			shards |= ShardMask(parent);
+
+		TaskHandle handle;
+		bool ready = parents.empty();
+		{
+			RegistryLock lock(shards);
+			std::vector<AsyncTaskWrapper*> parentTasks;
+			parentTasks.reserve(parents.size());
+			for (const auto& parent : parents)
+				parentTasks.push_back(FindUnconsumedTask(parent));
+
+			handle = RegisterTask(std::move(owned), pool, opt, shard);
+
+			for (size_t i = 0; i < parentTasks.size(); i++)
+			{
+				if (!parentTasks[i]->AddContinuation(&child->Links[i]) && child->TakeInput(i, parentTasks[i]))
+					ready = true;
+			}
+		}
+
+		// This thread resolved the last input, scheduled without the locks as with Then()
+		if (ready)
+			child->Start();
+
+		return TypedTaskHandle<ReturnType>(handle);
+	}
+
+	template<typename T, typename Func, typename Callback>
+	static auto WhenAll(const std::vector<TypedTaskHandle<T>>& parents, Func&& task, Callback resultCB, AsyncOptions opt = {})
+	{
+		return WhenAllInPool(m_defaultPoolName, parents, std::forward<Func>(task), std::forward<Callback>(resultCB), opt);
+	}
+
+	template<typename T, typename Func>
+	static auto WhenAll(const std::vector<TypedTaskHandle<T>>& parents, Func&& task, AsyncOptions opt = {})
+	{
+		return WhenAllInPool(m_defaultPoolName, parents, std::forward<Func>(task), [](auto&&) {}, opt);
+	}
+
+	// Runs task(token, progress, firstResult) as soon as the first parent finishes, the other results are ignored.
+	// If the first parent to finish threw, the task does not run and its callback is skipped
+	template<typename T, typename Func, typename Callback>
+	static auto WhenAnyInPool(const std::string& poolName, const std::vector<TypedTaskHandle<T>>& parents, Func&& task, Callback resultCB, AsyncOptions opt = {})
+	{
+		ThreadPool* pool = GetPool(poolName);
+		if (parents.empty())
+			throw std::runtime_error("WhenAny needs at least one task");
+
+		using ReturnType = decltype(task(std::declval<CancellationToken>(), std::declval<Progress>(), std::declval<T>()));
+		static_assert(std::is_invocable_r_v<void, Callback, ReturnType>, "Callback must have one argument of the same type as the returned type of the task");
+
+		auto* child = AllocateTask<ThenTaskWrapper<T, ReturnType>>(std::forward<Func>(task), std::forward<Callback>(resultCB), pool, opt.Priority);
+		TaskPtr owned(child);
+
+		uint32_t shard = HomeShard();
+		uint32_t shards = RegistrationMask(shard, opt);
+		for (const auto& parent : parents)
+			shards |= ShardMask(parent);
+
+		TaskHandle handle;
+		bool ready = false;
+		{
+			RegistryLock lock(shards);
+			std::vector<AsyncTaskWrapper*> parentTasks;
+			parentTasks.reserve(parents.size());
+			for (const auto& parent : parents)
+				parentTasks.push_back(FindUnconsumedTask(parent));
+
+			handle = RegisterTask(std::move(owned), pool, opt, shard);
+
+			// The links outlive the child, which may be retired while slower parents are still running
+			auto* race = new WhenAnyState<T, ReturnType>(child, parentTasks.size());
+			for (size_t i = 0; i < parentTasks.size(); i++)
+			{
+				if (!parentTasks[i]->AddContinuation(&race->Links[i]) && race->TakeInput(parentTasks[i]))
+					ready = true;
+			}
+		}
+
+		// This thread won the race, scheduled without the locks as with Then()
+		if (ready)
+			child->Start();
+
+		return TypedTaskHandle<ReturnType>(handle);
+	}
+
+	template<typename T, typename Func, typename Callback>
+	static auto WhenAny(const std::vector<TypedTaskHandle<T>>& parents, Func&& task, Callback resultCB, AsyncOptions opt = {})
+	{
+		return WhenAnyInPool(m_defaultPoolName, parents, std::forward<Func>(task), std::forward<Callback>(resultCB), opt);
+	}
+
+	template<typename T, typename Func>
+	static auto WhenAny(const std::vector<TypedTaskHandle<T>>& parents, Func&& task, AsyncOptions opt = {})
+	{
+		return WhenAnyInPool(m_defaultPoolName, parents, std::forward<Func>(task), [](auto&&) {}, opt);
+	}
+
+	// Starts the coroutine on a worker of the pool and registers it like a task: the callback gets its co_return value
+	// on the main thread, and the handle can be waited on or chained. While suspended it holds no worker thread
+	template<typename T, typename Callback>
+	static TypedTaskHandle<T> CreateCoroutineInPool(const std::string& poolName, CoTask<T> coroutine, Callback resultCB, AsyncOptions opt = {})
+	{
+		ThreadPool* pool = GetPool(poolName);
+		static_assert(std::is_invocable_r_v<void, Callback, T>, "Callback must have one argument of the same type as the coroutine's result");
+
+		auto handle = coroutine.Release();
+		auto* asyncTask = AllocateTask<CoroutineTaskWrapper<T>>(handle, std::move(resultCB));
+		CoPromiseBase& promise = handle.promise();
+		promise.Pool = pool;
+		promise.Owner = asyncTask;
+		promise.Finish = [](AsyncTaskWrapper* owner, std::exception_ptr error)
+			{
+				owner->Error = error;
+				Execute(owner);
+			};
+
+		TaskHandle id;
+		{
+			uint32_t shard = HomeShard();
+			RegistryLock lock(RegistrationMask(shard, opt));
+			id = RegisterTask(TaskPtr(asyncTask), pool, opt, shard);
+		}
+
+		try
+		{
+			pool->Enqueue([handle]() { handle.resume(); }, opt.Priority, DropHandler(asyncTask));
+		}
+		catch (const QueueFullError&)
+		{
+			asyncTask->Error = std::current_exception();
+			Execute(asyncTask);
+		}
+		catch (...)
+		{
+			asyncTask->Error = std::current_exception();
+			Execute(asyncTask);
+			throw;
+		}
+
+		return TypedTaskHandle<T>(id);
+	}
+
+	template<typename T, typename Callback>
+	static TypedTaskHandle<T> CreateCoroutine(CoTask<T> coroutine, Callback resultCB, AsyncOptions opt = {})
+	{
+		return CreateCoroutineInPool(m_defaultPoolName, std::move(coroutine), std::move(resultCB), opt);
+	}
+
+	template<typename T>
+	static TypedTaskHandle<T> CreateCoroutine(CoTask<T> coroutine, AsyncOptions opt = {})
+	{
+		return CreateCoroutineInPool(m_defaultPoolName, std::move(coroutine), [](auto&&) {}, opt);
+	}
+
+	// co_await SimpleAsync::SwitchTo("PoolName") resumes the coroutine on a worker of that pool,
+	// later awaits in the same coroutine resume there too
+	struct PoolSwitch
+	{
+		ThreadPool* Target;
+		TaskPriority Priority;
+
+		bool await_ready() const noexcept { return false; }
+
+		template<typename Promise>
+		void await_suspend(std::coroutine_handle<Promise> coroutine)
+		{
+			ThreadPool* previous = nullptr;
+			if constexpr (std::is_base_of_v<CoPromiseBase, Promise>)
+			{
+				// Set before enqueuing, the coroutine may already run on the target when Enqueue returns
+				previous = std::exchange(coroutine.promise().Pool, Target);
+			}
+
+			try
+			{
+				Target->EnqueueUnbounded([coroutine]() { coroutine.resume(); }, Priority);
+			}
+			catch (...)
+			{
+				if constexpr (std::is_base_of_v<CoPromiseBase, Promise>)
+					coroutine.promise().Pool = previous;
+				throw;
+			}
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	static PoolSwitch SwitchTo(const std::string& poolName, TaskPriority priority = TaskPriority::Normal)
+	{
+		return PoolSwitch{ GetPool(poolName), priority };
+	}
+
+	// Returned by co_await on a TypedTaskHandle. Registers as a continuation of the task, so it has
+	// to be awaited before Update() picks the task up, as with Then(). SimpleAsync::Async has no such window
+	template<class T>
+	class HandleAwaiter : public TaskContinuation
+	{
+	public:
+		explicit HandleAwaiter(TaskHandle handle) : m_handle(handle) {}
+		HandleAwaiter() = default;
+
+		bool await_ready() const noexcept { return false; }
+
+		template<typename Promise>
+		bool await_suspend(std::coroutine_handle<Promise> coroutine)
+		{
+			SetResumePool(coroutine);
+
+			std::lock_guard<std::mutex> lock(ShardFor(m_handle).Mutex);
+			AsyncTaskWrapper* task = FindUnconsumedTask(m_handle);
+			if (task->AddContinuation(this))
+				return true;
+
+			// Already finished, the lock keeps Update() from consuming the result while it is copied
+			ReadResult(task);
+			return false;
+		}
+
+		T await_resume()
+		{
+			if (m_error)
+				std::rethrow_exception(m_error);
+			return std::move(*m_result);
+		}
+
+		// Task's worker thread
+		void Resolve(AsyncTaskWrapper* parent) override
+		{
+			ReadResult(parent);
+			if (!m_resumeOnResolve)
+				return;
+
+			// This awaiter lives in the coroutine frame, which may be gone once it resumes
+			std::coroutine_handle<> coroutine = m_coroutine;
+			try
+			{
+				m_pool->EnqueueUnbounded([coroutine]() { coroutine.resume(); });
+			}
+			catch (...)
+			{
+				coroutine.resume(); // Pool is stopping, carry on here
+			}
+		}
+
+	protected:
+		template<typename Promise>
+		void SetResumePool(std::coroutine_handle<Promise> coroutine)
+		{
+			m_coroutine = coroutine;
+			if constexpr (std::is_base_of_v<CoPromiseBase, Promise>)
+				m_pool = coroutine.promise().Pool;
+			if (!m_pool)
+				m_pool = GetPool(m_defaultPoolName);
+		}
+
+		void ReadResult(AsyncTaskWrapper* task)
+		{
+			if (task->Error)
+			{
+				m_error = task->Error;
+				return;
+			}
+
+			try
+			{
+				auto& result = static_cast<ConcreteAsyncTaskWrapper<T>*>(task)->Result;
+				if (m_ownsResult)
+					m_result.emplace(std::move(*result));
+				else
+					m_result.emplace(*result);
+			}
+			catch (...)
+			{
+				m_error = std::current_exception();
+			}
+		}
+
+		TaskHandle m_handle;
+		ThreadPool* m_pool = nullptr;
+		std::coroutine_handle<> m_coroutine;
+		std::optional<T> m_result;
+		std::exception_ptr m_error;
+		bool m_ownsResult = false; // Nobody else can read the task's result, it is moved instead of copied
+		bool m_resumeOnResolve = true;
+	};
+
+	// Returned by SimpleAsync::Async. The task is only created once the coroutine suspends, with the
+	// awaiter attached before it is enqueued, so the result can't be consumed by Update() first
+	template<class T, class Work>
+	class AsyncAwaiter : public HandleAwaiter<T>
+	{
+	public:
+		AsyncAwaiter(ThreadPool* pool, Work&& work, const AsyncOptions& opt)
+			: m_targetPool(pool), m_work(std::move(work)), m_options(opt)
+		{
+			this->m_ownsResult = true;
+		}
+
+		template<typename Promise>
+		void await_suspend(std::coroutine_handle<Promise> coroutine)
+		{
+			this->SetResumePool(coroutine);
+
+			auto* asyncTask = AllocateTask<ConcreteAsyncTaskWrapper<T>>(std::move(m_work), [](T) {});
+			{
+				uint32_t shard = HomeShard();
+				RegistryLock lock(RegistrationMask(shard, m_options));
+				RegisterTask(TaskPtr(asyncTask), m_targetPool, m_options, shard);
+				asyncTask->AddContinuation(this);
+			}
+
+			try
+			{
+				m_targetPool->Enqueue([asyncTask]() { Execute(asyncTask); }, m_options.Priority, DropHandler(asyncTask));
+			}
+			catch (...)
+			{
+				// Still suspending, complete the task without resuming and let the error surface from co_await
+				this->m_resumeOnResolve = false;
+				asyncTask->Error = std::current_exception();
+				Execute(asyncTask);
+				throw;
+			}
+		}
+
+	private:
+		ThreadPool* m_targetPool;
+		Work m_work;
+		AsyncOptions m_options;
+	};
+
+	// co_await SimpleAsync::Async(task, args...) runs task(token, progress, args...) on a worker and resumes
+	// the coroutine with its result. Unlike awaiting the handle of CreateTask, this can never race with Update()
+	template<typename Func, typename... Args>
+	static auto AsyncInPool(const std::string& poolName, AsyncOptions opt, Func&& task, Args&&... args)
+	{
+		ThreadPool* pool = GetPool(poolName);
+
+		using ReturnType = decltype(task(std::declval<CancellationToken>(), std::declval<Progress>(), std::forward<Args>(args)...));
+		auto boundTask = [t = std::forward<Func>(task), argsTuple = std::make_tuple(std::forward<Args>(args)...)](CancellationToken token, Progress prog) mutable -> ReturnType
+			{
+				return std::apply([&](auto&&... unpackedArgs) -> decltype(auto) {
+					return t(token, prog, std::forward<decltype(unpackedArgs)>(unpackedArgs)...);
+					}, std::move(argsTuple));
+			};
+
+		return AsyncAwaiter<ReturnType, decltype(boundTask)>(pool, std::move(boundTask), opt);
+	}
+
+	template<typename Func, typename... Args>
+	static auto Async(Func&& task, Args&&... args)
+	{
+		return AsyncInPool(m_defaultPoolName, AsyncOptions{}, std::forward<Func>(task), std::forward<Args>(args)...);
+	}
+
+	// Waits for the task and runs its callback on this thread, unless Update() or the worker side got to it first.
+	// The task stays registered until Update() drains its completion, as the worker may still be publishing it
+	static void ForceWait(TaskHandle id)
+	{
+		RegistryShard& shard = ShardFor(id);
+		AsyncTaskWrapper* task = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(shard.Mutex);
+			TaskRecord* record = shard.Find(id);
+			if (!record)
+				return;
+
+			if (record->Task->Executor != CallbackExecutor::Update || record->CallbackClaimed)
+			{
+				// Someone else runs the callback, wait until it did
+				shard.DeliveryWaiters++;
+				shard.Delivered.wait(lock, [&shard, id]()
+					{
+						TaskRecord* current = shard.Find(id);
+						return !current || current->CallbackRan;
+					});
+				shard.DeliveryWaiters--;
+				return;
+			}
+
+			// Pinned, Update() leaves retiring it to us
+			record->CallbackClaimed = true;
+			record->Forcing = true;
+			record->TimeoutCallback = nullptr;
+			record->ProgressCallback = nullptr;
+			task = record->Task.get();
+			task->Drained = true;
+		}
+
+		task->ForceWait();
+
+		std::lock_guard<std::mutex> lock(shard.Mutex);
+		TaskRecord* record = shard.Find(id);
+		record->Forcing = false;
+		record->CallbackRan = true;
+		if (record->UpdatePassed)
+			shard.Remove(id);
+		if (shard.DeliveryWaiters > 0)
+			shard.Delivered.notify_all();
+	}
+
+	// Runs task(token, progress, item) for every item as one group: a single registration, one lock acquisition
+	// to publish all of them, and one handle to ForceWait, Cancel or chain on. The callback receives all results
+	// in item order. The group's progress is the fraction of items done, and its token is shared by every item
+	template<typename Func, typename Item, typename Callback>
+	static auto CreateTasksInPool(const std::string& poolName, Func&& task, std::vector<Item> items, Callback resultCB, AsyncOptions opt = {})
+	{
+		ThreadPool* pool = GetPool(poolName);
+
+		using ReturnType = decltype(task(std::declval<CancellationToken>(), std::declval<Progress>(), std::declval<Item>()));
+		static_assert(std::is_invocable_r_v<void, Callback, std::vector<ReturnType>>, "Callback must take a std::vector of the task's returned type");
+
+		using Group = GroupTaskWrapper<std::decay_t<Func>, Item, ReturnType>;
+		auto* group = AllocateTask<Group>(std::forward<Func>(task), std::move(items), std::move(resultCB));
+		TaskHandle handle;
+		{
+			uint32_t shard = HomeShard();
+			RegistryLock lock(RegistrationMask(shard, opt));
+			handle = RegisterTask(TaskPtr(group), pool, opt, shard);
+		}
+
+		// Once executed or queued, an Inline or Pool callback may retire the group at any time
+		size_t count = group->ItemCount();
+		if (count == 0)
+		{
+			Execute(group);
+			return TypedTaskHandle<std::vector<ReturnType>>(handle);
+		}
+
+		std::vector<PoolTask> batch;
+		batch.reserve(count);
+		for (size_t i = 0; i < count; i++)
+			batch.emplace_back([group, i]() { group->RunItem(i); });
+
+		try
+		{
+			pool->EnqueueBatch(batch, opt.Priority);
+		}
+		catch (const QueueFullError&)
+		{
+			group->Error = std::current_exception();
+			Execute(group);
+		}
+		catch (...)
+		{
+			// Nothing was queued, complete the group as failed so the handle stays consistent
+			group->Error = std::current_exception();
+			Execute(group);
+			throw;
+		}
+
+		return TypedTaskHandle<std::vector<ReturnType>>(handle);
+	}
+
+	template<typename Func, typename Item, typename Callback>
+	static auto CreateTasks(Func&& task, std::vector<Item> items, Callback resultCB, AsyncOptions opt = {})
+	{
+		return CreateTasksInPool(m_defaultPoolName, std::forward<Func>(task), std::move(items), std::move(resultCB), opt);
+	}
+
+	template<typename Func, typename Item>
+	static auto CreateTasks(Func&& task, std::vector<Item> items, AsyncOptions opt = {})
+	{
+		return CreateTasksInPool(m_defaultPoolName, std::forward<Func>(task), std::move(items), [](auto&&) {}, opt);
+	}
+
+	// Calls func(i) for every i in [begin, end), split in chunks of grain indices (0 picks one from the pool size).
+	// Chunks are split recursively so idle workers steal the largest remaining halves. The calling thread
+	// runs its share and helps with queued pool work until every chunk is done. The first exception is rethrown here
+	template<typename Func>
+	static void ParallelFor(size_t begin, size_t end, size_t grain, Func&& func)
+	{
+		ParallelForInPool(m_defaultPoolName, begin, end, grain, std::forward<Func>(func));
+	}
+
+	template<typename Func>
+	static void ParallelForInPool(const std::string& poolName, size_t begin, size_t end, size_t grain, Func&& func)
+	{
+		ThreadPool* pool = GetPool(poolName);
+		if (end <= begin)
+			return;
+
+		size_t count = end - begin;
+		if (grain == 0)
+			grain = AutoGrain(pool, count);
+
+		RunChunks(pool, (count + grain - 1) / grain, [&](size_t chunk)
+			{
+				size_t first = begin + chunk * grain;
+				size_t last = std::min(end, first + grain);
+				for (size_t i = first; i < last; i++)
+					func(i);
+			});
+	}
+
+	// Writes func(*it) to out for every element, random access iterators only
+	template<typename InputIt, typename OutputIt, typename Func>
+	static OutputIt Transform(InputIt first, InputIt last, OutputIt out, Func&& func, size_t grain = 0)
+	{
+		return TransformInPool(m_defaultPoolName, first, last, out, std::forward<Func>(func), grain);
+	}
+
+	template<typename InputIt, typename OutputIt, typename Func>
+	static OutputIt TransformInPool(const std::string& poolName, InputIt first, InputIt last, OutputIt out, Func&& func, size_t grain = 0)
+	{
+		size_t count = static_cast<size_t>(last - first);
+		ParallelForInPool(poolName, 0, count, grain, [&](size_t i) { out[i] = func(first[i]); });
+		return out + count;
+	}
+
+	// Folds the range with op, which has to be associative. Partial results are combined in order
+	// so op does not need to be commutative
+	template<typename InputIt, typename T, typename BinaryOp>
+	static T Reduce(InputIt first, InputIt last, T init, BinaryOp&& op, size_t grain = 0)
+	{
+		return ReduceInPool(m_defaultPoolName, first, last, std::move(init), std::forward<BinaryOp>(op), grain);
+	}
+
+	template<typename InputIt, typename T, typename BinaryOp>
+	static T ReduceInPool(const std::string& poolName, InputIt first, InputIt last, T init, BinaryOp&& op, size_t grain = 0)
+	{
+		ThreadPool* pool = GetPool(poolName);
+		size_t count = static_cast<size_t>(last - first);
+		if (count == 0)
+			return init;
+
+		if (grain == 0)
+			grain = AutoGrain(pool, count);
+
+		std::vector<std::optional<T>> partials((count + grain - 1) / grain);
+		RunChunks(pool, partials.size(), [&](size_t chunk)
+			{
+				size_t begin = chunk * grain;
+				size_t end = std::min(count, begin + grain);
+				T acc = first[begin];
+				for (size_t i = begin + 1; i < end; i++)
+					acc = op(std::move(acc), first[i]);
+				partials[chunk].emplace(std::move(acc));
+			});
+
+		for (auto& partial : partials)
+			init = op(std::move(init), std::move(*partial));
+		return init;
+	}
+
+	static void Update()
+	{
+		Update(UpdateBudget{});
+	}
+
+	// Runs timeout and completion callbacks until the budget is used up, the rest carries over to the next call.
+	// Returns the number of completion callbacks still pending
+	static uint32_t Update(const UpdateBudget& budget)
+	{
+		auto start = std::chrono::steady_clock::now();
+		uint32_t callbacksRun = 0;
+		auto budgetLeft = [&]()
+			{
+				if (budget.MaxCallbacks > 0 && callbacksRun >= budget.MaxCallbacks)
+					return false;
+
+				return budget.MaxMilliseconds <= 0 ||
+					std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() < budget.MaxMilliseconds;
+			};
+
+		//Timeouts, a single clock read and only expired entries are touched
+		TaskHandle expired;
+		for (RegistryShard& shard : m_shards)
+		{
+			while (budgetLeft() && PopExpiredTimeout(shard, start, expired))
+			{
+				if (FireTimeout(expired))
+					callbacksRun++;
+			}
+		}
+
+		// Finished since the last call, their callbacks may consume the results from here on
+		AppendCompletions(m_completions.PopAll());
+
+		// Progress, only tasks that reported a change. Left for the next call when over budget,
+		// the callback then gets the latest value. Records never move, the callbacks may create or remove tasks
+		for (RegistryShard& shard : m_shards)
+		{
+			if (!budgetLeft())
+				break;
+
+			{
+				std::lock_guard<std::mutex> lock(shard.Mutex);
+				m_progressBatch.swap(shard.DirtyProgress);
+			}
+
+			auto now = std::chrono::steady_clock::now();
+			size_t i = 0;
+			for (; i < m_progressBatch.size() && budgetLeft(); i++)
+			{
+				std::shared_ptr<std::function<void(float)>> callback;
+				float value;
+				{
+					std::lock_guard<std::mutex> lock(shard.Mutex);
+					TaskHandle handle = m_progressBatch[i];
+					TaskRecord* record = shard.Find(handle);
+					if (!record || !record->ProgressCallback)
+						continue;
+
+					// Throttled, stays flagged and is looked at again next call. A finished task's last value
+					// has no later report to wait for, it always goes out
+					bool finished = record->Task->Drained;
+					if (!finished && now - record->ProgressDeliveredAt < record->ProgressInterval)
+					{
+						shard.DirtyProgress.push_back(handle);
+						continue;
+					}
+
+					// Under the delta, held back until the task finishes in case it is the last one
+					value = record->Task->ProgressState.Consume();
+					if (!finished && value < 1.0f && std::abs(value - record->ProgressDelivered) < record->ProgressMinDelta)
+					{
+						record->ProgressHeld = true;
+						continue;
+					}
+
+					record->ProgressHeld = false;
+					record->ProgressDelivered = value;
+					record->ProgressDeliveredAt = now;
+					callback = record->ProgressCallback;
+
+					// Its callback already ran on a worker, Deliver() left retiring it to us
+					if (record->RetireAfterProgress)
+						shard.Remove(handle);
+				}
+
+				// Not through the record, Deliver() may remove it meanwhile
+				(*callback)(value);
+			}
+
+			if (i < m_progressBatch.size())
+			{
+				std::lock_guard<std::mutex> lock(shard.Mutex);
+				shard.DirtyProgress.insert(shard.DirtyProgress.end(), m_progressBatch.begin() + i, m_progressBatch.end());
+			}
+			m_progressBatch.clear();
+		}
+
+		// Completions, after progress so a task's last report reaches its callback before the task is retired.
+		// Callbacks run without the lock so they can use the rest of the API
+		AsyncTaskWrapper* processed = nullptr;
+		while (m_pendingHead && budgetLeft())
+		{
+			AsyncTaskWrapper* task = m_pendingHead;
+			m_pendingHead = task->NextCompleted;
+			if (!m_pendingHead)
+				m_pendingTail = nullptr;
+			m_pendingCount--;
+
+			bool run;
+			{
+				RegistryShard& shard = ShardFor(task->GetId());
+				std::lock_guard<std::mutex> lock(shard.Mutex);
+				TaskRecord* record = shard.Find(task->GetId());
+				run = !record->CallbackClaimed;
+				record->CallbackClaimed = true;
+				if (!run && record->Forcing)
+				{
+					// A ForceWait() on another thread took the callback over and retires the task when done
+					record->UpdatePassed = true;
+					continue;
+				}
+			}
+
+			if (run)
+			{
+				TaskTrace::CallbackStarted(task->TraceName, task->GetId());
+				task->CheckAndExecuteCallback();
+				TaskTrace::CallbackFinished(task->TraceName);
+				callbacksRun++;
+			}
+
+			// The link is free again, reuse it to collect what needs retiring
+			task->NextCompleted = processed;
+			processed = task;
+		}
+
+		if (processed)
+		{
+			std::unique_lock<std::mutex> lock;
+			while (processed)
+			{
+				AsyncTaskWrapper* next = processed->NextCompleted;
+				RegistryShard& shard = ShardFor(processed->GetId());
+				SwitchShardLock(lock, shard);
+				shard.Remove(processed->GetId());
+				if (shard.DeliveryWaiters > 0)
+					shard.Delivered.notify_all();
+				processed = next;
+			}
+		}
+
+		if (m_metricsHook && start >= m_nextMetrics)
+		{
+			m_nextMetrics = start + m_metricsInterval;
+
+			// Snapshot first, the hook may look pools up or create one
+			std::vector<std::pair<std::string, PoolMetrics>> snapshot;
+			{
+				std::shared_lock<std::shared_mutex> lock(m_poolsMutex);
+				snapshot.reserve(m_threadPools.size());
+				for (const auto& [name, pool] : m_threadPools)
+					snapshot.emplace_back(name, pool->GetMetrics());
+			}
+			for (const auto& [name, metrics] : snapshot)
+				m_metricsHook(name, metrics);
+		}
+
+		return m_pendingCount;
+	}
+
+	// Completion callbacks carried over by a budgeted Update(), plus those finished since
+	static uint32_t GetPendingCallbacksCount()
+	{
+		AppendCompletions(m_completions.PopAll());
+		return m_pendingCount;
+	}
+
+	// Timeout entries waiting for their deadline, in both dispatch modes. Those of tasks retired early
+	// are counted until they get compacted away
+	static size_t GetPendingTimeoutsCount()
+	{
+		size_t count = m_timeoutThread.Size();
+		for (RegistryShard& shard : m_shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.Mutex);
+			count += shard.Timeouts.Size();
+		}
+		return count;
+	}
+
+	// Safe to call from any thread, e.g. a timeout callback running on the timer thread.
+	// Tasks still queued are skipped and resolve with TaskCanceledError, running ones see the token.
+	// Cancellation callbacks run on this thread without any registry lock, so they may use the rest of the API
+	static void Cancel(TaskHandle id)
+	{
+		RegistryShard& shard = ShardFor(id);
+		AsyncTaskWrapper* task;
+		{
+			std::lock_guard<std::mutex> lock(shard.Mutex);
+			TaskRecord* record = shard.Find(id);
+			if (!record)
+				return;
+
+			// Pinned, the task may finish and be retired while its callbacks run
+			shard.Pin(id);
+			task = record->Task.get();
+		}
+
+		task->TokenState.Cancel();
+
+		std::lock_guard<std::mutex> lock(shard.Mutex);
+		shard.Unpin(id);
+	}
+
+	static void CreatePool(const std::string& poolName, size_t threadsCount, const ThreadPoolOptions& options = {})
+	{
+		if (poolName.empty())
+			throw std::runtime_error("Pool name cannot be empty");
+
+		std::unique_lock<std::shared_mutex> lock(m_poolsMutex);
+		auto it = m_threadPools.find(poolName);
+		if(it != m_threadPools.end())
+			throw std::runtime_error("Pool name already exists");
+
+		m_threadPools[poolName] = std::make_unique<ThreadPool>(threadsCount, poolName, options);
+	}
+
+	// Keeps the results of up to capacity finished shared tasks, see CreateSharedTask. A submission whose key is
+	// cached completes with a copy of the result without using a pool slot. Least recently used go first, 0 turns it off
+	static void SetResultCacheCapacity(size_t capacity)
+	{
+		std::lock_guard<std::mutex> lock(m_resultCacheMutex);
+		m_resultCacheCapacity.store(capacity, std::memory_order_relaxed);
+		TrimResultCache();
+	}
+
+	// Drops a cached result, e.g. once the file it was loaded from changed. A task in flight with that key is not affected
+	static void EvictCachedResult(const std::string& key)
+	{
+		std::lock_guard<std::mutex> lock(m_resultCacheMutex);
+		auto it = m_resultCacheIndex.find(key);
+		if (it == m_resultCacheIndex.end())
+			return;
+
+		m_resultCache.erase(it->second);
+		m_resultCacheIndex.erase(it);
+	}
+
+	static void Initialize(const std::string& defaultPoolName = DefaultPoolName, size_t maxThreads = std::thread::hardware_concurrency(), const ThreadPoolOptions& options = {})
+	{
+		auto poolName = defaultPoolName;
+		if (poolName.empty())
+			poolName = DefaultPoolName;
+
+		m_defaultPoolName = poolName;
+		auto pool = std::make_unique<ThreadPool>(maxThreads, defaultPoolName, options);
+		{
+			std::unique_lock<std::shared_mutex> lock(m_poolsMutex);
+			m_threadPools[m_defaultPoolName] = std::move(pool);
+		}
+		m_initialized = true;
+
+#ifdef SIMPLEASYNC_TRACE
+		if (m_poolCounterSampler == 0)
+			SetPoolCounterInterval(m_poolCounterInterval);
+#endif
+	}
+
+#ifdef SIMPLEASYNC_TRACE
+	// With tracing on, the profiler records every pool's queued tasks and busy threads as a counter named
+	// after the pool, every 10ms by default. The sampler runs on the profiler's writer thread, 0 turns it off
+	static void SetPoolCounterInterval(float intervalMilliseconds)
+	{
+		if (m_poolCounterSampler != 0)
+			Profiler::Instance().RemoveSampler(m_poolCounterSampler);
+
+		m_poolCounterSampler = 0;
+		m_poolCounterInterval = intervalMilliseconds;
+		if (intervalMilliseconds > 0)
+			m_poolCounterSampler = Profiler::Instance().AddSampler(SamplePoolCounters, intervalMilliseconds);
+	}
+#endif
+
+	static uint32_t GetAvailableThreadsCount(const std::string& poolName)
+	{
+		ThreadPool* pool = FindPool(poolName);
+		if (!pool)
+			throw std::runtime_error("Pool does not exists");
+
+		return pool->GetAvailableThreads();
+	}
+
+	static PoolMetrics GetPoolMetrics(const std::string& poolName)
+	{
+		ThreadPool* pool = FindPool(poolName);
+		if (!pool)
+			throw std::runtime_error("Pool does not exists");
+
+		return pool->GetMetrics();
+	}
+
+	// Called from Update() with a fresh snapshot of every pool, at most once per interval.
+	// Meant to forward metrics to a dashboard or the Profiler as counters, pass nullptr to stop
+	static void SetMetricsHook(std::function<void(const std::string& poolName, const PoolMetrics& metrics)> hook, float intervalMilliseconds = 100.0f)
+	{
+		m_metricsHook = std::move(hook);
+		m_metricsInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float, std::milli>(intervalMilliseconds));
+		m_nextMetrics = std::chrono::steady_clock::time_point{};
+	}
+
+	static IdleStats GetIdleStats(const std::string& poolName)
+	{
+		ThreadPool* pool = FindPool(poolName);
+		if (!pool)
+			throw std::runtime_error("Pool does not exists");
+
+		return pool->GetIdleStats();
+	}
+
+	static void Destroy()
+	{
+#ifdef SIMPLEASYNC_TRACE
+		// Waits for a sample in progress, the pools must outlive it
+		if (m_poolCounterSampler != 0)
+			Profiler::Instance().RemoveSampler(m_poolCounterSampler);
+		m_poolCounterSampler = 0;
+#endif
+
+		// Timer thread first, as its callbacks take the lock
+		m_timeoutThread.Stop();
+
+		// Pools next: joining them runs whatever is still queued, which references the tasks.
+		// All are stopped before any is freed, as a finishing task may schedule its continuation on another pool.
+		// No lock held meanwhile, the last tasks and coroutines may still create tasks
+		std::vector<ThreadPool*> pools;
+		{
+			std::shared_lock<std::shared_mutex> poolsLock(m_poolsMutex);
+			for (auto& pool : m_threadPools)
+				pools.push_back(pool.second.get());
+		}
+		for (ThreadPool* pool : pools)
+			pool->Shutdown();
+
+		RegistryLock lock(AllShards);
+		{
+			std::unique_lock<std::shared_mutex> poolsLock(m_poolsMutex);
+			m_threadPools.clear();
+		}
+		m_completions.PopAll();
+		m_pendingHead = nullptr;
+		m_pendingTail = nullptr;
+		m_pendingCount = 0;
+		for (RegistryShard& shard : m_shards)
+		{
+			shard.DirtyProgress.clear();
+			shard.InFlight.clear();
+			shard.Timeouts.Clear();
+			shard.StaleTimeouts = 0;
+			shard.Table.Clear();
+		}
+		m_metricsHook = nullptr;
+
+		std::lock_guard<std::mutex> cacheLock(m_resultCacheMutex);
+		m_resultCache.clear();
+		m_resultCacheIndex.clear();
+	}
+
+private:
+	template<class T>
+	class KeyedTaskWrapper;
+
+	struct TaskDeleter
+	{
+		void operator()(AsyncTaskWrapper* task) const
+		{
+			if (TaskSlab* slab = task->Slab)
+			{
+				size_t sizeClass = task->SlabClass;
+				task->~AsyncTaskWrapper();
+				slab->Free(task, sizeClass);
+			}
+			else
+				delete task;
+		}
+	};
+
+	using TaskPtr = std::unique_ptr<AsyncTaskWrapper, TaskDeleter>;
+
+	template<class Wrapper, typename... CtorArgs>
+	static Wrapper* AllocateTask(CtorArgs&&... args)
+	{
+		constexpr size_t sizeClass = TaskSlab::ClassFor(sizeof(Wrapper));
+		if constexpr (sizeClass < TaskSlab::ClassCount && alignof(Wrapper) <= alignof(std::max_align_t))
+		{
+			// From the calling thread's shard, like the registration that usually follows
+			TaskSlab& slab = m_shards[HomeShard()].Slab;
+			void* block = slab.Allocate(sizeClass);
+			try
+			{
+				Wrapper* w = ::new (block) Wrapper(std::forward<CtorArgs>(args)...);
+				w->Slab = &slab;
+				w->SlabClass = static_cast<uint8_t>(sizeClass);
+				return w;
+			}
+			catch (...)
+			{
+				slab.Free(block, sizeClass);
+				throw;
+			}
+		}
+		else
+			return new Wrapper(std::forward<CtorArgs>(args)...);
+	}
+
+	struct TaskRecord
+	{
+		TaskPtr Task;
+		std::function<void(TaskHandle)> TimeoutCallback;
+		std::shared_ptr<std::function<void(float)>> ProgressCallback; // Shared so Update() can run it while a worker retires the task
+		float ProgressMinDelta = 0;
+		std::chrono::steady_clock::duration ProgressInterval{};
+		float ProgressDelivered = 0; // Last value passed to the callback, and when
+		std::chrono::steady_clock::time_point ProgressDeliveredAt{};
+		bool ProgressHeld = false; // A value skipped for ProgressMinDelta, flagged again once the task finished
+		// Update() tasks: the first of Update() and ForceWait() to claim the callback runs it
+		bool CallbackClaimed = false;
+		bool CallbackRan = false; // Set once a ForceWait() or a worker ran it
+		bool Forcing = false; // A ForceWait() still uses the task, keep it alive
+		bool UpdatePassed = false; // Update() is done with it, the ForceWait() retires it
+		bool RetireAfterProgress = false; // Callback ran on a worker, Update() retires it after delivering its last progress
+		bool Retired = false; // Removed while pinned, freed by the last Unpin()
+		uint32_t Pins = 0; // Threads using the task without the shard lock, see Cancel()
+		bool TimeoutQueued = false; // Its timeout entry has not expired yet
+		TimeoutDispatch TimeoutMode = TimeoutDispatch::Update; // Heap holding the entry, a shard's or the timer thread's
+		uint32_t Generation = 0;
+		uint32_t LivePosition = 0; // Index into the dense live list
+	};
+
+	// Generational slot map holding one record per task, one per registry shard.
+	// Records sit in fixed-size pages so they never move, and live slots are also kept in a dense list.
+	// Always accessed under the lock of its shard. Handles it issues are local, see RegistryShard
+	class TaskTable
+	{
+	public:
+		static constexpr uint32_t PageSize = 1024;
+
+		TaskTable() : m_slotCount(0) {}
+
+		TaskHandle Insert(TaskPtr task)
+		{
+			uint32_t index;
+			if (!m_freeSlots.empty())
+			{
+				index = m_freeSlots.back();
+				m_freeSlots.pop_back();
+			}
+			else
+			{
+				index = m_slotCount++;
+				if (index % PageSize == 0)
+					m_pages.emplace_back(std::make_unique<TaskRecord[]>(PageSize));
+			}
+
+			TaskRecord& record = At(index);
+			record.Task = std::move(task);
+			record.LivePosition = static_cast<uint32_t>(m_live.size());
+			m_live.push_back(index);
+			return TaskHandle{ index, record.Generation };
+		}
+
+		// nullptr if the handle is stale or was never issued
+		TaskRecord* Find(TaskHandle handle)
+		{
+			TaskRecord* record = FindPinned(handle);
+			return record && !record->Retired ? record : nullptr;
+		}
+
+		// A pinned record looks removed at once, but keeps its task until it is unpinned
+		void Remove(TaskHandle handle)
+		{
+			TaskRecord* record = Find(handle);
+			if (!record)
+				return;
+
+			if (record->Pins > 0)
+				record->Retired = true;
+			else
+				Erase(handle.Index);
+		}
+
+		// Keeps the task alive while the caller uses it without the lock. The handle must be live
+		void Pin(TaskHandle handle)
+		{
+			Find(handle)->Pins++;
+		}
+
+		void Unpin(TaskHandle handle)
+		{
+			TaskRecord* record = FindPinned(handle);
+			if (--record->Pins == 0 && record->Retired)
+				Erase(handle.Index);
+		}
+
+		TaskRecord& At(uint32_t index)
+		{
+			return m_pages[index / PageSize][index % PageSize];
+		}
+
+		const std::vector<uint32_t>& Live() const
+		{
+			return m_live;
+		}
+
+		void Clear()
+		{
+			while (!m_live.empty())
+				Erase(m_live.back());
+		}
+
+	private:
+		// Also finds records removed while pinned
+		TaskRecord* FindPinned(TaskHandle handle)
+		{
+			if (handle.Index >= m_slotCount)
+				return nullptr;
+
+			TaskRecord& record = At(handle.Index);
+			if (record.Generation != handle.Generation || !record.Task)
+				return nullptr;
+
+			return &record;
+		}
+
+		void Erase(uint32_t index)
+		{
+			TaskRecord& record = At(index);
+			record.Task.reset();
+			record.TimeoutCallback = nullptr;
+			record.ProgressCallback = nullptr;
+			record.Retired = false;
+			record.Pins = 0;
+			record.Generation++; // Invalidates every outstanding handle to this slot
+
+			uint32_t last = m_live.back();
+			m_live[record.LivePosition] = last;
+			At(last).LivePosition = record.LivePosition;
+			m_live.pop_back();
+
+			m_freeSlots.push_back(index);
+		}
+
+		std::vector<std::unique_ptr<TaskRecord[]>> m_pages;
+		std::vector<uint32_t> m_live;
+		std::vector<uint32_t> m_freeSlots;
+		uint32_t m_slotCount;
+	};
+
+	// The task a keyed submission joins while it runs
+	struct SharedTask
+	{
+		TaskHandle Handle;
+		std::type_index Type;
+	};
+
+	struct CachedResult
+	{
+		std::string Key;
+		std::type_index Type;
+		std::shared_ptr<const void> Value;
+	};
+
+	static constexpr uint32_t ShardBits = 4;
+	static constexpr uint32_t ShardCount = 1u << ShardBits;
+	static_assert(ShardCount <= 32, "Shard sets are kept in a 32-bit mask");
+	static constexpr uint32_t AllShards = static_cast<uint32_t>((1ull << ShardCount) - 1);
+
+	// One slice of the task registry, with its own lock. Each thread registers into its home shard, so threads
+	// creating tasks on different shards don't contend. The low bits of a TaskHandle's index name its shard
+	struct alignas(64) RegistryShard
+	{
+		RegistryShard() : DeliveryWaiters(0) {}
+
+		std::mutex Mutex;
+		TaskTable Table;
+		TaskSlab Slab;
+		std::vector<TaskHandle> DirtyProgress; // Tasks whose progress changed since Update() last ran their callback
+		std::unordered_map<std::string, SharedTask> InFlight; // Keyed tasks that still take followers, by key
+		TimeoutHeap Timeouts;
+		size_t StaleTimeouts = 0; // Entries in Timeouts whose task retired before the deadline
+		std::condition_variable Delivered; // Signaled when a task that bypasses Update() is retired
+		uint32_t DeliveryWaiters;
+
+		TaskRecord* Find(TaskHandle handle) { return Table.Find(TaskHandle{ handle.Index >> ShardBits, handle.Generation }); }
+
+		// A timeout entry still waiting for its deadline is dropped along with the task, see TimeoutHeap
+		void Remove(TaskHandle handle)
+		{
+			TaskRecord* record = Find(handle);
+			if (!record)
+				return;
+
+			bool timeoutQueued = record->TimeoutQueued;
+			TimeoutDispatch timeoutMode = record->TimeoutMode;
+			Table.Remove(TaskHandle{ handle.Index >> ShardBits, handle.Generation });
+			if (!timeoutQueued)
+				return;
+
+			if (timeoutMode == TimeoutDispatch::TimerThread)
+			{
+				m_timeoutThread.Forget(handle);
+				return;
+			}
+
+			if (++StaleTimeouts * 2 > Timeouts.Size())
+			{
+				Timeouts.RemoveIf([this](const TimeoutEntry& entry) { return !Find(entry.Handle); });
+				StaleTimeouts = 0;
+			}
+		}
+
+		void Pin(TaskHandle handle) { Table.Pin(TaskHandle{ handle.Index >> ShardBits, handle.Generation }); }
+		void Unpin(TaskHandle handle) { Table.Unpin(TaskHandle{ handle.Index >> ShardBits, handle.Generation }); }
+	};
+
+	// Assigned round robin on first use, so up to ShardCount threads each get a shard of their own
+	static uint32_t HomeShard()
+	{
+		thread_local uint32_t shard = m_nextShard.fetch_add(1, std::memory_order_relaxed) % ShardCount;
+		return shard;
+	}
+
+	static uint32_t ShardOf(TaskHandle handle)
+	{
+		return handle.Index & (ShardCount - 1);
+	}
+
+	static RegistryShard& ShardFor(TaskHandle handle)
+	{
+		return m_shards[ShardOf(handle)];
+	}
+
+	// Bit of the handle's shard, none for an invalid handle
+	static uint32_t ShardMask(TaskHandle handle)
+	{
+		return handle.IsValid() ? 1u << ShardOf(handle) : 0;
+	}
+
+	// Moves the lock over to the shard unless it already holds it, the previous one is released first
+	static void SwitchShardLock(std::unique_lock<std::mutex>& lock, RegistryShard& shard)
+	{
+		if (lock.mutex() == &shard.Mutex)
+			return;
+
+		if (lock)
+			lock.unlock();
+		lock = std::unique_lock<std::mutex>(shard.Mutex);
+	}
+
+	// Locks a set of shards in index order, so two threads each locking several can't deadlock.
+	// A thread holding a single shard lock never takes another one
+	class RegistryLock
+	{
+	public:
+		explicit RegistryLock(uint32_t shards) : m_mask(shards)
+		{
+			for (uint32_t i = 0; i < ShardCount; i++)
+				if (m_mask & (1u << i))
+					SimpleAsync::m_shards[i].Mutex.lock();
+		}
+
+		~RegistryLock()
+		{
+			for (uint32_t i = ShardCount; i-- > 0; )
+				if (m_mask & (1u << i))
+					SimpleAsync::m_shards[i].Mutex.unlock();
+		}
+
+		RegistryLock(const RegistryLock&) = delete;
+		RegistryLock& operator=(const RegistryLock&) = delete;
+
+	private:
+		uint32_t m_mask;
+	};
+
+	static ThreadPool* GetPool(const std::string& poolName)
+	{
+		if (!m_initialized)
+		{
+			throw std::runtime_error("Initialize was never called!");
+		}
+		ThreadPool* pool = FindPool(poolName);
+		if (!pool)
+			throw std::runtime_error("Thread pool does not exist");
+
+		return pool;
+	}
+
+	// Pools live until Destroy(), the pointer stays valid once the lock is released
+	static ThreadPool* FindPool(const std::string& poolName)
+	{
+		std::shared_lock<std::shared_mutex> lock(m_poolsMutex);
+		auto it = m_threadPools.find(poolName);
+		return it == m_threadPools.end() ? nullptr : it->second.get();
+	}
+
+#ifdef SIMPLEASYNC_TRACE
+	// Profiler writer thread. Not under the shard locks: a thread holding one may be waiting for the writer to drain
+	static void SamplePoolCounters()
+	{
+		std::shared_lock<std::shared_mutex> lock(m_poolsMutex);
+		for (const auto& [name, pool] : m_threadPools)
+		{
+			PoolMetrics metrics = pool->GetMetrics();
+			Profiler::Instance().WriteCounter(name, {
+				{ "queued", static_cast<double>(metrics.QueueDepth) },
+				{ "active", static_cast<double>(metrics.ActiveThreads) } });
+		}
+	}
+#endif
+
+	// Keyed submissions share runs by key, see CreateSharedTask
+	template<bool Keyed, typename Func, typename Callback, typename... Args>
+	static auto SubmitTask(bool tryOnly, const std::string& poolName, const std::string& key, Func&& task, Callback resultCB, AsyncOptions opt, Args&&... args)
+	{
+		ThreadPool* pool = GetPool(poolName);
+
+		using ReturnType = decltype(task(std::declval<CancellationToken>(), std::declval<Progress>(), std::forward<Args>(args)...));
+
+		static_assert(std::is_invocable_r_v<void, Callback, ReturnType>, "Callback must have one argument of the same type as the returned type of the task");
+		auto boundTask = [t = std::forward<Func>(task), argsTuple = std::make_tuple(std::forward<Args>(args)...)](CancellationToken token, Progress prog) mutable -> ReturnType
+			{
+				auto callWithArgs = [&](auto&&... unpackedArgs) -> decltype(auto) {
+					return t(token, prog, std::forward<decltype(unpackedArgs)>(unpackedArgs)...);
+					};
+
+				return std::apply(callWithArgs, std::move(argsTuple));
+			};
+
+		using Wrapper = std::conditional_t<Keyed, KeyedTaskWrapper<ReturnType>, ConcreteAsyncTaskWrapper<ReturnType>>;
+		Wrapper* asyncTask;
+		if constexpr (Keyed)
+		{
+			static_assert(std::is_copy_constructible_v<ReturnType>, "A shared task needs a copyable result");
+			asyncTask = AllocateTask<Wrapper>(std::move(boundTask), std::move(resultCB), key, opt.Priority);
+		}
+		else
+			asyncTask = AllocateTask<Wrapper>(std::move(boundTask), std::move(resultCB));
+
+		TaskHandle handle;
+		std::exception_ptr failure;
+		bool shared = false;
+		bool sharedReady = false;
+		{
+			// Keyed tasks live in the shard of their key, where their in-flight entry is
+			uint32_t shard = Keyed ? KeyShard(key) : HomeShard();
+			RegistryLock lock(RegistrationMask(shard, opt));
+			if constexpr (Keyed)
+				shared = JoinShared(asyncTask, pool, opt, shard, sharedReady);
+
+			if (shared)
+				handle = asyncTask->GetId();
+			else
+			{
+				handle = RegisterTask(TaskPtr(asyncTask), pool, opt, shard);
+				if constexpr (Keyed)
+				{
+					m_shards[shard].InFlight.insert_or_assign(key, SharedTask{ handle, typeid(ReturnType) });
+					asyncTask->Leading = true;
+				}
+
+				// Queued under the lock, so a refused task is taken back out before Update() can see it
+				if (tryOnly)
+				{
+					try
+					{
+						if (!pool->TryEnqueue([asyncTask]() { Execute(asyncTask); }, opt.Priority, DropHandler(asyncTask)))
+						{
+							TaskTrace::Completed(asyncTask->TraceName, handle);
+							if constexpr (Keyed)
+								ForgetInFlight(m_shards[shard], key, handle);
+							m_shards[shard].Remove(handle);
+							return TypedTaskHandle<ReturnType>();
+						}
+					}
+					catch (...)
+					{
+						failure = std::current_exception();
+					}
+				}
+			}
+		}
+
+		// Shares another run's result, there is nothing to enqueue
+		if (shared)
+		{
+			// Resolved from the cache or a finished task, nothing else will complete it
+			if (sharedReady)
+				Execute(asyncTask);
+			return TypedTaskHandle<ReturnType>(handle);
+		}
+
+		if (!tryOnly)
+		{
+			try
+			{
+				pool->Enqueue([asyncTask]() { Execute(asyncTask); }, opt.Priority, DropHandler(asyncTask));
+			}
+			catch (const QueueFullError&)
+			{
+				// Fail policy, the handle resolves with the error instead of throwing at the caller
+				asyncTask->Error = std::current_exception();
+				Execute(asyncTask);
+			}
+			catch (...)
+			{
+				failure = std::current_exception();
+			}
+		}
+
+		if (failure)
+		{
+			// Complete it as failed, otherwise waiting on the handle would never return
+			asyncTask->Error = failure;
+			Execute(asyncTask);
+			std::rethrow_exception(failure);
+		}
+
+		return TypedTaskHandle<ReturnType>(handle);
+	}
+
+	static uint32_t KeyShard(const std::string& key)
+	{
+		return static_cast<uint32_t>(std::hash<std::string>{}(key)) & (ShardCount - 1);
+	}
+
+	// Caller holds the locks of RegistrationMask(shard, opt), shard being the key's. Registers the task as a follower
+	// of the in-flight task with the same key, or resolves it from the cache. False if neither has it and the task
+	// has to run, ready is set when the result was already copied in
+	template<class T>
+	static bool JoinShared(KeyedTaskWrapper<T>* task, ThreadPool* pool, const AsyncOptions& opt, uint32_t shard, bool& ready)
+	{
+		RegistryShard& registry = m_shards[shard];
+		AsyncTaskWrapper* leader = FindLeader<T>(registry, task->Key);
+		std::shared_ptr<const T> cached;
+		if (!leader)
+		{
+			cached = FindCachedResult<T>(task->Key);
+			if (!cached)
+				return false;
+		}
+
+		RegisterTask(TaskPtr(task), pool, opt, shard);
+
+		ready = true;
+		if (!leader)
+			task->Take(*cached);
+		else if (leader->AddContinuation(task))
+			ready = false;
+		else
+			task->Take(leader);
+		return true;
+	}
+
+	// Caller holds the shard's lock. Once drained its callback may be consuming the result
+	template<class T>
+	static AsyncTaskWrapper* FindLeader(RegistryShard& shard, const std::string& key)
+	{
+		auto it = shard.InFlight.find(key);
+		if (it == shard.InFlight.end() || it->second.Type != typeid(T))
+			return nullptr;
+
+		TaskRecord* record = shard.Find(it->second.Handle);
+		return record && !record->Task->Drained ? record->Task.get() : nullptr;
+	}
+
+	// Leader's worker thread, once it was canceled. The first follower to get here runs the task
+	// itself and leads the key from now on, the next ones follow it
+	template<class T>
+	static void Rejoin(KeyedTaskWrapper<T>* follower)
+	{
+		{
+			RegistryShard& shard = ShardFor(follower->GetId());
+			std::lock_guard<std::mutex> lock(shard.Mutex);
+			AsyncTaskWrapper* leader = FindLeader<T>(shard, follower->Key);
+			if (leader && leader->AddContinuation(follower))
+				return;
+
+			shard.InFlight.insert_or_assign(follower->Key, SharedTask{ follower->GetId(), typeid(T) });
+			follower->Leading = true;
+		}
+
+		Schedule(follower, follower->Pool, follower->Priority);
+	}
+
+	// Caller holds the shard's lock. Only the task owning the entry removes it, a newer one may have replaced it
+	static void ForgetInFlight(RegistryShard& shard, const std::string& key, TaskHandle handle)
+	{
+		auto it = shard.InFlight.find(key);
+		if (it != shard.InFlight.end() && it->second.Handle == handle)
+			shard.InFlight.erase(it);
+	}
+
+	// Worker thread of a keyed task, once it ran. Cached before the entry goes so a submission in between finds one of them
+	template<class T>
+	static void FinishShared(const std::string& key, TaskHandle handle, const T* result)
+	{
+		if (result)
+			CacheResult(key, *result);
+
+		RegistryShard& shard = ShardFor(handle);
+		std::lock_guard<std::mutex> lock(shard.Mutex);
+		ForgetInFlight(shard, key, handle);
+	}
+
+	template<class T>
+	static void CacheResult(const std::string& key, const T& result)
+	{
+		if (m_resultCacheCapacity.load(std::memory_order_relaxed) == 0)
+			return;
+
+		// Copied outside the lock. If it throws the result just isn't cached, the task itself succeeded
+		std::shared_ptr<const void> value;
+		try
+		{
+			value = std::make_shared<const T>(result);
+		}
+		catch (...)
+		{
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(m_resultCacheMutex);
+		auto it = m_resultCacheIndex.find(key);
+		if (it != m_resultCacheIndex.end())
+		{
+			m_resultCache.erase(it->second);
+			m_resultCacheIndex.erase(it);
+		}
+
+		m_resultCache.push_front(CachedResult{ key, typeid(T), std::move(value) });
+		m_resultCacheIndex.emplace(key, m_resultCache.begin());
+		TrimResultCache();
+	}
+
+	// A hit becomes the most recently used entry
+	template<class T>
+	static std::shared_ptr<const T> FindCachedResult(const std::string& key)
+	{
+		if (m_resultCacheCapacity.load(std::memory_order_relaxed) == 0)
+			return nullptr;
+
+		std::lock_guard<std::mutex> lock(m_resultCacheMutex);
+		auto it = m_resultCacheIndex.find(key);
+		if (it == m_resultCacheIndex.end() || it->second->Type != typeid(T))
+			return nullptr;
+
+		m_resultCache.splice(m_resultCache.begin(), m_resultCache, it->second);
+		return std::static_pointer_cast<const T>(it->second->Value);
+	}
+
+	// Caller holds m_resultCacheMutex
+	static void TrimResultCache()
+	{
+		while (m_resultCache.size() > m_resultCacheCapacity.load(std::memory_order_relaxed))
+		{
+			m_resultCacheIndex.erase(m_resultCache.back().Key);
+			m_resultCache.pop_back();
+		}
+	}
+
+	// Tasks SimpleAsync submits may be dropped by a full pool, they then complete failed with TaskDroppedError.
+	// Runs on the thread whose submission made the pool drop the task
+	static TaskDropHandler DropHandler(AsyncTaskWrapper* task)
+	{
+		return { [](void* context)
+			{
+				auto* dropped = static_cast<AsyncTaskWrapper*>(context);
+				dropped->Error = std::make_exception_ptr(TaskDroppedError());
+				Execute(dropped);
+			}, task };
+	}
+
+	// Shards a registration has to lock: its own and the one of AsyncOptions::Parent
+	static uint32_t RegistrationMask(uint32_t shard, const AsyncOptions& opt)
+	{
+		return 1u << shard | ShardMask(opt.Parent);
+	}
 
-struct CancellationState
-{
-	std::atomic<bool> Canceled{ false };
-};
+	// Caller holds the locks of RegistrationMask(shard, opt)
+	static TaskHandle RegisterTask(TaskPtr task, ThreadPool* pool, const AsyncOptions& opt, uint32_t shard)
+	{
+		AsyncTaskWrapper* raw = task.get();
+		raw->Pool = pool;
+		raw->TraceName = opt.Name;
+		raw->Executor = opt.Executor;
+		if (opt.Executor == CallbackExecutor::Pool)
+			raw->ExecutorPool = GetPool(opt.CallbackPool.empty() ? m_defaultPoolName : opt.CallbackPool);
 
-struct ProgressValue
-{
-	std::atomic<float> Value{0};
-};
+		RegistryShard& registry = m_shards[shard];
+		TaskHandle local = registry.Table.Insert(std::move(task));
+		TaskHandle handle{ local.Index << ShardBits | shard, local.Generation };
+		raw->ID = handle;
 
-using CancellationToken = std::shared_ptr<CancellationState>;
-using Progress = std::shared_ptr<ProgressValue>;
+		TaskTrace::Submitted(raw->TraceName, handle);
 
-struct TaskTimeout
-{
-	float TimeoutMs;
-	std::chrono::steady_clock::time_point StartedTime;
-};
+		TaskRecord& record = registry.Table.At(local.Index);
+		record.ProgressCallback = opt.ProgressCallback ? std::make_shared<std::function<void(float)>>(opt.ProgressCallback) : nullptr;
+		record.TimeoutCallback = opt.TimeoutCallback;
 
-template<class T>
-class ConcreteAsyncTaskWrapper : public AsyncTaskWrapper 
-{
-public:
-	uint32_t ID;
-	std::future<T> Task;
-	std::function<void(T)> Callback;
-	bool CallbackInvoked = false;
+		if (opt.Parent.IsValid())
+		{
+			if (TaskRecord* parent = ShardFor(opt.Parent).Find(opt.Parent))
+				raw->ParentLink = std::make_unique<CancellationCallback>(&parent->Task->TokenState, [raw]() { raw->TokenState.Cancel(); });
+		}
+
+		record.ProgressMinDelta = opt.ProgressMinDelta;
+		record.ProgressInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<float, std::milli>(opt.ProgressMinIntervalMilliseconds));
+		record.ProgressDelivered = 0;
+		record.ProgressDeliveredAt = {};
+		record.ProgressHeld = false;
+		record.CallbackClaimed = false;
+		record.CallbackRan = false;
+		record.Forcing = false;
+		record.UpdatePassed = false;
+		record.RetireAfterProgress = false;
+		record.TimeoutQueued = false;
+		if (opt.ProgressCallback)
+			raw->ProgressState.Watch(handle, [](TaskHandle h)
+				{
+					RegistryShard& shard = ShardFor(h);
+					std::lock_guard<std::mutex> lock(shard.Mutex);
+					shard.DirtyProgress.push_back(h);
+				});
 
-	ConcreteAsyncTaskWrapper(uint32_t id, std::future<T>&& task, std::function<void(T)> callback = {})
-		: ID(id), Task(std::move(task)), Callback(std::move(callback)) {}
+		if (opt.TimeoutCallback)
+		{
+			TimeoutEntry entry;
+			entry.Handle = handle;
+			entry.Deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<float, std::milli>(opt.TimeoutMilliseconds));
 
-	uint32_t GetId() const override { return ID; }
+			if (opt.TimeoutMode == TimeoutDispatch::TimerThread)
+				m_timeoutThread.Add(entry, [](TaskHandle h) { FireTimeout(h); });
+			else
+				registry.Timeouts.Push(entry);
+			record.TimeoutQueued = true;
+			record.TimeoutMode = opt.TimeoutMode;
+		}
 
-	void ForceWait() override {
-		if (Task.valid() && !CallbackInvoked) 
+		return handle;
+	}
+
+	// Caller holds the lock of the handle's shard. A continuation needs the parent's result, which its callback consumes
+	static AsyncTaskWrapper* FindUnconsumedTask(TaskHandle handle)
+	{
+		TaskRecord* record = handle.IsValid() ? ShardFor(handle).Find(handle) : nullptr;
+		if (!record)
+			throw std::runtime_error("Task does not exist anymore");
+		if (record->Task->Drained)
+			throw std::runtime_error("Task result was already consumed by its callback");
+
+		return record->Task.get();
+	}
+
+	// Enqueues a task whose inputs are ready. If it can't run, it completes right away so its own dependents resolve
+	static void Schedule(AsyncTaskWrapper* task, ThreadPool* pool, TaskPriority priority)
+	{
+		if (!task->Error)
 		{
-			try 
+			try
 			{
-				Task.wait();
-				T result = Task.get();
-				if (Callback) Callback(std::move(result));
+				pool->EnqueueUnbounded([task]() { Execute(task); }, priority);
+				return;
 			}
-			catch (...) 
+			catch (...)
 			{
-				// std::cerr << "AsyncTask Error: " << e.what() << std::endl;
+				task->Error = std::current_exception();
 			}
-			CallbackInvoked = true;
 		}
+
+		Execute(task);
 	}
 
-	bool CheckAndExecuteCallback() override 
+	// Roughly 8 chunks per thread, caller included, so stealing can even out uneven chunks
+	static size_t AutoGrain(ThreadPool* pool, size_t count)
+	{
+		size_t chunks = (static_cast<size_t>(pool->GetThreadsCount()) + 1) * 8;
+		return std::max<size_t>(1, count / chunks);
+	}
+
+	template<typename ChunkFunc>
+	struct ParallelJob
+	{
+		ChunkFunc& Func;
+		ThreadPool* Pool;
+		std::atomic<size_t> Remaining;
+		std::atomic<bool> Failed{ false };
+		std::exception_ptr Error;
+		std::mutex Mutex;
+		std::condition_variable DoneCondition;
+		bool Done = false;
+
+		ParallelJob(ChunkFunc& func, ThreadPool* pool, size_t chunks) : Func(func), Pool(pool), Remaining(chunks) {}
+	};
+
+	// Lives on the caller's stack, which returns only once every chunk signaled under the job mutex
+	template<typename ChunkFunc>
+	static void RunChunks(ThreadPool* pool, size_t chunkCount, ChunkFunc&& func)
+	{
+		ParallelJob<std::remove_reference_t<ChunkFunc>> job(func, pool, chunkCount);
+		SplitChunks(&job, 0, chunkCount);
+
+		while (true)
+		{
+			if (job.Remaining.load(std::memory_order_acquire) > 0 && pool->RunPendingTask())
+				continue;
+
+			std::unique_lock<std::mutex> lock(job.Mutex);
+			// Short wait, more chunks may get queued for us to help with
+			if (job.DoneCondition.wait_for(lock, std::chrono::microseconds(200), [&job]() { return job.Done; }))
+				break;
+		}
+
+		if (job.Error)
+			std::rethrow_exception(job.Error);
+	}
+
+	// Hands the upper half of [first, last) to the pool until one chunk is left, then runs it.
+	// From a work stealing worker the halves go to its own deque, where thieves take the largest first
+	template<typename Job>
+	static void SplitChunks(Job* job, size_t first, size_t last)
 	{
-		if (Task.valid()) 
+		while (last - first > 1)
+		{
+			size_t mid = first + (last - first) / 2;
+			try
+			{
+				// High priority, the submitting thread is waiting on it
+				job->Pool->EnqueueUnbounded([job, mid, last]() { SplitChunks(job, mid, last); }, TaskPriority::High);
+			}
+			catch (...)
+			{
+				break; // Pool is stopping, run the rest here
+			}
+			last = mid;
+		}
+
+		for (size_t chunk = first; chunk < last; chunk++)
 		{
-			if (Task.wait_for(std::chrono::seconds(0)) == std::future_status::ready) 
+			if (!job->Failed.load(std::memory_order_relaxed))
 			{
-				try 
+				try
 				{
-					if (!CallbackInvoked) 
-					{
-						CallbackInvoked = true;
-						T result = Task.get();
-						if (Callback) Callback(std::move(result));
-					}
-					return true;
+					job->Func(chunk);
 				}
-				catch (...) 
+				catch (...)
 				{
-					// std::cerr << "AsyncTask Exception: " << e.what() << std::endl;
-					return true;
+					if (!job->Failed.exchange(true))
+						job->Error = std::current_exception();
 				}
 			}
+
+			if (job->Remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				// Notify under the lock, the caller frees the job as soon as it can take it
+				std::lock_guard<std::mutex> lock(job->Mutex);
+				job->Done = true;
+				job->DoneCondition.notify_all();
+			}
+		}
+	}
+
+	// Fires at most once per task, from Update() or the timer thread
+	static bool PopExpiredTimeout(RegistryShard& shard, std::chrono::steady_clock::time_point now, TaskHandle& handle)
+	{
+		std::lock_guard<std::mutex> lock(shard.Mutex);
+		if (shard.Timeouts.Empty() || shard.Timeouts.Top().Deadline > now)
 			return false;
+
+		handle = shard.Timeouts.Top().Handle;
+		shard.Timeouts.Pop();
+		if (TaskRecord* record = shard.Find(handle))
+			record->TimeoutQueued = false;
+		return true;
+	}
+
+	static bool FireTimeout(TaskHandle handle)
+	{
+		std::function<void(TaskHandle)> cb;
+		{
+			RegistryShard& shard = ShardFor(handle);
+			std::lock_guard<std::mutex> lock(shard.Mutex);
+			if (TaskRecord* record = shard.Find(handle))
+			{
+				// Moved out so the callback is free to touch its own task
+				cb = std::move(record->TimeoutCallback);
+				record->TimeoutCallback = nullptr;
+				record->TimeoutQueued = false;
+				if (cb && record->Task->Pool)
+					record->Task->Pool->RecordTimedOut();
+			}
 		}
+
+		if (!cb)
+			return false;
+
+		cb(handle);
 		return true;
 	}
-};
 
-class SimpleAsync
-{
-public:
-	
-	template<typename Func, typename Callback, typename... Args>
-	static uint32_t CreateTask(Func&& task,	Callback&& callback, AsyncOptions opt , Args&&... args)
+	static void AppendCompletions(AsyncTaskWrapper* completed)
 	{
-		return CreateTaskInPool(
-			m_defaultPoolName,
-			std::forward<Func>(task),
-			std::forward<Callback>(callback),
-			opt,
-			std::forward<Args>(args)...);
+		if (!completed)
+			return;
+
+		// From here on the callback may consume the result, flagged under the shard lock continuations attach with.
+		// Runs of tasks from the same shard share one acquisition
+		{
+			std::unique_lock<std::mutex> lock;
+			for (AsyncTaskWrapper* task = completed; task; task = task->NextCompleted)
+			{
+				RegistryShard& shard = ShardFor(task->GetId());
+				SwitchShardLock(lock, shard);
+				task->Drained = true;
+				FlagHeldProgress(shard, task);
+			}
+		}
+
+		if (m_pendingTail)
+			m_pendingTail->NextCompleted = completed;
+		else
+			m_pendingHead = completed;
+
+		AsyncTaskWrapper* tail = completed;
+		m_pendingCount++;
+		while (tail->NextCompleted)
+		{
+			tail = tail->NextCompleted;
+			m_pendingCount++;
+		}
+		m_pendingTail = tail;
 	}
 
-	template<typename Func, typename... Args>
-	static uint32_t CreateTask(Func&& task, AsyncOptions opt, Args&&... args)
+	// Runs on the worker thread
+	static void Execute(AsyncTaskWrapper* task)
 	{
-		return CreateTaskInPool(
-			m_defaultPoolName,
-			std::forward<Func>(task),
-			[](auto&&) {},
-			opt,
-			std::forward<Args>(args)...);
+		TaskTrace::RunStarted(task->TraceName);
+		task->Run();
+		TaskTrace::RunFinished(task->TraceName);
+		TaskTrace::Completed(task->TraceName, task->GetId());
+		task->RunContinuations();
+		task->MarkDone();
+
+		switch (task->Executor)
+		{
+		case CallbackExecutor::Update:
+			m_completions.Push(task);
+			AsyncTaskWrapper::NotifyWaiters();
+			break;
+		case CallbackExecutor::Inline:
+			Deliver(task);
+			break;
+		case CallbackExecutor::Pool:
+			try
+			{
+				task->ExecutorPool->EnqueueUnbounded([task]() { Deliver(task); });
+			}
+			catch (...)
+			{
+				// Pool shutting down, the callback still runs exactly once
+				Deliver(task);
+			}
+			break;
+		}
 	}
 
-	template<typename Func, typename... Args>
-	static uint32_t CreateTaskInPool(const std::string& poolName, Func&& task, AsyncOptions opt, Args&&... args)
+	// Caller holds the shard lock. A finished task's value skipped for ProgressMinDelta was its last, Update() delivers it
+	static void FlagHeldProgress(RegistryShard& shard, AsyncTaskWrapper* task)
 	{
-		return CreateTaskInPool(
-			poolName,
-			std::forward<Func>(task),
-			[](auto&&) {},
-			opt,
-			std::forward<Args>(args)...);
+		TaskRecord* record = shard.Find(task->GetId());
+		if (!record || !record->ProgressHeld)
+			return;
+
+		record->ProgressHeld = false;
+		if (task->ProgressState.Reflag())
+			shard.DirtyProgress.push_back(task->GetId());
 	}
 
-	template<typename Func, typename Callback, typename... Args>
-	static uint32_t CreateTaskInPool(const std::string& poolName, Func&& task, Callback resultCB, AsyncOptions opt, Args&&... args)
+	// Runs the callback of a task that bypasses Update() and retires it, on a worker thread
+	static void Deliver(AsyncTaskWrapper* task)
 	{
-		if (!m_initialized)
+		TaskHandle id = task->GetId();
+		RegistryShard& shard = ShardFor(id);
 		{
-			throw std::runtime_error("Initialize was never called!");
+			std::lock_guard<std::mutex> lock(shard.Mutex);
+			task->Drained = true;
 		}
-		auto pool = m_threadPools.find(poolName);
-		if (pool == m_threadPools.end())
-			throw std::runtime_error("Thread pool does not exist");
 
-		auto token = std::make_shared<CancellationState>();
-		auto prog = std::make_shared<ProgressValue>();
-		using ReturnType = decltype(task(token, prog, std::forward<Args>(args)...));
+		TaskTrace::CallbackStarted(task->TraceName, id);
+		task->CheckAndExecuteCallback();
+		TaskTrace::CallbackFinished(task->TraceName);
 
-		static_assert(std::is_invocable_r_v<void, Callback, ReturnType>, "Callback must have one argument of the same type as the returned type of the task");
-		uint32_t id = m_id++;
+		std::lock_guard<std::mutex> lock(shard.Mutex);
+		TaskRecord* record = shard.Find(id);
+		FlagHeldProgress(shard, task);
+		if (record && record->ProgressCallback && task->ProgressState.Pending())
+		{
+			// Its last progress is still flagged, Update() retires the task once it delivered it
+			record->CallbackRan = true;
+			record->RetireAfterProgress = true;
+		}
+		else
+			shard.Remove(id);
+		if (shard.DeliveryWaiters > 0)
+			shard.Delivered.notify_all();
+	}
 
-		auto boundTask = [t = std::forward<Func>(task), token, prog, argsTuple = std::make_tuple(std::forward<Args>(args)...)]() mutable -> decltype(auto)
-			{
-				auto callWithArgs = [&](auto&&... unpackedArgs) -> decltype(auto) {
-					return t(token, prog, std::forward<decltype(unpackedArgs)>(unpackedArgs)...);
-					};
+	// Task submitted with a key, see CreateSharedTask. The one leading the key runs, the others follow it as its
+	// continuations and get their own copy of the result. Each completes like any task, with its own callback, executor and token
+	template<class T>
+	class KeyedTaskWrapper : public ConcreteAsyncTaskWrapper<T>, public TaskContinuation
+	{
+	public:
+		template<typename W, typename C>
+		KeyedTaskWrapper(W&& work, C&& callback, std::string key, TaskPriority priority)
+			: ConcreteAsyncTaskWrapper<T>(
+				[w = std::forward<W>(work), this](CancellationToken token, Progress prog) mutable -> T
+				{
+					if (m_input)
+						return std::move(*m_input);
+					return w(token, prog);
+				},
+				std::forward<C>(callback)),
+			Key(std::move(key)), Priority(priority) {}
 
-				return std::apply(callWithArgs, std::move(argsTuple));
-			};
+		// Worker thread, the followers are resolved right after as continuations
+		void Run() override
+		{
+			ConcreteAsyncTaskWrapper<T>::Run();
+			if (Leading)
+				FinishShared<T>(Key, this->GetId(), this->Error ? nullptr : &*this->Result);
+		}
 
-		auto future = pool->second->EnqueueTask(std::move(boundTask));
-		if (opt.ProgressCallback)
+		// Leader's worker thread
+		void Resolve(AsyncTaskWrapper* leader) override
 		{
-			m_progressCallbacks[id] = opt.ProgressCallback;
-			m_progress[id] = prog;
+			// Canceling the leader is not meant for the followers, unless they were canceled along with it
+			if (leader->Error && leader->TokenState.Canceled.load(std::memory_order_relaxed) && !this->TokenState.Canceled.load(std::memory_order_relaxed))
+			{
+				Rejoin(this);
+				return;
+			}
+
+			Take(leader);
+			Execute(this);
 		}
 
-		if (opt.TimeoutCallback)
+		// From the leader, under its shard's lock if it already finished so its callback can't consume the result meanwhile
+		void Take(AsyncTaskWrapper* leader)
 		{
-			m_timeoutCallbacks[id] = opt.TimeoutCallback;
-			TaskTimeout tt;
-			tt.StartedTime = std::chrono::steady_clock::now();
-			tt.TimeoutMs = opt.TimeoutMilliseconds;
-			m_timepoints[id] = tt;
+			if (leader->Error)
+				this->Error = leader->Error;
+			else
+				Take(*static_cast<ConcreteAsyncTaskWrapper<T>*>(leader)->Result);
 		}
 
-		auto asyncTask = std::make_unique<ConcreteAsyncTaskWrapper<ReturnType>>(id, std::move(future), std::forward<Callback>(resultCB));
+		void Take(const T& result)
+		{
+			try
+			{
+				m_input.emplace(result);
+			}
+			catch (...)
+			{
+				this->Error = std::current_exception();
+			}
+		}
 
-		m_tasks[id] = std::move(asyncTask);
-		m_cancellations[id] = token;
+		const std::string Key;
+		const TaskPriority Priority;
+		bool Leading = false; // Runs the task itself and owns the in-flight entry, set under the key's shard lock
 
-		return id;
-	}
+	private:
+		std::optional<T> m_input;
+	};
 
-	static void ForceWait(uint32_t id)
+	// Task fed by the result of another one. It is its own continuation on the parent
+	template<class T, class U>
+	class ThenTaskWrapper : public ConcreteAsyncTaskWrapper<U>, public TaskContinuation
 	{
-		std::lock_guard<std::mutex> lock(m_tasksMutex);
-		auto it = m_tasks.find(id);
-		if (it != m_tasks.end()) 
+	public:
+		template<typename F, typename C>
+		ThenTaskWrapper(F&& task, C&& callback, ThreadPool* pool, TaskPriority priority)
+			: ConcreteAsyncTaskWrapper<U>(
+				[t = std::forward<F>(task), this](CancellationToken token, Progress prog) mutable -> U { return t(token, prog, std::move(*m_input)); },
+				std::forward<C>(callback)),
+			m_pool(pool), m_priority(priority) {}
+
+		// Parent's worker thread
+		void Resolve(AsyncTaskWrapper* parent) override
 		{
-			it->second->ForceWait();
-			m_tasks.erase(it);
-			m_cancellations.erase(id);
+			Take(parent);
+			Start();
 		}
-	}
 
-	static void Update()
-	{
-		//Timeouts
-		for (auto it = m_timepoints.begin(); it != m_timepoints.end(); )
+		// Copies the parent's result. The attaching thread calls it under the parent's shard lock, then Start() without it
+		void Take(AsyncTaskWrapper* parent)
 		{
-			auto& k = it->first;
-			auto& v = it->second;
-
-			auto now = std::chrono::steady_clock::now();
-			auto diffMs = std::chrono::duration<float, std::milli>(now - v.StartedTime).count();
-
-			if (diffMs >= v.TimeoutMs)
+			if (parent->Error)
+				this->Error = parent->Error;
+			else
 			{
-				if (auto cb = m_timeoutCallbacks.find(k);
-					cb != m_timeoutCallbacks.end())
+				try
 				{
-					cb->second(k);
-					m_timeoutCallbacks.erase(cb);
+					m_input.emplace(*static_cast<ConcreteAsyncTaskWrapper<T>*>(parent)->Result);
+				}
+				catch (...)
+				{
+					this->Error = std::current_exception();
 				}
-
-				it = m_timepoints.erase(it);
 			}
-			else
+		}
+
+		void Start()
+		{
+			Schedule(this, m_pool, m_priority);
+		}
+
+	private:
+		std::optional<T> m_input;
+		ThreadPool* m_pool;
+		TaskPriority m_priority;
+	};
+
+	// Task fed by the results of several tasks, scheduled by whichever parent finishes last
+	template<class T, class U>
+	class WhenAllTaskWrapper : public ConcreteAsyncTaskWrapper<U>
+	{
+	public:
+		struct Link : TaskContinuation
+		{
+			WhenAllTaskWrapper* Owner = nullptr;
+			size_t Index = 0;
+
+			void Resolve(AsyncTaskWrapper* parent) override
 			{
-				++it;
+				if (Owner->TakeInput(Index, parent))
+					Owner->Start();
 			}
-		}
+		};
 
-		// Progress
-		for (auto it = m_progressCallbacks.begin(); it != m_progressCallbacks.end(); it++)
+		std::vector<Link> Links;
+
+		template<typename F, typename C>
+		WhenAllTaskWrapper(F&& task, C&& callback, ThreadPool* pool, TaskPriority priority, size_t inputs)
+			: ConcreteAsyncTaskWrapper<U>(
+				[t = std::forward<F>(task), this](CancellationToken token, Progress prog) mutable -> U
+				{
+					std::vector<T> values;
+					values.reserve(m_inputs.size());
+					for (auto& input : m_inputs)
+						values.push_back(std::move(*input));
+					return t(token, prog, std::move(values));
+				},
+				std::forward<C>(callback)),
+			Links(inputs), m_inputs(inputs), m_remaining(inputs), m_pool(pool), m_priority(priority)
 		{
-			auto val = m_progress[it->first];
-			it->second(val->Value);
+			for (size_t i = 0; i < inputs; i++)
+			{
+				Links[i].Owner = this;
+				Links[i].Index = i;
+			}
 		}
 
-		std::lock_guard<std::mutex> lock(m_tasksMutex);
-		for (auto it = m_tasks.begin(); it != m_tasks.end(); )
+		// True for the last input, the caller then calls Start(), outside any shard lock
+		bool TakeInput(size_t index, AsyncTaskWrapper* parent)
 		{
-			if (it->second->CheckAndExecuteCallback()) 
+			if (parent->Error)
+				Fail(parent->Error);
+			else
 			{
-				if (auto tout = m_timeoutCallbacks.find(it->first); tout != m_timeoutCallbacks.end())
+				try
 				{
-					m_timeoutCallbacks.erase(it->first);
-					m_timepoints.erase(it->first);
+					m_inputs[index].emplace(*static_cast<ConcreteAsyncTaskWrapper<T>*>(parent)->Result);
 				}
-
-				if (auto prog = m_progressCallbacks.find(it->first); prog != m_progressCallbacks.end())
+				catch (...)
 				{
-					m_progressCallbacks.erase(it->first);
-					m_progress.erase(it->first);
+					Fail(std::current_exception());
 				}
-
-				it = m_tasks.erase(it);
 			}
-			else 
+
+			return m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1;
+		}
+
+		void Start()
+		{
+			Schedule(this, m_pool, m_priority);
+		}
+
+	private:
+		void Fail(std::exception_ptr error)
+		{
+			// First failure wins, the last resolver reads it after the counter's acquire
+			if (!m_failed.exchange(true))
+				this->Error = error;
+		}
+
+		std::vector<std::optional<T>> m_inputs;
+		std::atomic<size_t> m_remaining;
+		std::atomic<bool> m_failed{ false };
+		ThreadPool* m_pool;
+		TaskPriority m_priority;
+	};
+
+	// Shared by the parents of a WhenAny, the first one to finish resolves the child. Frees itself after the last parent
+	template<class T, class U>
+	class WhenAnyState
+	{
+	public:
+		struct Link : TaskContinuation
+		{
+			WhenAnyState* Owner = nullptr;
+
+			void Resolve(AsyncTaskWrapper* parent) override
 			{
-				++it;
+				ThenTaskWrapper<T, U>* child = Owner->m_child;
+				if (Owner->TakeInput(parent))
+					child->Start();
 			}
+		};
+
+		std::vector<Link> Links;
+
+		WhenAnyState(ThenTaskWrapper<T, U>* child, size_t inputs)
+			: Links(inputs), m_child(child), m_remaining(inputs)
+		{
+			for (auto& link : Links)
+				link.Owner = this;
 		}
-	}
 
-	static void Cancel(uint32_t id)
-	{
-		auto it = m_tasks.find(id);
-		if (it != m_tasks.end())
+		// True if this parent finished first, the caller then starts the child outside any shard lock.
+		// The state may be freed by the time it returns
+		bool TakeInput(AsyncTaskWrapper* parent)
 		{
-			m_cancellations[id]->Canceled.store(true);
+			bool first = !m_resolved.exchange(true);
+			if (first)
+				m_child->Take(parent);
+
+			if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				delete this;
+			return first;
 		}
-	}
 
-	static void CreatePool(const std::string& poolName, size_t threadsCount)
+	private:
+
+		ThenTaskWrapper<T, U>* m_child;
+		std::atomic<size_t> m_remaining;
+		std::atomic<bool> m_resolved{ false };
+	};
+
+	// Registered task driven by a coroutine. Completed from its final suspend point, owns the frame
+	template<class T>
+	class CoroutineTaskWrapper : public ConcreteAsyncTaskWrapper<T>
 	{
-		if (poolName.empty())
-			throw std::runtime_error("Pool name cannot be empty");
+	public:
+		template<typename C>
+		CoroutineTaskWrapper(std::coroutine_handle<typename CoTask<T>::promise_type> coroutine, C&& callback)
+			: ConcreteAsyncTaskWrapper<T>(
+				[coroutine](CancellationToken, Progress) -> T { return std::move(*coroutine.promise().Result); },
+				std::forward<C>(callback)),
+			m_coroutine(coroutine) {}
 
-		auto it = m_threadPools.find(poolName);
-		if(it != m_threadPools.end())
-			throw std::runtime_error("Pool name already exists");
+		~CoroutineTaskWrapper() override
+		{
+			m_coroutine.destroy();
+		}
 
-		m_threadPools[poolName] = std::make_unique<ThreadPool>(threadsCount, poolName);
-	}
+	private:
+		std::coroutine_handle<typename CoTask<T>::promise_type> m_coroutine;
+	};
 
-	static void Initialize(const std::string& defaultPoolName = DefaultPoolName, size_t maxThreads = std::thread::hardware_concurrency())
+	// Many items sharing one task body and one registration. Completes through Execute() once the last item ran,
+	// its own Work only gathers the per item results
+	template<class Func, class Item, class R>
+	class GroupTaskWrapper : public ConcreteAsyncTaskWrapper<std::vector<R>>
 	{
-		auto poolName = defaultPoolName;
-		if (poolName.empty())
-			poolName = DefaultPoolName;
+	public:
+		template<typename F, typename C>
+		GroupTaskWrapper(F&& task, std::vector<Item> items, C&& callback)
+			: ConcreteAsyncTaskWrapper<std::vector<R>>(
+				[this](CancellationToken, Progress) -> std::vector<R>
+				{
+					std::vector<R> values;
+					values.reserve(m_results.size());
+					for (auto& result : m_results)
+						values.push_back(std::move(*result));
+					return values;
+				},
+				std::forward<C>(callback)),
+			m_task(std::forward<F>(task)), m_items(std::move(items)), m_results(m_items.size()), m_remaining(m_items.size()) {}
 
-		m_defaultPoolName = poolName;
-		m_threadPools[m_defaultPoolName] = std::make_unique<ThreadPool>(maxThreads, defaultPoolName);
-		m_initialized = true;
-	}
+		size_t ItemCount() const { return m_items.size(); }
 
-	static uint32_t GetAvailableThreadsCount(const std::string& poolName)
-	{
-		auto it = m_threadPools.find(poolName);
-		if (it == m_threadPools.end())
-			throw std::runtime_error("Pool does not exists");
+		// Worker thread
+		void RunItem(size_t index)
+		{
+			// Items still queued when the group gets canceled are skipped
+			if (!m_failed.load(std::memory_order_relaxed) && !this->TokenState.Canceled.load(std::memory_order_relaxed))
+			{
+				TaskTrace::RunStarted(this->TraceName);
+				try
+				{
+					m_results[index].emplace(m_task(&this->TokenState, &this->ProgressState, std::move(m_items[index])));
+				}
+				catch (...)
+				{
+					if (!m_failed.exchange(true))
+						this->Error = std::current_exception();
+				}
+				TaskTrace::RunFinished(this->TraceName);
+			}
 
-		return it->second->GetAvailableThreads();
-	}
+			// Progress is published before the count drops, the last item may free the group right after
+			size_t finished = m_finished.fetch_add(1, std::memory_order_relaxed) + 1;
+			this->ProgressState.Report(static_cast<float>(finished) / m_items.size());
 
-	static void Destroy()
-	{
-		std::lock_guard<std::mutex> lock(m_tasksMutex);
-		m_tasks.clear();
-		m_threadPools.clear();
-	}
+			if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				Execute(this);
+		}
 
-private:
-	inline static std::unordered_map<uint32_t, std::unique_ptr<AsyncTaskWrapper>> m_tasks;
-	inline static std::unordered_map<uint32_t, CancellationToken> m_cancellations;
-	inline static std::unordered_map<uint32_t, TaskTimeout> m_timepoints;
-	inline static std::unordered_map<uint32_t, std::function<void(uint32_t)>> m_timeoutCallbacks;
-	inline static std::unordered_map<uint32_t, std::function<void(float)>> m_progressCallbacks;
-	inline static std::unordered_map<uint32_t, Progress> m_progress;
-	inline static std::mutex m_tasksMutex;
-	inline static uint32_t m_id = 0;
+	private:
+		Func m_task;
+		std::vector<Item> m_items;
+		std::vector<std::optional<R>> m_results;
+		std::atomic<size_t> m_remaining;
+		std::atomic<size_t> m_finished{ 0 };
+		std::atomic<bool> m_failed{ false };
+	};
+
+	inline static RegistryShard m_shards[ShardCount];
+	inline static std::atomic<uint32_t> m_nextShard{ 0 };
+	inline static CompletionQueue m_completions;
+	inline static AsyncTaskWrapper* m_pendingHead = nullptr; // Drained completions whose callback has not run yet
+	inline static AsyncTaskWrapper* m_pendingTail = nullptr;
+	inline static uint32_t m_pendingCount = 0;
+	inline static std::vector<TaskHandle> m_progressBatch; // Scratch for Update(), keeps its capacity
+	inline static std::list<CachedResult> m_resultCache; // Most recently used first
+	inline static std::unordered_map<std::string, std::list<CachedResult>::iterator> m_resultCacheIndex;
+	inline static std::atomic<size_t> m_resultCacheCapacity{ 0 };
+	inline static std::mutex m_resultCacheMutex;
+	inline static TimeoutThread m_timeoutThread;
+	inline static std::function<void(const std::string&, const PoolMetrics&)> m_metricsHook;
+	inline static std::chrono::steady_clock::duration m_metricsInterval{};
+	inline static std::chrono::steady_clock::time_point m_nextMetrics{};
 	inline static std::unordered_map<std::string, std::unique_ptr<ThreadPool>> m_threadPools;
+	inline static std::shared_mutex m_poolsMutex; // Exclusive where pools are added or removed, shared for lookups and iteration
+#ifdef SIMPLEASYNC_TRACE
+	inline static uint32_t m_poolCounterSampler = 0;
+	inline static float m_poolCounterInterval = 10.0f;
+#endif
 	inline static bool m_initialized = false;
 	inline static std::string m_defaultPoolName;
 };
+
+template<class T>
+template<typename Func, typename Callback>
+auto TypedTaskHandle<T>::Then(Func&& task, Callback&& resultCB, const AsyncOptions& opt) const
+{
+	return SimpleAsync::Then(*this, std::forward<Func>(task), std::forward<Callback>(resultCB), opt);
+}
+
+template<class T>
+template<typename Func, typename Callback>
+auto TypedTaskHandle<T>::Then(Func&& task, Callback&& resultCB) const
+{
+	return SimpleAsync::Then(*this, std::forward<Func>(task), std::forward<Callback>(resultCB));
+}
+
+template<class T>
+template<typename Func>
+auto TypedTaskHandle<T>::Then(Func&& task) const
+{
+	return SimpleAsync::Then(*this, std::forward<Func>(task));
+}
+
+template<class T>
+auto TypedTaskHandle<T>::operator co_await() const
+{
+	return SimpleAsync::HandleAwaiter<T>(*this);
+}
@@ -1,60 +1,549 @@
 #pragma once
-#include <queue>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
 #include <future>
 #include <vector>
+#include <memory>
 #include <atomic>
+#include <chrono>
+#include <span>
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+#include "InplaceFunction.h"
 #ifdef _WIN32
 #include <windows.h>
-#elif defined(__linux__) || defined(__APPLE__)
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#elif defined(__APPLE__)
 #include <pthread.h>
+#include <pthread/qos.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
 #endif
 
-class ThreadPool
+enum class SchedulingMode
+{
+	SharedQueue,	// Every worker pulls from one mutex-guarded queue
+	WorkStealing	// Per-worker deques, idle workers steal from each other
+};
+
+enum class TaskPriority : uint8_t
+{
+	High,
+	Normal,
+	Low
+};
+
+inline constexpr size_t TaskPriorityLevels = 3;
+
+// What an idle worker does before parking on the condition variable. Spinning and yielding
+// keep it ready for bursts of small tasks, at the cost of CPU time while the pool is idle
+struct IdlePolicy
+{
+	uint32_t SpinIterations = 0;	// Checks separated by a pause instruction
+	uint32_t YieldIterations = 0;	// Checks separated by a yield to the OS scheduler
+};
+
+// What Enqueue does when a bounded pool's queue is full
+enum class OverflowPolicy
+{
+	Block,		// Wait for room. A worker submitting to its own pool runs the task inline instead
+	Fail,		// Throw QueueFullError
+	DropOldest,	// Drop the oldest droppable task of the same or a lower priority, or the new one when there is none.
+				// Work stealing pools look in the workers' deques too
+	RunInline	// Run the task on the submitting thread
+};
+
+struct QueueFullError : std::runtime_error
+{
+	QueueFullError() : std::runtime_error("Thread pool queue is full") {}
+};
+
+// OS scheduling class of the workers, named after the macOS QoS classes.
+// Mapped to thread priorities on Windows and to nice values on Linux (raising it may need privileges)
+enum class ThreadQoS
+{
+	Default,
+	Background,
+	Utility,
+	UserInitiated,
+	UserInteractive
+};
+
+struct ThreadPoolOptions
+{
+	SchedulingMode Mode = SchedulingMode::SharedQueue;
+	float AgingMilliseconds = 100.0f; // A lower priority task waiting this long is served first, 0 to disable
+	IdlePolicy Idle;
+	std::vector<uint32_t> Cores;	// Logical CPUs to pin workers to, worker i gets Cores[i % size]. Empty leaves it to the OS
+	bool NumaAware = false;			// Spread workers over NUMA nodes and keep one submission queue per node
+	ThreadQoS QoS = ThreadQoS::Default;
+
+	// Elastic sizing: with MaxThreads above the pool's thread count, that count becomes the minimum
+	uint32_t MaxThreads = 0;
+	float GrowLatencyMilliseconds = 10.0f;		// A worker is added when the oldest queued task waited this long and none is idle
+	float RetireIdleMilliseconds = 5000.0f;	// Workers above the minimum exit after idling this long
+
+	bool CollectTimings = true; // Queue wait and run time histograms, costs two clock reads per task
+
+	// Bounded queue: at most this many tasks wait in the pool, 0 for no limit
+	size_t QueueCapacity = 0;
+	OverflowPolicy Overflow = OverflowPolicy::Block;
+};
+
+// Logical CPUs grouped by NUMA node. A single node holding every CPU where the platform reports nothing
+class CpuTopology
 {
 public:
-	ThreadPool(size_t numOfThreads, const std::string& poolName = "UnnamedPool") : m_stop(false), m_totalThreads(static_cast<uint32_t>(numOfThreads))
+	static const CpuTopology& Get()
 	{
-		for (size_t i = 0; i < numOfThreads; i++)
+		static CpuTopology topology;
+		return topology;
+	}
+
+	size_t NodeCount() const { return m_nodes.size(); }
+	const std::vector<uint32_t>& NodeCpus(size_t node) const { return m_nodes[node]; }
+
+	size_t NodeOfCpu(uint32_t cpu) const
+	{
+		return cpu < m_cpuNodes.size() ? m_cpuNodes[cpu] : 0;
+	}
+
+	// -1 when the platform can't tell
+	static int CurrentCpu()
+	{
+#ifdef _WIN32
+		PROCESSOR_NUMBER number;
+		GetCurrentProcessorNumberEx(&number);
+		return number.Group * 64 + number.Number;
+#elif defined(__linux__)
+		return sched_getcpu();
+#else
+		return -1;
+#endif
+	}
+
+private:
+	CpuTopology()
+	{
+#ifdef _WIN32
+		ULONG highest = 0;
+		if (GetNumaHighestNodeNumber(&highest))
 		{
-			m_workers.emplace_back([this, poolName, i]() {
-				SetThreadName(poolName, static_cast<uint32_t>(i));
-				std::function<void()> task;
-				while (1)
+			for (USHORT node = 0; node <= highest; node++)
+			{
+				GROUP_AFFINITY affinity = {};
+				if (!GetNumaNodeProcessorMaskEx(node, &affinity) || affinity.Mask == 0)
+					continue;
+
+				std::vector<uint32_t> cpus;
+				for (uint32_t bit = 0; bit < 64; bit++)
 				{
-					{
-						std::unique_lock l(m_mutex);
-						m_condition.wait(l, [this]() { return m_stop || !m_tasks.empty(); });
-						if (m_stop && m_tasks.empty()) return;
-
-						task = std::move(m_tasks.front());
-						m_tasks.pop();
-					}
-
-					m_activeThreads.fetch_add(1, std::memory_order_relaxed);
-					try
-					{
-						task();
-					}
-					catch (...)
-					{
-					}
-					m_activeThreads.fetch_sub(1, std::memory_order_relaxed);
+					if (affinity.Mask & (KAFFINITY(1) << bit))
+						cpus.push_back(affinity.Group * 64 + bit);
 				}
-				});
+				m_nodes.push_back(std::move(cpus));
+			}
+		}
+#elif defined(__linux__)
+		for (size_t node = 0; ; node++)
+		{
+			std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+			if (!file)
+				break;
+
+			// Ranges like "0-7,16-23"
+			std::vector<uint32_t> cpus;
+			std::string range;
+			while (std::getline(file, range, ','))
+			{
+				uint32_t first = 0, last = 0;
+				char dash = 0;
+				std::istringstream parser(range);
+				if (!(parser >> first))
+					continue;
+				last = (parser >> dash >> last) ? last : first;
+				for (uint32_t cpu = first; cpu <= last; cpu++)
+					cpus.push_back(cpu);
+			}
+
+			if (!cpus.empty())
+				m_nodes.push_back(std::move(cpus));
+		}
+#endif
+
+		if (m_nodes.empty())
+		{
+			std::vector<uint32_t> cpus;
+			for (uint32_t cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++)
+				cpus.push_back(cpu);
+			m_nodes.push_back(std::move(cpus));
+		}
+
+		for (size_t node = 0; node < m_nodes.size(); node++)
+		{
+			for (uint32_t cpu : m_nodes[node])
+			{
+				if (cpu >= m_cpuNodes.size())
+					m_cpuNodes.resize(cpu + 1, 0);
+				m_cpuNodes[cpu] = static_cast<uint32_t>(node);
+			}
+		}
+	}
+
+	std::vector<std::vector<uint32_t>> m_nodes;
+	std::vector<uint32_t> m_cpuNodes;
+};
+
+// How idle workers found their next task, for tuning IdlePolicy
+struct IdleStats
+{
+	uint64_t SpinHits = 0;	// Work showed up while spinning
+	uint64_t YieldHits = 0;	// Work showed up while yielding
+	uint64_t Parks = 0;		// Went to sleep on the condition variable
+	uint64_t Wakeups = 0;	// notify calls issued by submitters, only made when a worker is parked
+};
+
+// Power of two buckets in microseconds: bucket 0 counts samples under 1us, bucket i those under 2^i us,
+// the last one everything longer
+struct LatencyHistogram
+{
+	static constexpr size_t BucketCount = 24;
+
+	uint64_t Buckets[BucketCount] = {};
+
+	static size_t BucketOf(uint64_t microseconds)
+	{
+		return std::min<size_t>(std::bit_width(microseconds), BucketCount - 1);
+	}
+
+	uint64_t Count() const
+	{
+		uint64_t count = 0;
+		for (uint64_t bucket : Buckets)
+			count += bucket;
+		return count;
+	}
+
+	// Upper bound in microseconds of the bucket holding the given quantile (0..1), 0 when empty
+	double Percentile(double quantile) const
+	{
+		uint64_t count = Count();
+		if (count == 0)
+			return 0;
+
+		uint64_t target = static_cast<uint64_t>(quantile * (count - 1)) + 1;
+		uint64_t seen = 0;
+		for (size_t i = 0; i < BucketCount; i++)
+		{
+			seen += Buckets[i];
+			if (seen >= target)
+				return static_cast<double>(uint64_t(1) << i);
 		}
+		return static_cast<double>(uint64_t(1) << (BucketCount - 1));
+	}
+};
+
+// Point in time copy of a pool's counters, see ThreadPool::GetMetrics. Totals count since the pool started
+struct PoolMetrics
+{
+	size_t QueueDepth = 0;
+	uint32_t Threads = 0;
+	uint32_t ActiveThreads = 0;
+	uint64_t Enqueued = 0;
+	uint64_t Completed = 0;
+	uint64_t Canceled = 0;	// Reported by SimpleAsync, tasks skipped because they were canceled while queued
+	uint64_t TimedOut = 0;	// Reported by SimpleAsync, tasks whose timeout fired
+	uint64_t Steals = 0;
+	uint64_t Rejected = 0;	// Refused by a full queue, through OverflowPolicy::Fail or TryEnqueue
+	uint64_t Dropped = 0;	// Dropped from a full queue, through OverflowPolicy::DropOldest
+	LatencyHistogram QueueWait;
+	LatencyHistogram RunTime;
+	std::vector<uint64_t> WorkerBusyNanoseconds; // Time each worker slot spent running tasks
+	uint64_t UptimeNanoseconds = 0;
+
+	// Fraction of the running workers' time spent in tasks between an earlier snapshot and this one
+	float BusyRatio(const PoolMetrics& earlier) const
+	{
+		uint64_t busy = 0;
+		for (size_t i = 0; i < WorkerBusyNanoseconds.size(); i++)
+			busy += WorkerBusyNanoseconds[i] - (i < earlier.WorkerBusyNanoseconds.size() ? earlier.WorkerBusyNanoseconds[i] : 0);
+
+		uint64_t elapsed = (UptimeNanoseconds - earlier.UptimeNanoseconds) * std::max<uint32_t>(Threads, 1);
+		return elapsed == 0 ? 0.0f : std::min(1.0f, static_cast<float>(busy) / elapsed);
+	}
+};
+
+inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+	_mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+using PoolTask = InplaceFunction<void(), 64>;
+
+// Growable circular buffer used for the task queues.
+// Unlike std::deque it keeps its storage once grown, so steady-state push/pop does not allocate
+template<typename T>
+class TaskRing
+{
+public:
+	bool Empty() const { return m_head == m_tail; }
+	size_t Size() const { return m_tail - m_head; }
+
+	void PushBack(T&& item)
+	{
+		if (Size() == m_items.size())
+			Grow();
+		m_items[m_tail++ & (m_items.size() - 1)] = std::move(item);
+	}
+
+	T& Front()
+	{
+		return m_items[m_head & (m_items.size() - 1)];
+	}
+
+	const T& Front() const
+	{
+		return m_items[m_head & (m_items.size() - 1)];
+	}
+
+	T PopFront()
+	{
+		return std::move(m_items[m_head++ & (m_items.size() - 1)]);
+	}
+
+	T PopBack()
+	{
+		return std::move(m_items[--m_tail & (m_items.size() - 1)]);
+	}
+
+	// Position counts from the front
+	T& At(size_t position)
+	{
+		return m_items[(m_head + position) & (m_items.size() - 1)];
+	}
+
+	// The items behind the removed one move up, so it costs O(size)
+	T Remove(size_t position)
+	{
+		T item = std::move(At(position));
+		for (size_t i = position; i + 1 < Size(); i++)
+			At(i) = std::move(At(i + 1));
+		m_tail--;
+		return item;
+	}
+
+private:
+	void Grow()
+	{
+		std::vector<T> items(m_items.empty() ? 16 : m_items.size() * 2);
+		size_t count = Size();
+		for (size_t i = 0; i < count; i++)
+			items[i] = std::move(m_items[(m_head + i) & (m_items.size() - 1)]);
+
+		m_items = std::move(items);
+		m_head = 0;
+		m_tail = count;
+	}
+
+	std::vector<T> m_items; // Size is always a power of two
+	size_t m_head = 0;
+	size_t m_tail = 0;
+};
+
+// Called on the submitting thread when a full pool drops a task, after which the task is destroyed unrun
+struct TaskDropHandler
+{
+	void (*Dropped)(void* context) = nullptr;
+	void* Context = nullptr;
+};
+
+struct QueuedTask
+{
+	PoolTask Task;
+	std::chrono::steady_clock::time_point EnqueuedAt;
+	TaskDropHandler OnDrop{};
+	bool Droppable = false; // Only what came through Enqueue may be dropped to make room
+};
+
+// One ring per priority level, higher levels are served first.
+// A lower level task that waited longer than the aging threshold goes ahead of them, so it cannot starve
+class TaskQueue
+{
+public:
+	bool Empty() const { return m_size == 0; }
+	size_t Size() const { return m_size; }
+
+	// Must not be empty
+	std::chrono::steady_clock::time_point OldestEnqueuedAt() const
+	{
+		auto oldest = std::chrono::steady_clock::time_point::max();
+		for (const auto& level : m_levels)
+		{
+			if (!level.Empty())
+				oldest = std::min(oldest, level.Front().EnqueuedAt);
+		}
+		return oldest;
+	}
+
+	void Push(QueuedTask&& task, TaskPriority priority)
+	{
+		m_levels[static_cast<size_t>(priority)].PushBack(std::move(task));
+		m_size++;
+	}
+
+	// Oldest droppable task at the given priority or lower, for OverflowPolicy::DropOldest
+	QueuedTask* FindDroppable(TaskPriority priority, size_t& level, size_t& position)
+	{
+		for (level = TaskPriorityLevels - 1; level + 1 > static_cast<size_t>(priority); level--)
+		{
+			for (position = 0; position < m_levels[level].Size(); position++)
+			{
+				QueuedTask& task = m_levels[level].At(position);
+				if (task.Droppable)
+					return &task;
+			}
+		}
+		return nullptr;
+	}
+
+	QueuedTask& Peek(size_t level, size_t position)
+	{
+		return m_levels[level].At(position);
+	}
+
+	QueuedTask Remove(size_t level, size_t position)
+	{
+		m_size--;
+		return m_levels[level].Remove(position);
+	}
+
+	// newestFirst is used by the owner of a work stealing deque, everyone else takes the oldest task
+	QueuedTask Pop(bool newestFirst, std::chrono::steady_clock::duration aging)
+	{
+		size_t level = 0;
+		while (m_levels[level].Empty())
+			level++;
+
+		if (aging.count() > 0)
+		{
+			std::chrono::steady_clock::time_point now;
+			bool clockRead = false;
+			for (size_t lower = TaskPriorityLevels - 1; lower > level; lower--)
+			{
+				if (m_levels[lower].Empty())
+					continue;
+
+				// Clock is only read when some lower level actually has work
+				if (!clockRead)
+				{
+					now = std::chrono::steady_clock::now();
+					clockRead = true;
+				}
+
+				if (now - m_levels[lower].Front().EnqueuedAt >= aging)
+				{
+					level = lower;
+					newestFirst = false;
+					break;
+				}
+			}
+		}
+
+		m_size--;
+		return newestFirst ? m_levels[level].PopBack() : m_levels[level].PopFront();
+	}
+
+private:
+	TaskRing<QueuedTask> m_levels[TaskPriorityLevels];
+	size_t m_size = 0;
+};
+
+class ThreadPool
+{
+public:
+	ThreadPool(size_t numOfThreads, const std::string& poolName = "UnnamedPool", const ThreadPoolOptions& options = {}) 
+		: m_totalThreads(static_cast<uint32_t>(numOfThreads)), m_mode(options.Mode), m_idle(options.Idle),
+		m_aging(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float, std::milli>(options.AgingMilliseconds))),
+		m_poolName(poolName), m_qos(options.QoS), m_minThreads(static_cast<uint32_t>(numOfThreads)),
+		m_growLatency(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float, std::milli>(options.GrowLatencyMilliseconds))),
+		m_retireAfter(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float, std::milli>(options.RetireIdleMilliseconds))),
+		m_stop(false)
+	{
+		// Every slot an elastic pool may use is set up front, so nothing is reallocated while workers run
+		size_t slots = std::max<size_t>(numOfThreads, options.MaxThreads);
+		if (m_mode == SchedulingMode::WorkStealing)
+		{
+			for (size_t i = 0; i < slots; i++)
+				m_localQueues.emplace_back(std::make_unique<WorkerQueue>());
+		}
+
+		// Placement is decided up front, so the node queues exist before any worker runs
+		const CpuTopology& topology = CpuTopology::Get();
+		m_placement.resize(slots);
+		m_workerNodes.resize(slots, 0);
+		m_tasks.resize(options.NumaAware ? topology.NodeCount() : 1);
+		for (size_t i = 0; i < slots; i++)
+		{
+			if (!options.Cores.empty())
+			{
+				uint32_t cpu = options.Cores[i % options.Cores.size()];
+				m_placement[i] = { cpu };
+				if (options.NumaAware)
+					m_workerNodes[i] = static_cast<uint32_t>(topology.NodeOfCpu(cpu));
+			}
+			else if (options.NumaAware)
+			{
+				m_workerNodes[i] = static_cast<uint32_t>(i % topology.NodeCount());
+				m_placement[i] = topology.NodeCpus(m_workerNodes[i]);
+			}
+		}
+
+		m_workers.resize(slots);
+		m_slotRunning.resize(slots, false);
+		m_metrics = std::make_unique<WorkerMetrics[]>(slots + 1);
+		m_collectTimings = options.CollectTimings;
+		m_capacity = options.QueueCapacity;
+		m_overflow = options.Overflow;
+		m_startedAt = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < numOfThreads; i++)
+			StartWorker(i);
+		if (IsElastic())
+			m_monitor = std::thread([this]() { MonitorLoop(); });
 	}
 
 	~ThreadPool()
+	{
+		Shutdown();
+	}
+
+	// Runs what is still queued, then joins the workers. Enqueue from other threads fails from now on
+	void Shutdown()
 	{
 		{
 			std::scoped_lock l(m_mutex);
 			m_stop = true;
 		}
 		m_condition.notify_all();
+		m_roomCondition.notify_all();
+		m_monitorCondition.notify_all();
+		if (m_monitor.joinable())
+			m_monitor.join();
 		for (auto& w : m_workers)
 		{
 			if (w.joinable())
@@ -62,6 +551,12 @@ public:
 		}
 	}
 
+	// Current number of workers, which moves between the minimum and MaxThreads in an elastic pool
+	uint32_t GetThreadsCount() const
+	{
+		return m_totalThreads.load();
+	}
+
 	uint32_t GetActiveThreadsCount() const
 	{
 		return m_activeThreads.load();
@@ -69,7 +564,133 @@ public:
 
 	uint32_t GetAvailableThreads() const
 	{
-		return m_totalThreads - m_activeThreads.load();
+		return m_totalThreads.load() - m_activeThreads.load();
+	}
+
+	static void SetThreadName(const std::string& baseName, size_t threadIndex)
+	{
+#ifdef _WIN32
+		std::wstring name = std::wstring(baseName.begin(), baseName.end()) +
+			L"-" + std::to_wstring(threadIndex);
+		SetThreadDescription(GetCurrentThread(), name.c_str());
+#elif defined(__linux__)
+		std::string name = baseName + "-" + std::to_string(threadIndex);
+		pthread_setname_np(pthread_self(), name.substr(0, 15).c_str()); // 15 char limit
+#elif defined(__APPLE__)
+		std::string name = baseName + "-" + std::to_string(threadIndex);
+		pthread_setname_np(name.c_str());
+#endif
+	}
+
+	// Pins the calling thread to the given CPUs (none leaves it alone) and applies the QoS class.
+	// Best effort, failures are ignored. Affinity is not available on macOS, only the QoS class applies there
+	static void SetThreadPlacement(const std::vector<uint32_t>& cpus, ThreadQoS qos)
+	{
+#ifdef _WIN32
+		if (!cpus.empty())
+		{
+			// A thread runs within one processor group, the one of the first CPU
+			GROUP_AFFINITY affinity = {};
+			affinity.Group = static_cast<WORD>(cpus[0] / 64);
+			for (uint32_t cpu : cpus)
+			{
+				if (cpu / 64 == affinity.Group)
+					affinity.Mask |= KAFFINITY(1) << (cpu % 64);
+			}
+			SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+		}
+
+		static constexpr int priorities[] = { THREAD_PRIORITY_NORMAL, THREAD_PRIORITY_LOWEST, THREAD_PRIORITY_BELOW_NORMAL, THREAD_PRIORITY_ABOVE_NORMAL, THREAD_PRIORITY_HIGHEST };
+		if (qos != ThreadQoS::Default)
+			SetThreadPriority(GetCurrentThread(), priorities[static_cast<size_t>(qos)]);
+#elif defined(__linux__)
+		if (!cpus.empty())
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			for (uint32_t cpu : cpus)
+			{
+				if (cpu < CPU_SETSIZE)
+					CPU_SET(cpu, &set);
+			}
+			pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		}
+
+		// Nice values are per thread on Linux
+		static constexpr int niceValues[] = { 0, 19, 10, -5, -10 };
+		if (qos != ThreadQoS::Default)
+			setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), niceValues[static_cast<size_t>(qos)]);
+#elif defined(__APPLE__)
+		static constexpr qos_class_t classes[] = { QOS_CLASS_DEFAULT, QOS_CLASS_BACKGROUND, QOS_CLASS_UTILITY, QOS_CLASS_USER_INITIATED, QOS_CLASS_USER_INTERACTIVE };
+		if (qos != ThreadQoS::Default)
+			pthread_set_qos_class_self_np(classes[static_cast<size_t>(qos)], 0);
+#endif
+	}
+
+	SchedulingMode GetSchedulingMode() const
+	{
+		return m_mode;
+	}
+
+	IdleStats GetIdleStats() const
+	{
+		IdleStats stats;
+		stats.SpinHits = m_spinHits.load(std::memory_order_relaxed);
+		stats.YieldHits = m_yieldHits.load(std::memory_order_relaxed);
+		stats.Parks = m_parks.load(std::memory_order_relaxed);
+		stats.Wakeups = m_wakeups.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+	// Tasks waiting in a NUMA node's submission queue, a single queue 0 unless NumaAware. Takes the pool lock, unlike GetMetrics()
+	size_t GetNodeQueueDepth(size_t node)
+	{
+		std::scoped_lock l(m_mutex);
+		return node < m_tasks.size() ? m_tasks[node].Size() : 0;
+	}
+
+	// Cheap snapshot, every counter is read with a relaxed load so totals may be off by the tasks in flight
+	PoolMetrics GetMetrics() const
+	{
+		PoolMetrics metrics;
+		metrics.QueueDepth = m_pendingTasks.load(std::memory_order_relaxed);
+		metrics.Threads = m_totalThreads.load(std::memory_order_relaxed);
+		metrics.ActiveThreads = m_activeThreads.load(std::memory_order_relaxed);
+		metrics.Enqueued = m_enqueued.load(std::memory_order_relaxed);
+		metrics.Canceled = m_canceled.load(std::memory_order_relaxed);
+		metrics.TimedOut = m_timedOut.load(std::memory_order_relaxed);
+		metrics.Rejected = m_rejected.load(std::memory_order_relaxed);
+		metrics.Dropped = m_dropped.load(std::memory_order_relaxed);
+		metrics.WorkerBusyNanoseconds.resize(m_workers.size());
+
+		for (size_t i = 0; i <= m_workers.size(); i++)
+		{
+			const WorkerMetrics& worker = m_metrics[i];
+			metrics.Completed += worker.Completed.load(std::memory_order_relaxed);
+			metrics.Steals += worker.Steals.load(std::memory_order_relaxed);
+			if (i < m_workers.size())
+				metrics.WorkerBusyNanoseconds[i] = worker.BusyNanoseconds.load(std::memory_order_relaxed);
+
+			for (size_t b = 0; b < LatencyHistogram::BucketCount; b++)
+			{
+				metrics.QueueWait.Buckets[b] += worker.QueueWait[b].load(std::memory_order_relaxed);
+				metrics.RunTime.Buckets[b] += worker.RunTime[b].load(std::memory_order_relaxed);
+			}
+		}
+
+		metrics.UptimeNanoseconds = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_startedAt).count());
+		return metrics;
+	}
+
+	// Outcomes only the layer submitting the tasks knows about, folded into GetMetrics()
+	void RecordCanceled()
+	{
+		m_canceled.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void RecordTimedOut()
+	{
+		m_timedOut.fetch_add(1, std::memory_order_relaxed);
 	}
 
 	template<typename Func, typename... Args>
@@ -77,44 +698,761 @@ public:
 	{
 		using ReturnType = std::invoke_result_t<Func, Args...>;
 
-		auto task = std::make_shared<std::packaged_task<ReturnType()>>(
-			std::bind(std::forward<Func>(func), std::forward<Args>(args)...)
-		);
+		std::packaged_task<ReturnType()> task(std::bind(std::forward<Func>(func), std::forward<Args>(args)...));
+		std::future<ReturnType> res = task.get_future();
 
-		std::future<ReturnType> res = task->get_future();
+		Enqueue([task = std::move(task)]() mutable { task(); });
+		return res;
+	}
 
+	// Fire-and-forget submission, no future is created.
+	// Does not allocate as long as the callable fits in PoolTask's inline storage.
+	// A full bounded queue applies the pool's overflow policy, onDrop is told if the task gets dropped
+	void Enqueue(PoolTask&& task, TaskPriority priority = TaskPriority::Normal, TaskDropHandler onDrop = {})
+	{
+		QueuedTask queued{ std::move(task), std::chrono::steady_clock::now(), onDrop, true };
+		if (m_capacity > 0 && !TryReserve(1))
 		{
-			std::scoped_lock l(m_mutex);
-			if (m_stop) throw std::runtime_error("Enqueue on stop thread pool");
-			m_tasks.emplace([task]() { (*task)(); });
+			QueuedTask evicted;
+			switch (Overflow(priority, evicted))
+			{
+			case Admission::Queued:
+				break;
+			case Admission::Evicted:
+				Drop(evicted);
+				break;
+			case Admission::RunInline:
+				RunTask(queued);
+				return;
+			case Admission::DropNew:
+				Drop(queued);
+				return;
+			}
 		}
 
-		m_condition.notify_one();
-		return res;
+		Push(std::move(queued), priority);
+	}
+
+	// Never waits, drops or runs inline: returns false when the queue is full, leaving the task untouched
+	bool TryEnqueue(PoolTask&& task, TaskPriority priority = TaskPriority::Normal, TaskDropHandler onDrop = {})
+	{
+		if (m_capacity > 0 && !TryReserve(1))
+		{
+			m_rejected.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		Push(QueuedTask{ std::move(task), std::chrono::steady_clock::now(), onDrop, true }, priority);
+		return true;
+	}
+
+	// Queued even past the capacity and never dropped, for work that must not be lost like a coroutine
+	// resuming. It still takes room, so it holds back new submissions
+	void EnqueueUnbounded(PoolTask&& task, TaskPriority priority = TaskPriority::Normal)
+	{
+		if (m_capacity > 0)
+			m_queued.fetch_add(1);
+		Push(QueuedTask{ std::move(task), std::chrono::steady_clock::now() }, priority);
+	}
+
+	// Publishes all tasks under a single lock acquisition and wakes at most one worker per task.
+	// The tasks are moved from, on failure none of them was queued. In a full bounded queue the batch
+	// waits or fails as a whole, and its tasks are never dropped: DropOldest drops one other task per
+	// batch task that does not fit, Block waits for the whole batch to fit (or the queue to empty, if it
+	// never will), and RunInline and DropOldest run what still does not fit on the calling thread
+	void EnqueueBatch(std::span<PoolTask> tasks, TaskPriority priority = TaskPriority::Normal)
+	{
+		if (tasks.empty())
+			return;
+
+		size_t queued = tasks.size();
+		if (m_capacity > 0 && !TryReserve(tasks.size()))
+		{
+			std::vector<QueuedTask> evicted;
+			queued = OverflowBatch(tasks.size(), priority, evicted);
+			for (auto& task : evicted)
+				Drop(task);
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		std::span<PoolTask> pushed = tasks.first(queued);
+		if (m_mode == SchedulingMode::WorkStealing)
+		{
+			if (t_currentPool == this)
+			{
+				auto& local = *m_localQueues[t_workerIndex];
+				std::scoped_lock l(local.Mutex);
+				for (auto& task : pushed)
+					local.Tasks.Push(QueuedTask{ std::move(task), now }, priority);
+				m_pendingTasks.fetch_add(pushed.size());
+				m_enqueued.fetch_add(pushed.size(), std::memory_order_relaxed);
+			}
+			else
+			{
+				size_t node = SubmitNode();
+				std::scoped_lock l(m_mutex);
+				if (m_stop) StopFailure(queued);
+				for (auto& task : pushed)
+					m_tasks[node].Push(QueuedTask{ std::move(task), now }, priority);
+				m_pendingTasks.fetch_add(pushed.size());
+				m_enqueued.fetch_add(pushed.size(), std::memory_order_relaxed);
+				if (IsElastic())
+					GrowIfLaggingLocked();
+			}
+
+			WakeWorkers(std::min<size_t>(pushed.size(), m_sleepingWorkers.load()));
+		}
+		else
+		{
+			size_t node = SubmitNode();
+			size_t wake;
+			{
+				std::scoped_lock l(m_mutex);
+				if (m_stop) StopFailure(queued);
+				for (auto& task : pushed)
+					m_tasks[node].Push(QueuedTask{ std::move(task), now }, priority);
+				m_pendingTasks.fetch_add(pushed.size());
+				m_enqueued.fetch_add(pushed.size(), std::memory_order_relaxed);
+				wake = std::min<size_t>(pushed.size(), m_sleepingWorkers.load());
+				if (IsElastic())
+					GrowIfLaggingLocked();
+			}
+
+			WakeWorkers(wake);
+		}
+
+		for (auto& task : tasks.subspan(queued))
+		{
+			QueuedTask inlineTask{ std::move(task), now };
+			RunTask(inlineTask);
+		}
+	}
+
+	// Runs one queued task on the calling thread, if there is any. Lets a thread waiting on
+	// pool work help instead of blocking. Returns false when nothing was queued
+	bool RunPendingTask()
+	{
+		QueuedTask task;
+		if (m_mode == SchedulingMode::WorkStealing)
+		{
+			if (!TryPopWorkStealing(t_workerIndex, task, t_currentPool == this))
+				return false;
+		}
+		else
+		{
+			if (!TryPopShared(task))
+				return false;
+		}
+
+		RunTask(task);
+		return true;
 	}
 
 private:
 
-	void SetThreadName(const std::string& baseName, size_t threadIndex)
+	struct WorkerQueue
 	{
-#ifdef _WIN32
-		std::wstring name = std::wstring(baseName.begin(), baseName.end()) +
-			L"-" + std::to_wstring(threadIndex);
-		SetThreadDescription(GetCurrentThread(), name.c_str());
-#elif defined(__linux__)
-		std::string name = baseName + "-" + std::to_string(threadIndex);
-		pthread_setname_np(pthread_self(), name.substr(0, 15).c_str()); // 15 char limit
-#elif defined(__APPLE__)
-		std::string name = baseName + "-" + std::to_string(threadIndex);
-		pthread_setname_np(name.c_str());
-#endif
+		std::mutex Mutex;
+		TaskQueue Tasks;
+	};
+
+	// Counters of one worker slot, on their own cache line so workers don't contend on them
+	struct alignas(64) WorkerMetrics
+	{
+		std::atomic<uint64_t> Completed{ 0 };
+		std::atomic<uint64_t> Steals{ 0 };
+		std::atomic<uint64_t> BusyNanoseconds{ 0 };
+		std::atomic<uint64_t> QueueWait[LatencyHistogram::BucketCount];
+		std::atomic<uint64_t> RunTime[LatencyHistogram::BucketCount];
+	};
+
+	enum class Admission
+	{
+		Queued,		// Room was found after all
+		Evicted,	// An older task was dropped, its room goes to the new one
+		RunInline,
+		DropNew
+	};
+
+	// Room, when the queue is bounded, was taken by the caller
+	void Push(QueuedTask&& task, TaskPriority priority)
+	{
+		if (m_mode == SchedulingMode::WorkStealing)
+		{
+			PushWorkStealing(std::move(task), priority);
+			return;
+		}
+
+		size_t node = SubmitNode();
+		bool wake;
+		{
+			std::scoped_lock l(m_mutex);
+			if (m_stop) StopFailure(1);
+			m_tasks[node].Push(std::move(task), priority);
+			m_pendingTasks.fetch_add(1);
+			m_enqueued.fetch_add(1, std::memory_order_relaxed);
+			wake = m_sleepingWorkers.load() > 0;
+			if (IsElastic())
+				GrowIfLaggingLocked();
+		}
+
+		// Spinning workers pick the task up through the pending count
+		if (wake)
+			WakeWorkers(1);
+	}
+
+	// Bounded queues. A batch larger than the capacity is let in once the queue is empty
+	bool TryReserve(size_t count)
+	{
+		size_t queued = m_queued.load();
+		while (queued + count <= m_capacity || queued == 0)
+		{
+			if (m_queued.compare_exchange_weak(queued, queued + count))
+				return true;
+		}
+		return false;
+	}
+
+	// Takes whatever room is left, up to count
+	size_t ReserveUpTo(size_t count)
+	{
+		size_t queued = m_queued.load();
+		size_t room;
+		do
+		{
+			room = queued < m_capacity ? std::min(count, m_capacity - queued) : 0;
+		} while (room > 0 && !m_queued.compare_exchange_weak(queued, queued + room));
+		return room;
+	}
+
+	// Tasks left the queue or will never be queued. A producer waiting for room is woken,
+	// taking m_mutex if the caller doesn't hold it
+	void ReleaseRoom(size_t count, bool holdsMutex)
+	{
+		if (m_capacity == 0)
+			return;
+
+		m_queued.fetch_sub(count);
+		if (m_blockedProducers.load() == 0)
+			return;
+
+		if (holdsMutex)
+			m_roomCondition.notify_all();
+		else
+		{
+			std::scoped_lock l(m_mutex);
+			m_roomCondition.notify_all();
+		}
+	}
+
+	// The blocked count is published before re-checking, so a worker taking a task either
+	// sees us waiting and notifies, or we see the room it freed
+	void WaitForRoom(size_t count)
+	{
+		std::unique_lock l(m_mutex);
+		m_blockedProducers.fetch_add(1);
+		m_roomCondition.wait(l, [&]() { return m_stop || TryReserve(count); });
+		m_blockedProducers.fetch_sub(1);
+		if (m_stop)
+			throw std::runtime_error("Enqueue on stop thread pool");
+	}
+
+	// Caller holds m_mutex
+	[[noreturn]] void StopFailure(size_t reserved)
+	{
+		ReleaseRoom(reserved, true);
+		throw std::runtime_error("Enqueue on stop thread pool");
+	}
+
+	// The queue is full, applies the overflow policy to one task
+	Admission Overflow(TaskPriority priority, QueuedTask& evicted)
+	{
+		switch (m_overflow)
+		{
+		case OverflowPolicy::Fail:
+			m_rejected.fetch_add(1, std::memory_order_relaxed);
+			throw QueueFullError();
+		case OverflowPolicy::RunInline:
+			return Admission::RunInline;
+		case OverflowPolicy::DropOldest:
+		{
+			std::scoped_lock l(m_mutex);
+			if (TryReserve(1))
+				return Admission::Queued;
+
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return EvictOldest(priority, evicted) ? Admission::Evicted : Admission::DropNew;
+		}
+		case OverflowPolicy::Block:
+			break;
+		}
+
+		// A worker waiting for room in its own pool could wait forever
+		if (t_currentPool == this)
+			return Admission::RunInline;
+
+		WaitForRoom(1);
+		return Admission::Queued;
+	}
+
+	// Same for a batch, returns how many of its tasks are queued. The others run inline
+	size_t OverflowBatch(size_t count, TaskPriority priority, std::vector<QueuedTask>& evicted)
+	{
+		switch (m_overflow)
+		{
+		case OverflowPolicy::Fail:
+			m_rejected.fetch_add(count, std::memory_order_relaxed);
+			throw QueueFullError();
+		case OverflowPolicy::RunInline:
+			return ReserveUpTo(count);
+		case OverflowPolicy::DropOldest:
+		{
+			// An evicted task's room goes to the batch task taking its place
+			std::scoped_lock l(m_mutex);
+			size_t room = ReserveUpTo(count);
+			QueuedTask task;
+			while (room < count && EvictOldest(priority, task))
+			{
+				evicted.push_back(std::move(task));
+				room++;
+			}
+
+			m_dropped.fetch_add(evicted.size(), std::memory_order_relaxed);
+			return room;
+		}
+		case OverflowPolicy::Block:
+			break;
+		}
+
+		if (t_currentPool == this)
+			return ReserveUpTo(count);
+
+		WaitForRoom(count);
+		return count;
+	}
+
+	// Caller holds m_mutex. The oldest droppable task of the submission queues and the work stealing deques,
+	// at the given priority or lower. The deques are locked in index order, nothing takes m_mutex while holding one
+	bool EvictOldest(TaskPriority priority, QueuedTask& evicted)
+	{
+		TaskQueue* oldestQueue = nullptr;
+		size_t oldestLevel = 0;
+		size_t oldestPosition = 0;
+		auto consider = [&](TaskQueue& queue)
+		{
+			size_t level, position;
+			QueuedTask* task = queue.FindDroppable(priority, level, position);
+			if (task && (!oldestQueue || level > oldestLevel ||
+				(level == oldestLevel && task->EnqueuedAt < oldestQueue->Peek(oldestLevel, oldestPosition).EnqueuedAt)))
+			{
+				oldestQueue = &queue;
+				oldestLevel = level;
+				oldestPosition = position;
+			}
+		};
+
+		for (auto& queue : m_tasks)
+			consider(queue);
+
+		std::vector<std::unique_lock<std::mutex>> locks;
+		locks.reserve(m_localQueues.size());
+		for (auto& local : m_localQueues)
+		{
+			locks.emplace_back(local->Mutex);
+			consider(local->Tasks);
+		}
+
+		if (!oldestQueue)
+			return false;
+
+		evicted = oldestQueue->Remove(oldestLevel, oldestPosition);
+		m_pendingTasks.fetch_sub(1);
+		return true;
+	}
+
+	// The drop handler runs first, then the callable is destroyed unrun
+	static void Drop(QueuedTask& task)
+	{
+		if (task.OnDrop.Dropped)
+			task.OnDrop.Dropped(task.OnDrop.Context);
+		task.Task = nullptr;
+	}
+
+	// Slot is free, either never used or its previous worker retired
+	void StartWorker(size_t slot)
+	{
+		if (m_workers[slot].joinable())
+			m_workers[slot].join(); // Retired, already past its last access to the pool
+
+		m_slotRunning[slot] = true;
+		m_workers[slot] = std::thread([this, slot]() {
+			SetThreadName(m_poolName, slot);
+			SetThreadPlacement(m_placement[slot], m_qos);
+			t_currentPool = this;
+			t_workerIndex = static_cast<uint32_t>(slot);
+			if (m_mode == SchedulingMode::WorkStealing)
+				WorkStealingLoop(static_cast<uint32_t>(slot));
+			else
+				SharedQueueLoop();
+			});
+	}
+
+	// Caller holds m_mutex. Elastic pools add a worker when queued work waits too long and nobody is idle
+	void GrowIfLaggingLocked()
+	{
+		if (m_stop || m_sleepingWorkers.load() > 0 || m_totalThreads.load() >= m_workers.size())
+			return;
+
+		auto oldest = std::chrono::steady_clock::time_point::max();
+		for (const auto& queue : m_tasks)
+		{
+			if (!queue.Empty())
+				oldest = std::min(oldest, queue.OldestEnqueuedAt());
+		}
+
+		if (oldest == std::chrono::steady_clock::time_point::max() || std::chrono::steady_clock::now() - oldest < m_growLatency)
+			return;
+
+		for (size_t slot = 0; slot < m_workers.size(); slot++)
+		{
+			if (!m_slotRunning[slot])
+			{
+				m_totalThreads.fetch_add(1);
+				StartWorker(slot);
+				return;
+			}
+		}
+	}
+
+	bool IsElastic() const
+	{
+		return m_workers.size() > m_minThreads;
+	}
+
+	// Elastic pools only. With every worker blocked and nothing submitted, no pop or push would notice the lag
+	void MonitorLoop()
+	{
+		auto interval = std::max<std::chrono::steady_clock::duration>(m_growLatency, std::chrono::milliseconds(1));
+		std::unique_lock l(m_mutex);
+		while (!m_stop)
+		{
+			m_monitorCondition.wait_for(l, interval);
+			if (m_pendingTasks.load() > 0)
+				GrowIfLaggingLocked();
+		}
+	}
+
+	void SharedQueueLoop()
+	{
+		QueuedTask task;
+		while (1)
+		{
+			if (TryPopShared(task))
+			{
+				RunTask(task);
+				continue;
+			}
+
+			if (!IdleWait())
+				return;
+		}
+	}
+
+	bool TryPopShared(QueuedTask& task)
+	{
+		size_t node = SubmitNode();
+		std::scoped_lock l(m_mutex);
+		return PopNodeQueues(node, task);
+	}
+
+	// Caller holds m_mutex. The given node's queue first, then the other nodes
+	bool PopNodeQueues(size_t node, QueuedTask& task)
+	{
+		for (size_t i = 0; i < m_tasks.size(); i++)
+		{
+			TaskQueue& queue = m_tasks[(node + i) % m_tasks.size()];
+			if (!queue.Empty())
+			{
+				task = queue.Pop(false, m_aging);
+				m_pendingTasks.fetch_sub(1);
+				ReleaseRoom(1, true);
+				// Workers blocked in long tasks stop submissions from being served, catch up here too
+				if (IsElastic() && m_pendingTasks.load() > 0)
+					GrowIfLaggingLocked();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Node of the calling thread: a worker's assigned node, otherwise the node of the CPU it runs on
+	size_t SubmitNode() const
+	{
+		if (m_tasks.size() == 1)
+			return 0;
+		if (t_currentPool == this)
+			return m_workerNodes[t_workerIndex];
+
+		int cpu = CpuTopology::CurrentCpu();
+		return cpu < 0 ? 0 : CpuTopology::Get().NodeOfCpu(static_cast<uint32_t>(cpu)) % m_tasks.size();
+	}
+
+	// Spin, then yield, then park until the pending count says there is work.
+	// Returns false once the pool is stopping and nothing is left to run, or when an elastic worker retires
+	bool IdleWait()
+	{
+		for (uint32_t i = 0; i < m_idle.SpinIterations; i++)
+		{
+			if (m_pendingTasks.load(std::memory_order_relaxed) > 0)
+			{
+				m_spinHits.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+			CpuRelax();
+		}
+
+		for (uint32_t i = 0; i < m_idle.YieldIterations; i++)
+		{
+			if (m_pendingTasks.load(std::memory_order_relaxed) > 0)
+			{
+				m_yieldHits.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+			std::this_thread::yield();
+		}
+
+		// The sleeper count is published before re-checking, so an enqueuer either
+		// sees us sleeping and notifies, or we see its task
+		std::unique_lock l(m_mutex);
+		auto ready = [this]() { return m_stop || m_pendingTasks.load() > 0; };
+		m_sleepingWorkers.fetch_add(1);
+		if (!ready())
+			m_parks.fetch_add(1, std::memory_order_relaxed);
+
+		while (!ready())
+		{
+			if (m_totalThreads.load() <= m_minThreads)
+			{
+				m_condition.wait(l);
+				continue;
+			}
+
+			if (m_condition.wait_for(l, m_retireAfter) == std::cv_status::timeout && !ready() && m_totalThreads.load() > m_minThreads)
+			{
+				// Idle for too long above the minimum, the thread exits and its slot can be reused
+				m_sleepingWorkers.fetch_sub(1);
+				m_totalThreads.fetch_sub(1);
+				m_slotRunning[t_workerIndex] = false;
+				return false;
+			}
+		}
+
+		m_sleepingWorkers.fetch_sub(1);
+		return !(m_stop && m_pendingTasks.load() == 0);
 	}
 
+	void WorkStealingLoop(uint32_t index)
+	{
+		QueuedTask task;
+		while (1)
+		{
+			if (TryPopWorkStealing(index, task))
+			{
+				RunTask(task);
+				continue;
+			}
+
+			// Nothing found anywhere
+			if (!IdleWait())
+				return;
+		}
+	}
+
+	// The room is released after the deque's lock, ReleaseRoom() may take m_mutex and EvictOldest() nests them the other way
+	bool PopLocal(size_t index, bool newestFirst, QueuedTask& task)
+	{
+		auto& local = *m_localQueues[index];
+		{
+			std::scoped_lock l(local.Mutex);
+			if (local.Tasks.Empty())
+				return false;
+
+			task = local.Tasks.Pop(newestFirst, m_aging);
+			m_pendingTasks.fetch_sub(1);
+		}
+		ReleaseRoom(1, false);
+		return true;
+	}
+
+	// ownsQueue is false for threads outside the pool, those skip straight to the injection queue
+	bool TryPopWorkStealing(uint32_t index, QueuedTask& task, bool ownsQueue = true)
+	{
+		// Own deque first, newest task (LIFO) as it is most likely still in cache
+		if (ownsQueue && PopLocal(index, true, task))
+			return true;
+
+		// Then the injection queues fed by threads outside the pool, our node's first
+		size_t node = SubmitNode();
+		{
+			std::scoped_lock l(m_mutex);
+			if (PopNodeQueues(node, task))
+				return true;
+		}
+
+		// Finally steal the oldest task from another worker, on the same node first
+		for (int pass = 0; pass < (m_tasks.size() > 1 ? 2 : 1); pass++)
+		{
+			for (size_t i = ownsQueue ? 1 : 0; i < m_localQueues.size(); i++)
+			{
+				size_t victimIndex = (index + i) % m_localQueues.size();
+				if (m_tasks.size() > 1 && (m_workerNodes[victimIndex] == node) != (pass == 0))
+					continue;
+
+				if (PopLocal(victimIndex, false, task))
+				{
+					m_metrics[MetricsSlot()].Steals.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+
+	void PushWorkStealing(QueuedTask&& task, TaskPriority priority)
+	{
+		if (t_currentPool == this)
+		{
+			// Submitted from one of our workers, keep it local so it can be stolen if needed
+			auto& local = *m_localQueues[t_workerIndex];
+			std::scoped_lock l(local.Mutex);
+			local.Tasks.Push(std::move(task), priority);
+			m_pendingTasks.fetch_add(1);
+			m_enqueued.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			size_t node = SubmitNode();
+			std::scoped_lock l(m_mutex);
+			if (m_stop) StopFailure(1);
+			m_tasks[node].Push(std::move(task), priority);
+			m_pendingTasks.fetch_add(1);
+			m_enqueued.fetch_add(1, std::memory_order_relaxed);
+			if (IsElastic())
+				GrowIfLaggingLocked();
+		}
+
+		if (m_sleepingWorkers.load() > 0)
+			WakeWorkers(1);
+	}
+
+	void WakeWorkers(size_t count)
+	{
+		if (count == 0)
+			return;
+
+		if (m_mode == SchedulingMode::WorkStealing)
+		{
+			// Work stealing pushes outside m_mutex, taking it guarantees a worker
+			// that registered as sleeper is already waiting
+			std::scoped_lock l(m_mutex);
+		}
+
+		m_wakeups.fetch_add(count, std::memory_order_relaxed);
+		if (count >= m_totalThreads)
+		{
+			m_condition.notify_all();
+			return;
+		}
+
+		for (size_t i = 0; i < count; i++)
+			m_condition.notify_one();
+	}
+
+	void RunTask(QueuedTask& task)
+	{
+		WorkerMetrics& metrics = m_metrics[MetricsSlot()];
+		m_activeThreads.fetch_add(1, std::memory_order_relaxed);
+
+		std::chrono::steady_clock::time_point start;
+		if (m_collectTimings)
+		{
+			start = std::chrono::steady_clock::now();
+			metrics.QueueWait[LatencyHistogram::BucketOf(Microseconds(start - task.EnqueuedAt))].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		try
+		{
+			task.Task();
+		}
+		catch (...)
+		{
+		}
+
+		if (m_collectTimings)
+		{
+			auto ran = std::chrono::steady_clock::now() - start;
+			metrics.RunTime[LatencyHistogram::BucketOf(Microseconds(ran))].fetch_add(1, std::memory_order_relaxed);
+			metrics.BusyNanoseconds.fetch_add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(ran).count()), std::memory_order_relaxed);
+		}
+
+		metrics.Completed.fetch_add(1, std::memory_order_relaxed);
+		m_activeThreads.fetch_sub(1, std::memory_order_relaxed);
+		task.Task = nullptr;
+	}
+
+	static uint64_t Microseconds(std::chrono::steady_clock::duration duration)
+	{
+		return static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(duration).count()));
+	}
+
+	// A worker's own slot, threads outside the pool share the last one
+	size_t MetricsSlot() const
+	{
+		return t_currentPool == this ? t_workerIndex : m_workers.size();
+	}
+
+	inline static thread_local ThreadPool* t_currentPool = nullptr; // Pool owning the calling thread, if any
+	inline static thread_local uint32_t t_workerIndex = 0;
+
 	std::vector<std::thread> m_workers;
 	std::mutex m_mutex;
 	std::condition_variable m_condition;
-	std::queue<std::function<void()>> m_tasks;
+	std::thread m_monitor; // Elastic pools only, checks for lag between submissions
+	std::condition_variable m_monitorCondition; // Wakes the monitor for shutdown
+	std::vector<TaskQueue> m_tasks; // Shared queue, or injection queue in work stealing mode. One per NUMA node when NumaAware
+	std::vector<uint32_t> m_workerNodes;
+	std::vector<std::unique_ptr<WorkerQueue>> m_localQueues; // Work stealing only
+	std::atomic<size_t> m_pendingTasks = 0; // Tasks sitting in any queue, what idle workers watch
+	std::atomic<uint32_t> m_sleepingWorkers = 0; // Parked on m_condition
+	std::atomic<uint64_t> m_spinHits = 0;
+	std::atomic<uint64_t> m_yieldHits = 0;
+	std::atomic<uint64_t> m_parks = 0;
+	std::atomic<uint64_t> m_wakeups = 0;
+	std::atomic<uint64_t> m_enqueued = 0;
+	std::atomic<uint64_t> m_canceled = 0;
+	std::atomic<uint64_t> m_timedOut = 0;
+	std::atomic<uint64_t> m_rejected = 0;
+	std::atomic<uint64_t> m_dropped = 0;
+	size_t m_capacity = 0; // Bounded queue, 0 for none
+	OverflowPolicy m_overflow = OverflowPolicy::Block;
+	std::atomic<size_t> m_queued = 0; // Bounded queue only, room taken by queued tasks and submissions about to be
+	std::atomic<uint32_t> m_blockedProducers = 0; // Waiting on m_roomCondition
+	std::condition_variable m_roomCondition;
+	std::unique_ptr<WorkerMetrics[]> m_metrics; // One per worker slot plus one for threads outside the pool
+	bool m_collectTimings = true;
+	std::chrono::steady_clock::time_point m_startedAt;
 	std::atomic<uint32_t> m_activeThreads = 0;
-	uint32_t m_totalThreads;
+	std::atomic<uint32_t> m_totalThreads;
+	SchedulingMode m_mode;
+	IdlePolicy m_idle;
+	std::chrono::steady_clock::duration m_aging;
+	std::string m_poolName;
+	ThreadQoS m_qos;
+	std::vector<std::vector<uint32_t>> m_placement; // CPUs per worker slot, empty for no pinning
+	std::vector<bool> m_slotRunning; // Guarded by m_mutex once workers run
+	uint32_t m_minThreads;
+	std::chrono::steady_clock::duration m_growLatency;
+	std::chrono::steady_clock::duration m_retireAfter;
 	bool m_stop;
 };
@@ -0,0 +1,339 @@
+#include "SimpleAsync.h"
+#include <atomic>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <map>
+
+// Hot path benchmarks for SimpleAsync and ThreadPool.
+//
+//   benchmark [--quick] [--save file] [--baseline file] [--tolerance 0.10]
+//
+// --save writes every result as "name value" lines, --baseline compares against such a file
+// and exits with 1 when a result got worse by more than the tolerance.
+// Build with optimizations, e.g. g++ -std=c++20 -O2 -pthread benchmark.cpp -o benchmark
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchResult
+{
+    std::string Name;
+    double Value;
+    std::string Unit;
+    bool HigherIsBetter;
+};
+
+static std::vector<BenchResult> s_results;
+static double s_scale = 1.0; // Fraction of the default amount of work, --quick uses a tenth
+
+static void Report(const std::string& name, double value, const std::string& unit, bool higherIsBetter)
+{
+    s_results.push_back({ name, value, unit, higherIsBetter });
+    std::cout << std::left << std::setw(44) << name << std::right << std::setw(14) << std::fixed << std::setprecision(2) << value << " " << unit << std::endl;
+}
+
+static double Seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static const char* ModeName(SchedulingMode mode)
+{
+    return mode == SchedulingMode::WorkStealing ? "ws" : "shared";
+}
+
+static std::vector<size_t> ThreadCounts()
+{
+    size_t hardware = std::max<size_t>(1, std::thread::hardware_concurrency());
+    std::vector<size_t> counts;
+    for (size_t n = 1; n < hardware; n *= 2)
+        counts.push_back(n);
+    counts.push_back(hardware);
+    return counts;
+}
+
+static double Percentile(std::vector<double>& samples, double p)
+{
+    if (samples.empty())
+        return 0;
+
+    size_t index = static_cast<size_t>(p * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+// Raw pool submission: empty tasks pushed by 1..N producer threads straight into ThreadPool::Enqueue
+static void BenchPoolThroughput(SchedulingMode mode)
+{
+    const size_t perProducer = static_cast<size_t>(200000 * s_scale);
+    size_t workers = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+    for (size_t producers : ThreadCounts())
+    {
+        ThreadPoolOptions options;
+        options.Mode = mode;
+        ThreadPool pool(workers, "Bench", options);
+
+        std::atomic<size_t> done{ 0 };
+        size_t total = perProducer * producers;
+
+        auto start = Clock::now();
+        std::vector<std::thread> threads;
+        for (size_t p = 0; p < producers; p++)
+        {
+            threads.emplace_back([&]()
+                {
+                    for (size_t i = 0; i < perProducer; i++)
+                        pool.Enqueue([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+                });
+        }
+        for (auto& t : threads)
+            t.join();
+
+        while (done.load(std::memory_order_relaxed) < total)
+            std::this_thread::yield();
+
+        Report(std::string("pool.throughput.") + ModeName(mode) + ".p" + std::to_string(producers), total / Seconds(start), "tasks/s", true);
+    }
+}
+
+// End to end: CreateTask from 1..N producers with the calling thread driving Update() until every callback ran
+static void BenchTaskThroughput(SchedulingMode mode)
+{
+    const size_t perProducer = static_cast<size_t>(50000 * s_scale);
+    size_t workers = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+    for (size_t producers : ThreadCounts())
+    {
+        ThreadPoolOptions options;
+        options.Mode = mode;
+        SimpleAsync::Initialize("Bench", workers, options);
+
+        size_t callbacks = 0;
+        size_t total = perProducer * producers;
+
+        auto start = Clock::now();
+        std::vector<std::thread> threads;
+        for (size_t p = 0; p < producers; p++)
+        {
+            threads.emplace_back([&]()
+                {
+                    for (size_t i = 0; i < perProducer; i++)
+                        SimpleAsync::CreateTask([](CancellationToken, Progress) { return 0; }, [&callbacks](int) { callbacks++; }, AsyncOptions{});
+                });
+        }
+
+        while (callbacks < total)
+            SimpleAsync::Update();
+
+        double seconds = Seconds(start);
+        for (auto& t : threads)
+            t.join();
+
+        Report(std::string("task.throughput.") + ModeName(mode) + ".p" + std::to_string(producers), total / seconds, "tasks/s", true);
+        SimpleAsync::Destroy();
+    }
+}
+
+// Time from CreateTask until a worker starts the task body, on an otherwise idle pool
+static void BenchStartLatency(SchedulingMode mode)
+{
+    const size_t samples = static_cast<size_t>(20000 * s_scale);
+    size_t workers = std::max<size_t>(2, std::thread::hardware_concurrency() / 2);
+
+    ThreadPoolOptions options;
+    options.Mode = mode;
+    SimpleAsync::Initialize("Bench", workers, options);
+
+    std::vector<double> latencies(samples);
+    std::atomic<size_t> started{ 0 };
+
+    for (size_t i = 0; i < samples; i++)
+    {
+        auto submit = Clock::now();
+        SimpleAsync::CreateTask([&latencies, &started, submit, i](CancellationToken, Progress)
+            {
+                latencies[i] = std::chrono::duration<double, std::micro>(Clock::now() - submit).count();
+                started.fetch_add(1, std::memory_order_release);
+                return 0;
+            }, AsyncOptions{});
+
+        // One task in flight at a time, so this measures wakeup and dispatch rather than queueing
+        while (started.load(std::memory_order_acquire) <= i)
+            std::this_thread::yield();
+
+        if (i % 256 == 0)
+            SimpleAsync::Update();
+    }
+    SimpleAsync::Update();
+
+    Report(std::string("latency.start.") + ModeName(mode) + ".p50", Percentile(latencies, 0.50), "us", false);
+    Report(std::string("latency.start.") + ModeName(mode) + ".p99", Percentile(latencies, 0.99), "us", false);
+    SimpleAsync::Destroy();
+}
+
+// Cost of an Update() call with nothing completing, as the number of registered but unfinished tasks grows
+static void BenchUpdateCost()
+{
+    const size_t calls = 2000;
+    size_t workers = 2;
+
+    for (size_t inFlight : { size_t(0), size_t(1000), size_t(10000), size_t(100000) })
+    {
+        SimpleAsync::Initialize("Bench", workers);
+
+        std::atomic<bool> release{ false };
+        AsyncOptions opt;
+        for (size_t i = 0; i < inFlight; i++)
+        {
+            SimpleAsync::CreateTask([&release](CancellationToken, Progress)
+                {
+                    while (!release.load(std::memory_order_acquire))
+                        std::this_thread::yield();
+                    return 0;
+                }, opt);
+        }
+
+        auto start = Clock::now();
+        for (size_t i = 0; i < calls; i++)
+            SimpleAsync::Update();
+        double perCall = Seconds(start) * 1e9 / calls;
+
+        release.store(true, std::memory_order_release);
+        SimpleAsync::Destroy();
+
+        Report("update.cost.inflight" + std::to_string(inFlight), perCall, "ns/call", false);
+    }
+}
+
+// ParallelFor over the same data with 1..N workers, reported as time and speedup over one worker
+static void BenchParallelFor()
+{
+    const size_t count = static_cast<size_t>((size_t(1) << 22) * s_scale);
+    std::vector<float> data(count, 1.0f);
+    double single = 0;
+
+    for (size_t workers : ThreadCounts())
+    {
+        SimpleAsync::Initialize("Bench", workers);
+
+        // Warm up the pool and the data once
+        SimpleAsync::ParallelFor(0, count, 0, [&](size_t i) { data[i] = std::sqrt(data[i] + 1.0f); });
+
+        const int rounds = 5;
+        auto start = Clock::now();
+        for (int r = 0; r < rounds; r++)
+            SimpleAsync::ParallelFor(0, count, 0, [&](size_t i) { data[i] = std::sqrt(data[i] + 1.0f); });
+        double ms = Seconds(start) * 1000.0 / rounds;
+
+        if (workers == 1)
+            single = ms;
+
+        Report("parallelfor.t" + std::to_string(workers), ms, "ms", false);
+        if (workers > 1 && ms > 0)
+            Report("parallelfor.speedup.t" + std::to_string(workers), single / ms, "x", true);
+
+        SimpleAsync::Destroy();
+    }
+}
+
+static bool SaveResults(const std::string& path)
+{
+    std::ofstream out(path);
+    if (!out)
+        return false;
+
+    for (const auto& result : s_results)
+        out << result.Name << " " << std::setprecision(10) << result.Value << "\n";
+    return true;
+}
+
+// Returns the number of results that regressed beyond the tolerance
+static int CompareBaseline(const std::string& path, double tolerance)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        std::cout << "Could not read baseline " << path << std::endl;
+        return 0;
+    }
+
+    std::map<std::string, double> baseline;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        std::string name;
+        double value;
+        if (fields >> name >> value)
+            baseline[name] = value;
+    }
+
+    int regressions = 0;
+    std::cout << "\nAgainst baseline " << path << " (tolerance " << tolerance * 100 << "%)" << std::endl;
+    for (const auto& result : s_results)
+    {
+        auto it = baseline.find(result.Name);
+        if (it == baseline.end() || it->second == 0)
+            continue;
+
+        double change = (result.Value - it->second) / it->second;
+        bool worse = result.HigherIsBetter ? change < -tolerance : change > tolerance;
+        if (worse)
+            regressions++;
+
+        std::cout << std::left << std::setw(44) << result.Name << std::right << std::setw(9) << std::showpos << std::setprecision(1) << change * 100 << "%" << std::noshowpos
+            << (worse ? "  REGRESSION" : "") << std::endl;
+    }
+    return regressions;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string savePath;
+    std::string baselinePath;
+    double tolerance = 0.10;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--quick")
+            s_scale = 0.1;
+        else if (arg == "--save" && i + 1 < argc)
+            savePath = argv[++i];
+        else if (arg == "--baseline" && i + 1 < argc)
+            baselinePath = argv[++i];
+        else if (arg == "--tolerance" && i + 1 < argc)
+            tolerance = std::stod(argv[++i]);
+        else
+        {
+            std::cout << "Usage: benchmark [--quick] [--save file] [--baseline file] [--tolerance 0.10]" << std::endl;
+            return 2;
+        }
+    }
+
+    std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+
+    for (SchedulingMode mode : { SchedulingMode::SharedQueue, SchedulingMode::WorkStealing })
+    {
+        BenchPoolThroughput(mode);
+        BenchTaskThroughput(mode);
+        BenchStartLatency(mode);
+    }
+    BenchUpdateCost();
+    BenchParallelFor();
+
+    if (!savePath.empty() && !SaveResults(savePath))
+        std::cout << "Could not write " << savePath << std::endl;
+
+    if (!baselinePath.empty() && CompareBaseline(baselinePath, tolerance) > 0)
+        return 1;
+
+    return 0;
+}
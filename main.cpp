@@ -24,6 +24,15 @@ int main(int argc, char* argv[])
         // Create a low priority queue with single thread for sequential task execution
         SimpleAsync::CreatePool("LowPriorityQueue", 1);
 
+        // Stream pool metrics into the trace as counters
+        SimpleAsync::SetMetricsHook([](const std::string& poolName, const PoolMetrics& metrics)
+            {
+                Profiler::Instance().WriteCounter(poolName, {
+                    { "queued", static_cast<double>(metrics.QueueDepth) },
+                    { "active", static_cast<double>(metrics.ActiveThreads) },
+                    { "completed", static_cast<double>(metrics.Completed) } });
+            });
+
         // === No Callback task ===
         auto noCBTask = [](CancellationToken token, Progress prog, int durationMs) -> int
             {
@@ -91,11 +100,11 @@ int main(int argc, char* argv[])
                 std::cout << "[Timeout Callback] Result: " << result << " on thread: " << std::this_thread::get_id() << std::endl;
             };
 
-        auto timeoutHandler = [](uint32_t id)
+        auto timeoutHandler = [](TaskHandle id)
             {
                 PROFILE_SCOPE("Timeout handler");
                 std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                std::cout << "[Timeout Handler] Timeout reached! Canceling task " << id << std::endl;
+                std::cout << "[Timeout Handler] Timeout reached! Canceling task " << id.Index << std::endl;
                 SimpleAsync::Cancel(id);
             };
 
@@ -175,7 +184,7 @@ int main(int argc, char* argv[])
         auto taskKillLoop = [](CancellationToken token, Progress prog) {
             for (int i = 1; i <= 10; i++)
             {
-                prog->Value = i / 10.0f;
+                prog->Report(i / 10.0f);
                 std::this_thread::sleep_for(std::chrono::milliseconds(1000));
             }
             return 0;
@@ -187,12 +196,7 @@ int main(int argc, char* argv[])
             };
         AsyncOptions opt2;
         opt2.ProgressCallback = [](float p) {
-            static float previous = 0;
-            if (p > previous)
-            {
-                previous = p;
-                std::cout << "[Progress Callback] Progress until exit loop: " << p << " on thread: " << std::this_thread::get_id() << std::endl;
-            }
+            std::cout << "[Progress Callback] Progress until exit loop: " << p << " on thread: " << std::this_thread::get_id() << std::endl;
             };
 
         SimpleAsync::CreateTask(taskKillLoop, killLoopCB, opt2);
@@ -210,7 +214,7 @@ int main(int argc, char* argv[])
             // Cancel the cancelable task at frame 50
             if (frames == 150)
             {
-                std::cout << "\n[Main Loop] Frame " << frames << ": Canceling task " << cancelTaskID << std::endl;
+                std::cout << "\n[Main Loop] Frame " << frames << ": Canceling task " << cancelTaskID.Index << std::endl;
                 SimpleAsync::Cancel(cancelTaskID);
             }    
             std::this_thread::sleep_for(std::chrono::milliseconds(16));
@@ -0,0 +1,2442 @@
+// Task lifecycle events are checked in TestProfilerTaskTrace
+#define SIMPLEASYNC_TRACE
+#include "SimpleAsync.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <new>
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Tests for SimpleAsync and the Profiler, one scenario per feature plus the races that once crashed, hung or
+// ran a callback twice. Profiler sessions are written to the temp directory and deleted once read back.
+//
+//   tests
+//
+// Prints every failed check and exits with 1 if there was one. A hang is reported after a minute.
+// Build with sanitizers to catch the races too, e.g. g++ -std=c++20 -g -pthread -fsanitize=address tests.cpp -o tests
+
+static int s_failures = 0;
+
+static void Check(bool condition, const std::string& what)
+{
+    if (condition)
+        return;
+
+    s_failures++;
+    std::cout << "  FAILED: " << what << std::endl;
+}
+
+// Counts the heap allocations of the current thread while enabled, to check what gets pooled
+static thread_local bool t_countAllocations = false;
+static thread_local int t_allocations = 0;
+
+// Every replaced form goes through this pair, so GCC never sees free() on what operator new returned.
+// Over-aligned allocations keep the library's own pair
+static void* CountedAllocate(size_t size)
+{
+    if (t_countAllocations)
+        t_allocations++;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+static void CountedFree(void* p) noexcept
+{
+    std::free(p);
+}
+
+void* operator new(size_t size)
+{
+    return CountedAllocate(size);
+}
+
+void* operator new[](size_t size)
+{
+    return CountedAllocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    CountedFree(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    CountedFree(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    CountedFree(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    CountedFree(p);
+}
+
+static const char* ExecutorName(CallbackExecutor executor)
+{
+    switch (executor)
+    {
+    case CallbackExecutor::Inline: return "inline";
+    case CallbackExecutor::Pool: return "pool";
+    default: return "update";
+    }
+}
+
+static void DrainUpdates()
+{
+    for (int i = 0; i < 100 && SimpleAsync::GetPendingCallbacksCount() > 0; i++)
+        SimpleAsync::Update();
+}
+
+// Many workers finishing at once push onto the completion queue while Update() drains it, no callback is lost or run twice
+static void TestConcurrentCompletions()
+{
+    std::cout << "Concurrent completions" << std::endl;
+
+    SimpleAsync::CreatePool("Completions", 8);
+    const int count = 20000;
+    std::vector<int> calls(count, 0);
+    int called = 0;
+    std::thread::id caller = std::this_thread::get_id();
+    bool onCaller = true;
+    for (int i = 0; i < count; i++)
+    {
+        SimpleAsync::CreateTaskInPool("Completions", [](CancellationToken, Progress, int index) { return index; },
+            [&calls, &called, &onCaller, caller](int index)
+            {
+                calls[index]++;
+                called++;
+                onCaller = onCaller && std::this_thread::get_id() == caller;
+            }, AsyncOptions{}, i);
+
+        // Drained while workers are still completing
+        if (i % 100 == 0)
+            SimpleAsync::Update();
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+    while (called < count && std::chrono::steady_clock::now() < deadline)
+        SimpleAsync::Update();
+
+    // A repeat would show up late
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    DrainUpdates();
+
+    int missing = static_cast<int>(std::count(calls.begin(), calls.end(), 0));
+    int repeated = static_cast<int>(std::count_if(calls.begin(), calls.end(), [](int c) { return c > 1; }));
+    Check(missing == 0 && repeated == 0, "every callback ran exactly once, " + std::to_string(missing) + " missing and "
+        + std::to_string(repeated) + " repeated");
+    Check(onCaller, "the callbacks ran on the thread calling Update()");
+}
+
+// Workers retire Inline and Pool tasks while Update() runs their progress callbacks, each still gets its last value
+static void TestProgressWhileRetiring()
+{
+    std::cout << "Progress while workers retire tasks" << std::endl;
+
+    for (CallbackExecutor executor : { CallbackExecutor::Inline, CallbackExecutor::Pool })
+    {
+        const int count = 2000;
+        std::atomic<int> results{ 0 };
+        int progress = 0;
+        bool increasing = true;
+        std::vector<float> last(count, 0.0f);
+
+        std::vector<TaskHandle> handles;
+        for (int i = 0; i < count; i++)
+        {
+            AsyncOptions opt{};
+            opt.Executor = executor;
+            opt.ProgressCallback = [&, i](float value)
+                {
+                    progress++;
+                    increasing = increasing && value > last[i];
+                    last[i] = value;
+                };
+
+            handles.push_back(SimpleAsync::CreateTask([](CancellationToken, Progress prog, int value)
+                {
+                    for (int step = 1; step <= 4; step++)
+                        prog->Report(step / 4.0f);
+                    return value;
+                }, [&results](int) { results++; }, opt, i));
+            SimpleAsync::Update();
+        }
+
+        for (TaskHandle handle : handles)
+        {
+            SimpleAsync::Update();
+            SimpleAsync::ForceWait(handle);
+        }
+        for (int i = 0; i < 100 && std::count(last.begin(), last.end(), 1.0f) < count; i++)
+            SimpleAsync::Update();
+        DrainUpdates();
+
+        std::string name = ExecutorName(executor);
+        Check(results == count, name + ": every callback ran once, got " + std::to_string(results.load()));
+        Check(std::count(last.begin(), last.end(), 1.0f) == count, name + ": every task's last progress was delivered, got "
+            + std::to_string(std::count(last.begin(), last.end(), 1.0f)));
+        Check(increasing && progress <= count * 4, name + ": each change was delivered at most once and in order, got "
+            + std::to_string(progress) + " calls");
+    }
+}
+
+// Reports handed over one at a time, each followed by an Update(), against the delta and interval throttles
+static void TestProgressThrottling()
+{
+    std::cout << "Progress throttling" << std::endl;
+
+    // Runs a task reporting the values in turn. between(i) runs on this thread once value i was reported,
+    // before the Update() that picks it up. The last value is reported right before the task returns
+    auto run = [](AsyncOptions opt, std::vector<float> values, auto&& between)
+    {
+        std::vector<float> delivered;
+        std::atomic<size_t> reported{ 0 };
+        std::atomic<size_t> acknowledged{ 0 };
+        opt.ProgressCallback = [&delivered](float value) { delivered.push_back(value); };
+
+        TaskHandle handle = SimpleAsync::CreateTask([&](CancellationToken, Progress prog)
+            {
+                for (size_t i = 0; i < values.size(); i++)
+                {
+                    prog->Report(values[i]);
+                    reported = i + 1;
+                    while (i + 1 < values.size() && acknowledged <= i)
+                        std::this_thread::yield();
+                }
+                return 0;
+            }, [](int) {}, opt);
+
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            while (reported <= i)
+                std::this_thread::yield();
+            if (i + 1 == values.size())
+            {
+                while (SimpleAsync::GetPendingCallbacksCount() == 0)
+                    std::this_thread::yield();
+            }
+
+            between(i);
+            SimpleAsync::Update();
+            acknowledged = i + 1;
+        }
+        SimpleAsync::ForceWait(handle);
+        DrainUpdates();
+        return delivered;
+    };
+
+    auto describe = [](const std::vector<float>& values)
+    {
+        std::string text;
+        for (float value : values)
+            text += std::to_string(value) + " ";
+        return text;
+    };
+
+    AsyncOptions delta{};
+    delta.ProgressMinDelta = 0.25f;
+    std::vector<float> delivered = run(delta, { 0.1f, 0.2f, 0.3f, 0.5f, 0.6f, 1.0f }, [](size_t) {});
+    Check(delivered == std::vector<float>{ 0.3f, 0.6f, 1.0f }, "changes under the delta were skipped, got " + describe(delivered));
+
+    // The last value is under the delta and not 1, the task finishing still delivers it
+    delivered = run(delta, { 0.5f, 0.6f }, [](size_t) {});
+    Check(delivered == std::vector<float>{ 0.5f, 0.6f }, "a finished task's last value skips the delta, got " + describe(delivered));
+
+    AsyncOptions interval{};
+    interval.ProgressMinIntervalMilliseconds = 200.0f;
+    delivered = run(interval, { 0.1f, 0.2f, 0.3f, 0.4f }, [](size_t i)
+        {
+            // Past the interval before the third value is picked up, the second one waited with it
+            if (i == 2)
+                std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        });
+    Check(delivered == std::vector<float>{ 0.1f, 0.3f, 0.4f }, "values inside the interval waited and a finished task's last one did not, got "
+        + describe(delivered));
+
+    // Update() skips the last value for the delta while the task still runs, it goes out once the task finished
+    for (CallbackExecutor executor : { CallbackExecutor::Update, CallbackExecutor::Inline, CallbackExecutor::Pool })
+    {
+        std::vector<float> held;
+        std::atomic<bool> reported{ false };
+        std::atomic<bool> skipped{ false };
+        std::atomic<bool> done{ false };
+        AsyncOptions opt{};
+        opt.Executor = executor;
+        opt.ProgressMinDelta = 0.5f;
+        opt.ProgressCallback = [&held](float value) { held.push_back(value); };
+        SimpleAsync::CreateTask([&](CancellationToken, Progress prog)
+            {
+                prog->Report(0.3f);
+                reported = true;
+                while (!skipped)
+                    std::this_thread::yield();
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                return 0;
+            }, [&done](int) { done = true; }, opt);
+
+        while (!reported)
+            std::this_thread::yield();
+        SimpleAsync::Update();
+        skipped = true;
+        for (int i = 0; i < 1000 && (!done || held.empty()); i++)
+        {
+            SimpleAsync::Update();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        DrainUpdates();
+        Check(held == std::vector<float>{ 0.3f }, std::string(ExecutorName(executor)) + ": a value skipped before the task finished was delivered, got "
+            + describe(held));
+    }
+}
+
+// Continuations get their parents' results: a chain passes its value along, WhenAll keeps the order of its
+// parents whatever order they finish in, and WhenAny runs once with the first winner
+static void TestContinuations()
+{
+    std::cout << "Continuations" << std::endl;
+
+    for (CallbackExecutor executor : { CallbackExecutor::Update, CallbackExecutor::Inline, CallbackExecutor::Pool })
+    {
+        std::string name = ExecutorName(executor);
+        AsyncOptions opt{};
+        opt.Executor = executor;
+
+        std::atomic<int> chained{ 0 };
+        auto first = SimpleAsync::CreateTask([](CancellationToken, Progress) { return 2; }, AsyncOptions{});
+        auto second = SimpleAsync::Then(first, [](CancellationToken, Progress, int value) { return value * 3; }, AsyncOptions{});
+        auto third = second.Then([](CancellationToken, Progress, int value) { return value + 1; }, [&chained](int value) { chained = value; }, opt);
+
+        // The first parent finishes last
+        const int parentCount = 4;
+        std::vector<TypedTaskHandle<int>> parents;
+        for (int i = 0; i < parentCount; i++)
+        {
+            parents.push_back(SimpleAsync::CreateTask([i](CancellationToken, Progress)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds((parentCount - i) * 5));
+                    return i;
+                }, AsyncOptions{}));
+        }
+        std::vector<int> all;
+        auto whenAll = SimpleAsync::WhenAll(parents, [](CancellationToken, Progress, std::vector<int> values) { return values; },
+            [&all](std::vector<int> values) { all = std::move(values); }, opt);
+
+        std::atomic<bool> release{ false };
+        std::atomic<int> anyRuns{ 0 };
+        std::atomic<int> anyCallbacks{ 0 };
+        std::atomic<int> winner{ 0 };
+        auto slow = SimpleAsync::CreateTask([&release](CancellationToken, Progress)
+            {
+                while (!release)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                return 2;
+            }, AsyncOptions{});
+        auto fast = SimpleAsync::CreateTask([](CancellationToken, Progress) { return 1; }, AsyncOptions{});
+        auto whenAny = SimpleAsync::WhenAny(std::vector<TypedTaskHandle<int>>{ slow, fast },
+            [&anyRuns](CancellationToken, Progress, int value) { anyRuns++; return value; },
+            [&anyCallbacks, &winner](int value) { anyCallbacks++; winner = value; }, opt);
+
+        SimpleAsync::ForceWait(third);
+        SimpleAsync::ForceWait(whenAll);
+        SimpleAsync::ForceWait(whenAny);
+        release = true;
+        SimpleAsync::ForceWait(slow);
+        DrainUpdates();
+
+        Check(chained == 7, name + ": the chain passed its value along, got " + std::to_string(chained.load()));
+        Check(all == std::vector<int>{ 0, 1, 2, 3 }, name + ": WhenAll kept the order of its parents");
+        Check(winner == 1, name + ": WhenAny got the first parent to finish, got " + std::to_string(winner.load()));
+        Check(anyRuns == 1 && anyCallbacks == 1, name + ": WhenAny ran once, got " + std::to_string(anyRuns.load()) + " runs and "
+            + std::to_string(anyCallbacks.load()) + " callbacks");
+    }
+}
+
+// Continuations attached to a parent that already failed, their callbacks re-enter the registry
+static void TestContinuationsOfFailedParents()
+{
+    std::cout << "Continuations of failed parents" << std::endl;
+
+    for (CallbackExecutor executor : { CallbackExecutor::Update, CallbackExecutor::Inline, CallbackExecutor::Pool })
+    {
+        std::atomic<int> ran{ 0 };
+        AsyncOptions opt{};
+        opt.Executor = executor;
+
+        auto failed = SimpleAsync::CreateTask([](CancellationToken, Progress) -> int { throw std::runtime_error("failed"); }, AsyncOptions{});
+        auto done = SimpleAsync::CreateTask([](CancellationToken, Progress) { return 1; }, AsyncOptions{});
+        // Finished but not drained yet, Update() has not seen them
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        auto then = SimpleAsync::Then(failed, [](CancellationToken, Progress, int value) { return value; }, [&ran](int) { ran++; }, opt);
+        auto all = SimpleAsync::WhenAll(std::vector<TypedTaskHandle<int>>{ failed, done },
+            [](CancellationToken, Progress, std::vector<int>) { return 1; }, [&ran](int) { ran++; }, opt);
+        auto any = SimpleAsync::WhenAny(std::vector<TypedTaskHandle<int>>{ failed },
+            [](CancellationToken, Progress, int value) { return value; }, [&ran](int) { ran++; }, opt);
+        auto next = SimpleAsync::Then(done, [](CancellationToken, Progress, int value) { return value + 1; }, [&ran](int value) { ran += value * 10; }, opt);
+
+        SimpleAsync::ForceWait(then);
+        SimpleAsync::ForceWait(all);
+        SimpleAsync::ForceWait(any);
+        SimpleAsync::ForceWait(next);
+        DrainUpdates();
+
+        // Only the continuation of the task that succeeded gets a result
+        Check(ran == 20, std::string(ExecutorName(executor)) + ": only the healthy chain called back, got " + std::to_string(ran.load()));
+    }
+}
+
+// A pool with room for two queued tasks, while its only worker is held by a gate
+static void TestOverflowPolicies()
+{
+    std::cout << "Overflow policies" << std::endl;
+
+    const char* names[] = { "Block", "Fail", "DropOldest", "RunInline" };
+    for (OverflowPolicy policy : { OverflowPolicy::Block, OverflowPolicy::Fail, OverflowPolicy::DropOldest, OverflowPolicy::RunInline })
+    {
+        std::string pool = std::string("Overflow") + names[static_cast<int>(policy)];
+        ThreadPoolOptions options;
+        options.QueueCapacity = 2;
+        options.Overflow = policy;
+        SimpleAsync::CreatePool(pool, 1, options);
+
+        std::atomic<bool> started{ false };
+        std::atomic<bool> open{ false };
+        std::atomic<int> ran{ 0 };
+        std::atomic<int> inlineRuns{ 0 };
+        std::thread::id caller = std::this_thread::get_id();
+
+        std::vector<TaskHandle> handles;
+        handles.push_back(SimpleAsync::CreateTaskInPool(pool, [&](CancellationToken, Progress)
+            {
+                started = true;
+                while (!open)
+                    std::this_thread::yield();
+                return 0;
+            }, [&ran](int) { ran++; }, AsyncOptions{}));
+        while (!started)
+            std::this_thread::yield();
+
+        // Block waits for room, so the gate opens from another thread
+        std::thread opener;
+        if (policy == OverflowPolicy::Block)
+            opener = std::thread([&open]() { std::this_thread::sleep_for(std::chrono::milliseconds(50)); open = true; });
+
+        for (int i = 0; i < 5; i++)
+        {
+            handles.push_back(SimpleAsync::CreateTaskInPool(pool, [&, caller](CancellationToken, Progress)
+                {
+                    if (std::this_thread::get_id() == caller)
+                        inlineRuns++;
+                    return 1;
+                }, [&ran](int) { ran++; }, AsyncOptions{}));
+        }
+
+        open = true;
+        if (opener.joinable())
+            opener.join();
+        for (TaskHandle handle : handles)
+            SimpleAsync::ForceWait(handle);
+        DrainUpdates();
+
+        PoolMetrics metrics = SimpleAsync::GetPoolMetrics(pool);
+        std::string name = names[static_cast<int>(policy)];
+        switch (policy)
+        {
+        case OverflowPolicy::Block:
+            Check(ran == 6, name + ": every task ran, got " + std::to_string(ran.load()));
+            break;
+        case OverflowPolicy::Fail:
+            Check(ran == 3 && metrics.Rejected == 3, name + ": three refused, got " + std::to_string(metrics.Rejected));
+            break;
+        case OverflowPolicy::DropOldest:
+            Check(ran == 3 && metrics.Dropped == 3, name + ": three dropped, got " + std::to_string(metrics.Dropped));
+            break;
+        case OverflowPolicy::RunInline:
+            Check(ran == 6 && inlineRuns == 3, name + ": three ran on the caller, got " + std::to_string(inlineRuns.load()));
+            break;
+        }
+    }
+}
+
+// A batch wakes a parked worker per task, up to the pool size, and runs every task, in both scheduling modes
+static void TestEnqueueBatch()
+{
+    std::cout << "Batch submission" << std::endl;
+
+    for (SchedulingMode mode : { SchedulingMode::SharedQueue, SchedulingMode::WorkStealing })
+    {
+        std::string name = mode == SchedulingMode::SharedQueue ? "shared queue" : "work stealing";
+        ThreadPoolOptions options;
+        options.Mode = mode;
+        const int workers = 4;
+        ThreadPool pool(workers, "Batch", options);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        // Each task waits for all the others, which only works out if the batch woke every parked worker
+        std::atomic<int> arrived{ 0 };
+        std::atomic<int> together{ 0 };
+        std::vector<PoolTask> batch;
+        for (int i = 0; i < workers; i++)
+        {
+            batch.emplace_back([&arrived, &together]()
+                {
+                    arrived++;
+                    for (int wait = 0; wait < 2000 && arrived < workers; wait++)
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    if (arrived == workers)
+                        together++;
+                });
+        }
+        pool.EnqueueBatch(batch);
+        for (int i = 0; i < 3000 && arrived + together < 2 * workers; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        Check(together == workers, name + ": the batch woke a worker per task, " + std::to_string(together.load()) + " ran at once");
+
+        // Many more tasks than workers
+        std::atomic<int> ran{ 0 };
+        batch.clear();
+        for (int i = 0; i < 1000; i++)
+            batch.emplace_back([&ran]() { ran++; });
+        pool.EnqueueBatch(batch);
+        for (int i = 0; i < 3000 && ran < 1000; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        Check(ran == 1000, name + ": every task of the batch ran, got " + std::to_string(ran.load()));
+    }
+}
+
+// A batch overflowing a DropOldest pool stays within the capacity, and a work stealing pool drops from the
+// workers' deques too. Straight on ThreadPool, to reach EnqueueBatch and the deques directly
+static void TestOverflowOfBatchesAndDeques()
+{
+    std::cout << "Overflow of batches and deques" << std::endl;
+
+    struct Counters
+    {
+        std::atomic<bool> started{ false };
+        std::atomic<bool> open{ false };
+        std::atomic<int> dropped{ 0 };
+        std::atomic<int> ran{ 0 };
+        std::atomic<int> inlineRuns{ 0 };
+        std::atomic<int> queuedRan{ 0 };
+    };
+    TaskDropHandler countDrop{ [](void* context) { static_cast<Counters*>(context)->dropped++; }, nullptr };
+    auto waitFor = [](std::atomic<int>& value, int expected)
+    {
+        for (int i = 0; i < 1000 && value < expected; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return value.load();
+    };
+
+    {
+        Counters counters;
+        countDrop.Context = &counters;
+        ThreadPoolOptions options;
+        options.QueueCapacity = 4;
+        options.Overflow = OverflowPolicy::DropOldest;
+        ThreadPool pool(1, "BatchOverflow", options);
+
+        pool.Enqueue([&counters]()
+            {
+                counters.started = true;
+                while (!counters.open)
+                    std::this_thread::yield();
+            });
+        while (!counters.started)
+            std::this_thread::yield();
+        for (int i = 0; i < 4; i++)
+            pool.Enqueue([&counters]() { counters.queuedRan++; }, TaskPriority::Normal, countDrop);
+
+        // Each batch task that does not fit drops one queued task, the two left over run on this thread
+        std::thread::id caller = std::this_thread::get_id();
+        std::vector<PoolTask> batch;
+        for (int i = 0; i < 6; i++)
+        {
+            batch.emplace_back([&counters, caller]()
+                {
+                    if (std::this_thread::get_id() == caller)
+                        counters.inlineRuns++;
+                    counters.ran++;
+                });
+        }
+        pool.EnqueueBatch(batch);
+
+        PoolMetrics metrics = pool.GetMetrics();
+        Check(metrics.QueueDepth == 4, "the batch stayed within the capacity, got " + std::to_string(metrics.QueueDepth) + " queued");
+        Check(counters.dropped == 4 && metrics.Dropped == 4, "one queued task was dropped per batch task, got " + std::to_string(counters.dropped.load()));
+        Check(counters.inlineRuns == 2, "what did not fit ran on the caller, got " + std::to_string(counters.inlineRuns.load()));
+
+        counters.open = true;
+        Check(waitFor(counters.ran, 6) == 6 && counters.queuedRan == 0, "every batch task ran and no dropped one did");
+    }
+
+    {
+        Counters counters;
+        countDrop.Context = &counters;
+        ThreadPoolOptions options;
+        options.Mode = SchedulingMode::WorkStealing;
+        options.QueueCapacity = 2;
+        options.Overflow = OverflowPolicy::DropOldest;
+        ThreadPool pool(1, "DequeOverflow", options);
+
+        // Submitted from the worker, these fill its own deque
+        pool.Enqueue([&pool, &counters, countDrop]()
+            {
+                for (int i = 0; i < 2; i++)
+                    pool.Enqueue([&counters]() { counters.queuedRan++; }, TaskPriority::Normal, countDrop);
+                counters.started = true;
+                while (!counters.open)
+                    std::this_thread::yield();
+            });
+        while (!counters.started)
+            std::this_thread::yield();
+        for (int i = 0; i < 2; i++)
+            pool.Enqueue([&counters]() { counters.ran++; });
+
+        Check(counters.dropped == 2, "the oldest tasks were dropped from the worker's deque, got " + std::to_string(counters.dropped.load()));
+        counters.open = true;
+        Check(waitFor(counters.ran, 2) == 2 && counters.queuedRan == 0, "the new tasks ran in place of the dropped ones, got "
+            + std::to_string(counters.ran.load()));
+    }
+}
+
+// ForceWait on another thread while the main thread keeps calling Update()
+static void TestForceWaitFromAnotherThread()
+{
+    std::cout << "ForceWait from another thread" << std::endl;
+
+    const int count = 2000;
+    std::atomic<int> ran{ 0 };
+    std::atomic<bool> finished{ false };
+
+    std::thread producer([&]()
+        {
+            for (int i = 0; i < count; i++)
+            {
+                auto handle = SimpleAsync::CreateTask([](CancellationToken, Progress, int value)
+                    {
+                        std::this_thread::sleep_for(std::chrono::microseconds(50));
+                        return value;
+                    }, [&ran](int) { ran++; }, AsyncOptions{}, i);
+                SimpleAsync::ForceWait(handle);
+            }
+            finished = true;
+        });
+
+    while (!finished)
+        SimpleAsync::Update();
+    producer.join();
+    DrainUpdates();
+
+    Check(ran == count, "every callback ran exactly once, got " + std::to_string(ran.load()));
+}
+
+// The run a shared task follows is canceled, directly or by its timeout handler
+static void TestSharedLeaderCanceled()
+{
+    std::cout << "Shared task whose leader is canceled" << std::endl;
+
+    std::atomic<int> runs{ 0 };
+    auto slow = [&runs](CancellationToken token, Progress, int value)
+        {
+            runs++;
+            for (int i = 0; i < 100; i++)
+            {
+                if (token->Canceled)
+                    throw TaskCanceledError();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            return value;
+        };
+
+    {
+        std::atomic<int> sum{ 0 };
+        AsyncOptions inlineOpt{};
+        inlineOpt.Executor = CallbackExecutor::Inline;
+
+        auto leader = SimpleAsync::CreateSharedTask("canceled", slow, [&sum](int value) { sum += value; }, AsyncOptions{}, 1);
+        auto follower = SimpleAsync::CreateSharedTask("canceled", slow, [&sum](int value) { sum += value; }, AsyncOptions{}, 1);
+        auto inlineFollower = SimpleAsync::CreateSharedTask("canceled", slow, [&sum](int value) { sum += value; }, inlineOpt, 1);
+        while (runs == 0)
+            std::this_thread::yield();
+
+        SimpleAsync::Cancel(leader);
+        SimpleAsync::ForceWait(leader);
+        SimpleAsync::ForceWait(follower);
+        SimpleAsync::ForceWait(inlineFollower);
+        DrainUpdates();
+
+        Check(runs == 2, "canceled: one follower ran the task again, runs " + std::to_string(runs.load()));
+        Check(sum == 2, "canceled: both followers called back, got " + std::to_string(sum.load()));
+    }
+
+    {
+        runs = 0;
+        std::atomic<int> sum{ 0 };
+        AsyncOptions timeoutOpt{};
+        timeoutOpt.TimeoutMilliseconds = 20;
+        timeoutOpt.TimeoutCallback = [](TaskHandle handle) { SimpleAsync::Cancel(handle); };
+
+        auto leader = SimpleAsync::CreateSharedTask("timeout", slow, [&sum](int value) { sum += value; }, timeoutOpt, 1);
+        auto follower = SimpleAsync::CreateSharedTask("timeout", slow, [&sum](int value) { sum += value; }, AsyncOptions{}, 1);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (sum == 0 && std::chrono::steady_clock::now() < deadline)
+        {
+            SimpleAsync::Update();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        SimpleAsync::ForceWait(leader);
+        SimpleAsync::ForceWait(follower);
+        DrainUpdates();
+
+        Check(runs == 2 && sum == 1, "timed out: the follower got its own run, runs " + std::to_string(runs.load()) + ", got " + std::to_string(sum.load()));
+    }
+}
+
+// Finished shared results kept in the LRU cache: a hit completes without a run, the least recently used goes
+// first at capacity, and a key only hits for the result type it was cached with
+static void TestResultCache()
+{
+    std::cout << "Result cache" << std::endl;
+
+    std::atomic<int> runs{ 0 };
+    auto submit = [&runs](const std::string& key, int value)
+    {
+        int result = 0;
+        auto handle = SimpleAsync::CreateSharedTask(key, [&runs](CancellationToken, Progress, int input)
+            {
+                runs++;
+                return input * 10;
+            }, [&result](int output) { result = output; }, AsyncOptions{}, value);
+        SimpleAsync::ForceWait(handle);
+        DrainUpdates();
+        return result;
+    };
+
+    SimpleAsync::SetResultCacheCapacity(2);
+    Check(submit("a", 1) == 10 && runs == 1, "a miss ran the task");
+
+    uint64_t enqueued = SimpleAsync::GetPoolMetrics(DefaultPoolName).Enqueued;
+    Check(submit("a", 1) == 10 && runs == 1, "a hit got the cached result without running, runs " + std::to_string(runs.load()));
+    Check(SimpleAsync::GetPoolMetrics(DefaultPoolName).Enqueued == enqueued, "a hit did not go through the pool");
+
+    // "b" is the least recently used once "a" was hit again, "c" pushes it out
+    submit("b", 2);
+    submit("a", 1);
+    submit("c", 3);
+    runs = 0;
+    Check(submit("a", 1) == 10 && submit("c", 3) == 30 && runs == 0, "the recently used entries stayed cached, runs " + std::to_string(runs.load()));
+    Check(submit("b", 2) == 20 && runs == 1, "the least recently used entry was evicted at capacity");
+
+    runs = 0;
+    SimpleAsync::EvictCachedResult("b");
+    SimpleAsync::EvictCachedResult("missing");
+    Check(submit("b", 2) == 20 && runs == 1, "an evicted entry ran again");
+
+    // The same key with a string result misses the int entry, then replaces it
+    runs = 0;
+    std::string text;
+    auto typed = SimpleAsync::CreateSharedTask("b", [&runs](CancellationToken, Progress) { runs++; return std::string("twenty"); },
+        [&text](std::string value) { text = value; }, AsyncOptions{});
+    SimpleAsync::ForceWait(typed);
+    DrainUpdates();
+    Check(text == "twenty" && runs == 1, "a key cached with another result type missed");
+    Check(submit("b", 2) == 20 && runs == 2, "the other type's result replaced the entry, runs " + std::to_string(runs.load()));
+
+    SimpleAsync::SetResultCacheCapacity(0);
+    runs = 0;
+    Check(submit("b", 2) == 20 && runs == 1, "a cache of capacity 0 keeps nothing");
+}
+
+// Groups whose callback runs on a worker can be retired before CreateTasks returns
+static void TestGroupsWithWorkerCallbacks()
+{
+    std::cout << "Groups with worker callbacks" << std::endl;
+
+    for (CallbackExecutor executor : { CallbackExecutor::Inline, CallbackExecutor::Pool })
+    {
+        const int count = 500;
+        std::atomic<int> groups{ 0 };
+        std::atomic<int> items{ 0 };
+        AsyncOptions opt{};
+        opt.Executor = executor;
+
+        std::vector<TaskHandle> handles;
+        for (int i = 0; i < count; i++)
+        {
+            std::vector<int> values(i % 3, i);
+            handles.push_back(SimpleAsync::CreateTasks([](CancellationToken, Progress, int value) { return value; }, values,
+                [&groups, &items](std::vector<int> results) { groups++; items += static_cast<int>(results.size()); }, opt));
+        }
+
+        for (TaskHandle handle : handles)
+            SimpleAsync::ForceWait(handle);
+        DrainUpdates();
+
+        int expected = 0;
+        for (int i = 0; i < count; i++)
+            expected += i % 3;
+        Check(groups == count && items == expected, std::string(ExecutorName(executor)) + ": every group called back with its items, got "
+            + std::to_string(groups.load()) + " groups, " + std::to_string(items.load()) + " items");
+    }
+}
+
+// Parents and children in different shards and pools, retired by workers at the same time while some parents get canceled
+static void TestParentTokenTeardown()
+{
+    std::cout << "Parent token teardown" << std::endl;
+
+    SimpleAsync::CreatePool("TeardownParents", 4);
+    SimpleAsync::CreatePool("TeardownChildren", 4);
+
+    std::atomic<int> callbacks{ 0 };
+    AsyncOptions inlineOpt{};
+    inlineOpt.Executor = CallbackExecutor::Inline;
+
+    for (int round = 0; round < 100; round++)
+    {
+        // Held until every child is linked to its parent
+        std::atomic<bool> open{ false };
+        auto gated = [&open](CancellationToken, Progress, int value)
+            {
+                while (!open)
+                    std::this_thread::yield();
+                return value;
+            };
+
+        std::vector<TaskHandle> parents;
+        for (int i = 0; i < 4; i++)
+            parents.push_back(SimpleAsync::CreateTaskInPool("TeardownParents", gated, [&callbacks](int) { callbacks++; }, inlineOpt, i));
+
+        // Children register from another thread, so into another home shard
+        std::vector<TaskHandle> children;
+        std::thread producer([&]()
+            {
+                for (TaskHandle parent : parents)
+                {
+                    AsyncOptions childOpt = inlineOpt;
+                    childOpt.Parent = parent;
+                    children.push_back(SimpleAsync::CreateTaskInPool("TeardownChildren", gated, [&callbacks](int) { callbacks++; }, childOpt, 0));
+                }
+            });
+        producer.join();
+
+        open = true;
+        if (round % 2)
+            SimpleAsync::Cancel(parents[round % 4]);
+
+        for (TaskHandle handle : parents)
+            SimpleAsync::ForceWait(handle);
+        for (TaskHandle handle : children)
+            SimpleAsync::ForceWait(handle);
+    }
+    Check(callbacks <= 800, "no callback ran twice, got " + std::to_string(callbacks.load()));
+
+    // Destroying a callback that another thread is running waits for it
+    auto* token = new CancellationState();
+    std::atomic<bool> running{ false };
+    std::atomic<bool> finished{ false };
+    auto* callback = new CancellationCallback(token, [&]()
+        {
+            running = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            finished = true;
+        });
+    std::thread canceler([token]() { token->Cancel(); });
+    while (!running)
+        std::this_thread::yield();
+    delete callback;
+    Check(finished, "the callback's destructor waited for it to finish");
+    canceler.join();
+    delete token;
+}
+
+// Cancellation callbacks run by Cancel() use the API on tasks of the same shard, all created from this thread
+static void TestCancelCallbacksReenter()
+{
+    std::cout << "Cancellation callbacks re-entering the API" << std::endl;
+
+    auto untilCanceled = [](CancellationToken token, Progress)
+        {
+            while (!token->Canceled)
+                std::this_thread::yield();
+            return 0;
+        };
+
+    TaskHandle sibling = SimpleAsync::CreateTask(untilCanceled, [](int) {}, AsyncOptions{});
+    TaskHandle created;
+    std::atomic<bool> registered{ false };
+    std::atomic<bool> callbackRan{ false };
+
+    TaskHandle task = SimpleAsync::CreateTask([&](CancellationToken token, Progress)
+        {
+            CancellationCallback onCancel(token, [&]()
+                {
+                    SimpleAsync::Cancel(sibling);
+                    created = SimpleAsync::CreateTask([](CancellationToken, Progress) { return 1; }, [](int) {}, AsyncOptions{});
+                    SimpleAsync::ForceWait(created);
+                    callbackRan = true;
+                });
+            registered = true;
+            while (!token->Canceled)
+                std::this_thread::yield();
+            return 0;
+        }, [](int) {}, AsyncOptions{});
+    while (!registered)
+        std::this_thread::yield();
+
+    SimpleAsync::Cancel(task);
+    SimpleAsync::ForceWait(task);
+    SimpleAsync::ForceWait(sibling);
+    DrainUpdates();
+
+    Check(callbackRan && created.IsValid(), "the callback canceled, created and waited on tasks of its own shard");
+}
+
+// Once the slab has blocks, submitting tasks with the common result types allocates nothing on the caller's thread
+static void TestSlabCoversCommonResults()
+{
+    std::cout << "Slab covers the common results" << std::endl;
+
+    auto countSubmissions = [](const char* what, auto&& submit)
+    {
+        const int count = 256;
+        int allocations = 0;
+        for (int round = 0; round < 2; round++)
+        {
+            std::vector<TaskHandle> handles;
+            handles.reserve(count * 2 + 4);
+
+            // The warm-up round queues everything behind the default pool's four blocked workers, so the queue reaches its full depth once
+            std::atomic<bool> release = round > 0;
+            if (round == 0)
+                for (int i = 0; i < 4; i++)
+                    handles.push_back(SimpleAsync::CreateTask([&release](CancellationToken, Progress)
+                        {
+                            while (!release)
+                                std::this_thread::yield();
+                            return 0;
+                        }, [](int) {}, AsyncOptions{}));
+
+            t_allocations = 0;
+            for (int i = 0; i < count; i++)
+            {
+                t_countAllocations = true;
+                submit(handles);
+                t_countAllocations = false;
+            }
+            allocations = t_allocations;
+            release = true;
+
+            for (TaskHandle handle : handles)
+                SimpleAsync::ForceWait(handle);
+            DrainUpdates();
+        }
+        // The first round warmed the slab up, the second one reuses its blocks
+        Check(allocations == 0, std::string(what) + ": no heap allocation per task, got " + std::to_string(allocations));
+    };
+
+    countSubmissions("int", [](std::vector<TaskHandle>& handles)
+        {
+            handles.push_back(SimpleAsync::CreateTask([](CancellationToken, Progress) { return 1; }, [](int) {}, AsyncOptions{}));
+        });
+    countSubmissions("double", [](std::vector<TaskHandle>& handles)
+        {
+            handles.push_back(SimpleAsync::CreateTask([](CancellationToken, Progress) { return 1.0; }, [](double) {}, AsyncOptions{}));
+        });
+    countSubmissions("string", [](std::vector<TaskHandle>& handles)
+        {
+            handles.push_back(SimpleAsync::CreateTask([](CancellationToken, Progress) { return std::string("short"); }, [](std::string) {}, AsyncOptions{}));
+        });
+    countSubmissions("vector", [](std::vector<TaskHandle>& handles)
+        {
+            handles.push_back(SimpleAsync::CreateTask([](CancellationToken, Progress) { return std::vector<int>(); }, [](std::vector<int>) {}, AsyncOptions{}));
+        });
+    countSubmissions("then", [](std::vector<TaskHandle>& handles)
+        {
+            auto parent = SimpleAsync::CreateTask([](CancellationToken, Progress) { return 1; }, [](int) {}, AsyncOptions{});
+            handles.push_back(parent);
+            handles.push_back(parent.Then([](CancellationToken, Progress, int value) { return value + 1; }, [](int) {}, AsyncOptions{}));
+        });
+}
+
+// Pools created while other threads look pools up to submit and read metrics, the map rehashes meanwhile
+static void TestCreatePoolWhileSubmitting()
+{
+    std::cout << "Create pools while submitting" << std::endl;
+
+    const int poolCount = 32;
+    std::atomic<bool> done{ false };
+    std::atomic<int> results{ 0 };
+    std::atomic<int> submitted{ 0 };
+    AsyncOptions opt{};
+    opt.Executor = CallbackExecutor::Inline;
+
+    std::vector<std::thread> submitters;
+    for (int t = 0; t < 3; t++)
+    {
+        submitters.emplace_back([&]()
+            {
+                std::vector<TaskHandle> handles;
+                while (!done)
+                {
+                    handles.push_back(SimpleAsync::CreateTask([](CancellationToken, Progress) { return 1; }, [&results](int) { results++; }, opt));
+                    submitted++;
+                    SimpleAsync::GetPoolMetrics(DefaultPoolName);
+                    SimpleAsync::GetAvailableThreadsCount(DefaultPoolName);
+                }
+                for (TaskHandle handle : handles)
+                    SimpleAsync::ForceWait(handle);
+            });
+    }
+
+    for (int i = 0; i < poolCount; i++)
+        SimpleAsync::CreatePool("Growing" + std::to_string(i), 1);
+    done = true;
+    for (std::thread& submitter : submitters)
+        submitter.join();
+    DrainUpdates();
+
+    Check(results == submitted, "every task submitted meanwhile called back, got " + std::to_string(results.load()) + " of "
+        + std::to_string(submitted.load()));
+    Check(SimpleAsync::GetPoolMetrics("Growing" + std::to_string(poolCount - 1)).QueueDepth == 0, "the last pool created can be looked up");
+}
+
+// A worker of a work stealing pool submits children to its own deque and then blocks, only steals can run them
+static void TestWorkStealing()
+{
+    std::cout << "Work stealing" << std::endl;
+
+    ThreadPoolOptions options;
+    options.Mode = SchedulingMode::WorkStealing;
+    SimpleAsync::CreatePool("Stealing", 4, options);
+
+    const int count = 64;
+    std::atomic<int> done{ 0 };
+    std::atomic<int> ranOnOwner{ 0 };
+    AsyncOptions opt{};
+    opt.Executor = CallbackExecutor::Inline;
+
+    TaskHandle outer = SimpleAsync::CreateTaskInPool("Stealing", [&](CancellationToken, Progress)
+        {
+            std::thread::id owner = std::this_thread::get_id();
+            for (int i = 0; i < count; i++)
+            {
+                SimpleAsync::CreateTaskInPool("Stealing", [&, owner](CancellationToken, Progress)
+                    {
+                        if (std::this_thread::get_id() == owner)
+                            ranOnOwner++;
+                        return 0;
+                    }, [&done](int) { done++; }, opt);
+            }
+
+            while (done < count)
+                std::this_thread::yield();
+            return 0;
+        }, [](int) {}, opt);
+
+    SimpleAsync::ForceWait(outer);
+    DrainUpdates();
+
+    PoolMetrics metrics = SimpleAsync::GetPoolMetrics("Stealing");
+    Check(done == count, "every child ran while its owner was blocked, got " + std::to_string(done.load()));
+    Check(ranOnOwner == 0, "no child ran on the blocked owner");
+    Check(metrics.Steals >= static_cast<uint64_t>(count), "the children were stolen, got " + std::to_string(metrics.Steals) + " steals");
+}
+
+// Timeouts fire once for tasks still running and never for finished ones, from Update() or the timer thread
+static void TestTimeouts()
+{
+    std::cout << "Timeouts" << std::endl;
+
+    SimpleAsync::CreatePool("Timeouts", 3);
+    std::atomic<bool> release{ false };
+    auto gated = [&release](CancellationToken, Progress)
+        {
+            while (!release)
+                std::this_thread::yield();
+            return 0;
+        };
+    auto quick = [](CancellationToken, Progress) { return 0; };
+
+    std::atomic<int> fired{ 0 };
+    std::atomic<int> lateFired{ 0 };
+    AsyncOptions opt{};
+    opt.TimeoutMilliseconds = 20;
+    opt.TimeoutCallback = [&fired](TaskHandle) { fired++; };
+    AsyncOptions finishedOpt = opt;
+    finishedOpt.TimeoutCallback = [&lateFired](TaskHandle) { lateFired++; };
+
+    TaskHandle slow = SimpleAsync::CreateTaskInPool("Timeouts", gated, [](int) {}, opt);
+    TaskHandle finished = SimpleAsync::CreateTaskInPool("Timeouts", quick, [](int) {}, finishedOpt);
+    SimpleAsync::ForceWait(finished);
+    DrainUpdates();
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    Check(fired == 0, "nothing fired before Update()");
+
+    for (int i = 0; i < 5; i++)
+    {
+        SimpleAsync::Update();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    Check(fired == 1, "Update() fired the running task's timeout once, got " + std::to_string(fired.load()));
+    Check(SimpleAsync::GetPoolMetrics("Timeouts").TimedOut == 1, "the pool counted the timeout");
+
+    // Nobody calls Update() meanwhile
+    std::atomic<int> timerFired{ 0 };
+    std::thread::id timerThread;
+    AsyncOptions timerOpt = opt;
+    timerOpt.TimeoutMode = TimeoutDispatch::TimerThread;
+    timerOpt.TimeoutCallback = [&](TaskHandle)
+        {
+            timerThread = std::this_thread::get_id();
+            timerFired++;
+        };
+    AsyncOptions finishedTimerOpt = finishedOpt;
+    finishedTimerOpt.TimeoutMode = TimeoutDispatch::TimerThread;
+
+    TaskHandle timed = SimpleAsync::CreateTaskInPool("Timeouts", gated, [](int) {}, timerOpt);
+    finished = SimpleAsync::CreateTaskInPool("Timeouts", quick, [](int) {}, finishedTimerOpt);
+    SimpleAsync::ForceWait(finished);
+    DrainUpdates();
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (timerFired == 0 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    Check(timerFired == 1 && timerThread != std::this_thread::get_id(), "the timer thread fired the running task's timeout once, got "
+        + std::to_string(timerFired.load()));
+    Check(lateFired == 0, "no timeout fired for a task that finished first");
+
+    release = true;
+    SimpleAsync::ForceWait(slow);
+    SimpleAsync::ForceWait(timed);
+    DrainUpdates();
+
+    // Long timeouts on short tasks, their entries go once the tasks retire instead of waiting out the deadline
+    const int count = 1000;
+    size_t before = SimpleAsync::GetPendingTimeoutsCount();
+    for (TimeoutDispatch mode : { TimeoutDispatch::Update, TimeoutDispatch::TimerThread })
+    {
+        AsyncOptions longOpt{};
+        longOpt.TimeoutMilliseconds = 60000;
+        longOpt.TimeoutMode = mode;
+        longOpt.TimeoutCallback = [&lateFired](TaskHandle) { lateFired++; };
+
+        std::vector<TaskHandle> handles;
+        for (int i = 0; i < count; i++)
+            handles.push_back(SimpleAsync::CreateTaskInPool("Timeouts", quick, [](int) {}, longOpt));
+        for (TaskHandle handle : handles)
+            SimpleAsync::ForceWait(handle);
+        DrainUpdates();
+    }
+    size_t after = SimpleAsync::GetPendingTimeoutsCount();
+    Check(after <= before, "the entries of retired tasks were dropped, " + std::to_string(after) + " left of " + std::to_string(count * 2));
+}
+
+// Counters of a single worker pool held by a gate, its busy time against idle time, and the hook Update() feeds
+static void TestPoolMetrics()
+{
+    std::cout << "Pool metrics" << std::endl;
+
+    SimpleAsync::CreatePool("Metrics", 1);
+
+    // The worker counts a task once it returned, after the task's inline callback let ForceWait() go
+    auto completed = [](uint64_t count)
+    {
+        PoolMetrics metrics = SimpleAsync::GetPoolMetrics("Metrics");
+        for (int i = 0; i < 1000 && metrics.Completed < count; i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            metrics = SimpleAsync::GetPoolMetrics("Metrics");
+        }
+        return metrics;
+    };
+
+    std::atomic<bool> started{ false };
+    std::atomic<bool> release{ false };
+    AsyncOptions opt{};
+    opt.Executor = CallbackExecutor::Inline;
+
+    std::vector<TaskHandle> handles;
+    handles.push_back(SimpleAsync::CreateTaskInPool("Metrics", [&](CancellationToken, Progress)
+        {
+            started = true;
+            while (!release)
+                std::this_thread::yield();
+            return 0;
+        }, [](int) {}, opt));
+    while (!started)
+        std::this_thread::yield();
+    for (int i = 0; i < 5; i++)
+        handles.push_back(SimpleAsync::CreateTaskInPool("Metrics", [](CancellationToken, Progress) { return 0; }, [](int) {}, opt));
+
+    PoolMetrics held = SimpleAsync::GetPoolMetrics("Metrics");
+    Check(held.QueueDepth == 5 && held.ActiveThreads == 1 && held.Threads == 1 && held.Enqueued == 6,
+        "five queued behind one busy worker, got depth " + std::to_string(held.QueueDepth) + ", active " + std::to_string(held.ActiveThreads));
+
+    release = true;
+    for (TaskHandle handle : handles)
+        SimpleAsync::ForceWait(handle);
+
+    PoolMetrics done = completed(6);
+    Check(done.QueueDepth == 0 && done.ActiveThreads == 0 && done.Completed == 6, "every task completed, got " + std::to_string(done.Completed));
+    Check(done.QueueWait.Count() == 6 && done.RunTime.Count() == 6, "each task has a queue wait and a run time");
+    Check(done.Steals == 0, "a shared queue pool never steals");
+
+    // 50ms of work, then 50ms of nothing
+    SimpleAsync::ForceWait(SimpleAsync::CreateTaskInPool("Metrics", [](CancellationToken, Progress)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            return 0;
+        }, [](int) {}, opt));
+    PoolMetrics worked = completed(7);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    PoolMetrics idled = SimpleAsync::GetPoolMetrics("Metrics");
+
+    uint64_t busy = worked.WorkerBusyNanoseconds[0] - done.WorkerBusyNanoseconds[0];
+    Check(busy >= 50000000 && busy < 1000000000, "the worker was busy for the 50ms task, got " + std::to_string(busy) + "ns");
+    Check(worked.BusyRatio(done) > 0.5f, "the pool was mostly busy while working, got " + std::to_string(worked.BusyRatio(done)));
+    Check(idled.BusyRatio(worked) < 0.1f, "and idle afterwards, got " + std::to_string(idled.BusyRatio(worked)));
+
+    // Called from Update() only, once per interval with every pool
+    std::atomic<int> calls{ 0 };
+    std::atomic<int> otherThread{ 0 };
+    std::atomic<int> fresh{ 0 };
+    std::thread::id main = std::this_thread::get_id();
+    SimpleAsync::SetMetricsHook([&](const std::string& poolName, const PoolMetrics& metrics)
+        {
+            if (std::this_thread::get_id() != main)
+                otherThread++;
+            if (poolName == "Metrics")
+            {
+                calls++;
+                if (metrics.Completed == 7)
+                    fresh++;
+            }
+        }, 50.0f);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    Check(calls == 0, "the hook waits for Update()");
+
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(220))
+    {
+        SimpleAsync::Update();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    int called = calls;
+    SimpleAsync::SetMetricsHook(nullptr);
+    SimpleAsync::Update();
+
+    Check(called >= 3 && called <= 5, "the hook ran once per 50ms over 220ms, got " + std::to_string(called));
+    Check(fresh == called && otherThread == 0, "on the Update() thread with a fresh snapshot");
+    Check(calls == called, "a cleared hook is not called anymore");
+}
+
+// Workers that parked wake up for new work, and spinning or yielding ones pick it up before parking
+static void TestIdlePolicies()
+{
+    std::cout << "Idle policies" << std::endl;
+
+    AsyncOptions opt{};
+    opt.Executor = CallbackExecutor::Inline;
+    auto runTasks = [&opt](const std::string& pool, int count)
+    {
+        std::atomic<int> ran{ 0 };
+        for (int i = 0; i < count; i++)
+        {
+            // Give the worker time to go idle before the next task shows up
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            SimpleAsync::ForceWait(SimpleAsync::CreateTaskInPool(pool, [&ran](CancellationToken, Progress) { return ++ran; }, [](int) {}, opt));
+        }
+        return ran.load();
+    };
+
+    // No spinning or yielding, idle workers go straight to sleep
+    SimpleAsync::CreatePool("Parking", 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    IdleStats parked = SimpleAsync::GetIdleStats("Parking");
+    Check(parked.Parks >= 2 && parked.Wakeups == 0, "both idle workers parked, got " + std::to_string(parked.Parks) + " parks");
+
+    Check(runTasks("Parking", 20) == 20, "parked workers woke up for every task");
+    IdleStats woken = SimpleAsync::GetIdleStats("Parking");
+    Check(woken.Wakeups >= 1 && woken.Parks > parked.Parks, "submissions woke parked workers, got " + std::to_string(woken.Wakeups) + " wakeups");
+    Check(woken.SpinHits == 0 && woken.YieldHits == 0, "nothing was found spinning or yielding without an idle policy");
+
+    // Spins long enough to still be spinning when the next task comes
+    ThreadPoolOptions spinning;
+    spinning.Idle.SpinIterations = 1000000;
+    SimpleAsync::CreatePool("Spinning", 1, spinning);
+    Check(runTasks("Spinning", 20) == 20, "a spinning worker ran every task");
+    IdleStats spun = SimpleAsync::GetIdleStats("Spinning");
+    Check(spun.SpinHits >= 1 && spun.YieldHits == 0, "the worker found work while spinning, got " + std::to_string(spun.SpinHits) + " hits");
+
+    ThreadPoolOptions yielding;
+    yielding.Idle.YieldIterations = 100000;
+    SimpleAsync::CreatePool("Yielding", 1, yielding);
+    Check(runTasks("Yielding", 20) == 20, "a yielding worker ran every task");
+    IdleStats yielded = SimpleAsync::GetIdleStats("Yielding");
+    Check(yielded.YieldHits >= 1 && yielded.SpinHits == 0, "the worker found work while yielding, got " + std::to_string(yielded.YieldHits) + " hits");
+}
+
+// A retired task's slot goes to the next task of the shard, the old handle must not reach the new task
+static void TestStaleHandles()
+{
+    std::cout << "Stale handles" << std::endl;
+
+    TaskHandle first = SimpleAsync::CreateTask([](CancellationToken, Progress) { return 1; }, [](int) {}, AsyncOptions{});
+    SimpleAsync::ForceWait(first);
+    DrainUpdates();
+
+    std::atomic<bool> release{ false };
+    std::atomic<bool> canceled{ false };
+    int result = 0;
+    TaskHandle second = SimpleAsync::CreateTask([&](CancellationToken token, Progress)
+        {
+            while (!release)
+                std::this_thread::yield();
+            canceled = token->Canceled.load();
+            return 2;
+        }, [&result](int value) { result = value; }, AsyncOptions{});
+
+    Check(second.Index == first.Index && second.Generation != first.Generation, "the new task reused the slot with a new generation");
+
+    // Neither may wait for, cancel or call back the new task
+    SimpleAsync::ForceWait(first);
+    SimpleAsync::Cancel(first);
+    Check(result == 0, "waiting on the stale handle did not run the new task's callback");
+
+    release = true;
+    SimpleAsync::ForceWait(second);
+    DrainUpdates();
+    Check(result == 2 && !canceled, "the new task ran uncanceled and called back, got " + std::to_string(result));
+}
+
+// Update() with a budget runs part of the finished callbacks and carries the rest over, in completion order
+static void TestBudgetedUpdate()
+{
+    std::cout << "Budgeted Update" << std::endl;
+
+    const uint32_t count = 10;
+    std::vector<int> order;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        SimpleAsync::CreateTask([i](CancellationToken, Progress) { return static_cast<int>(i); }, [&order](int value) { order.push_back(value); }, AsyncOptions{});
+        // One at a time so the completion order is known
+        while (SimpleAsync::GetPendingCallbacksCount() <= i)
+            std::this_thread::yield();
+    }
+
+    UpdateBudget fewCallbacks;
+    fewCallbacks.MaxCallbacks = 3;
+    uint32_t pending = SimpleAsync::Update(fewCallbacks);
+    Check(order.size() == 3 && pending == count - 3, "a 3 callback budget ran 3, got " + std::to_string(order.size()) + " with "
+        + std::to_string(pending) + " pending");
+
+    pending = SimpleAsync::Update(fewCallbacks);
+    Check(order.size() == 6 && pending == count - 6, "the next Update() picked up where the last one stopped");
+
+    SimpleAsync::Update();
+    bool inOrder = order.size() == count;
+    for (size_t i = 0; inOrder && i < order.size(); i++)
+        inOrder = order[i] == static_cast<int>(i);
+    Check(inOrder, "an unlimited Update() ran the rest, every callback once in completion order");
+
+    // Slow callbacks against a time budget, the first one always runs
+    const uint32_t slowCount = 4;
+    std::atomic<uint32_t> slowRan{ 0 };
+    for (uint32_t i = 0; i < slowCount; i++)
+    {
+        SimpleAsync::CreateTask([](CancellationToken, Progress) { return 0; }, [&slowRan](int)
+            {
+                slowRan++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }, AsyncOptions{});
+    }
+    while (SimpleAsync::GetPendingCallbacksCount() < slowCount)
+        std::this_thread::yield();
+
+    UpdateBudget shortTime;
+    shortTime.MaxMilliseconds = 1.0f;
+    pending = SimpleAsync::Update(shortTime);
+    Check(slowRan == 1 && pending == slowCount - 1, "a 1ms budget stopped after the first 5ms callback, ran " + std::to_string(slowRan.load()));
+    DrainUpdates();
+    Check(slowRan == slowCount, "the slow callbacks all ran eventually");
+}
+
+// A task that finished before Update() still gets its last progress, ahead of its result
+static void TestProgressOfFinishedTasks()
+{
+    std::cout << "Progress of finished tasks" << std::endl;
+
+    std::vector<float> progress;
+    size_t progressBeforeResult = 0;
+    bool resultRan = false;
+    AsyncOptions opt{};
+    opt.ProgressCallback = [&progress](float value) { progress.push_back(value); };
+
+    SimpleAsync::CreateTask([](CancellationToken, Progress prog)
+        {
+            prog->Report(0.5f);
+            prog->Report(1.0f);
+            return 0;
+        }, [&](int)
+        {
+            resultRan = true;
+            progressBeforeResult = progress.size();
+        }, opt);
+    while (SimpleAsync::GetPendingCallbacksCount() == 0)
+        std::this_thread::yield();
+
+    SimpleAsync::Update();
+    SimpleAsync::Update();
+
+    Check(resultRan, "the result callback ran");
+    Check(progress.size() == 1 && progress[0] == 1.0f, "only the latest value was delivered, got " + std::to_string(progress.size()) + " calls");
+    Check(progressBeforeResult == 1, "the last progress arrived before the result");
+}
+
+// A single worker held by a gate, then released onto tasks of mixed priorities
+static void TestPrioritiesAndAging()
+{
+    std::cout << "Priorities and aging" << std::endl;
+
+    auto runQueued = [](const std::string& poolName, float agingMilliseconds, std::chrono::milliseconds lowWaits)
+    {
+        ThreadPoolOptions options;
+        options.AgingMilliseconds = agingMilliseconds;
+        SimpleAsync::CreatePool(poolName, 1, options);
+
+        std::atomic<bool> release{ false };
+        std::mutex orderMutex;
+        std::string order;
+        AsyncOptions opt{};
+        opt.Executor = CallbackExecutor::Inline;
+
+        std::vector<TaskHandle> handles;
+        handles.push_back(SimpleAsync::CreateTaskInPool(poolName, [&release](CancellationToken, Progress)
+            {
+                while (!release)
+                    std::this_thread::yield();
+                return 0;
+            }, [](int) {}, opt));
+
+        auto submit = [&](TaskPriority priority, char name)
+        {
+            AsyncOptions prioritized = opt;
+            prioritized.Priority = priority;
+            handles.push_back(SimpleAsync::CreateTaskInPool(poolName, [&, name](CancellationToken, Progress)
+                {
+                    std::lock_guard<std::mutex> lock(orderMutex);
+                    order += name;
+                    return 0;
+                }, [](int) {}, prioritized));
+        };
+
+        submit(TaskPriority::Low, 'L');
+        std::this_thread::sleep_for(lowWaits);
+        submit(TaskPriority::Normal, 'N');
+        submit(TaskPriority::High, 'H');
+
+        release = true;
+        for (TaskHandle handle : handles)
+            SimpleAsync::ForceWait(handle);
+        DrainUpdates();
+
+        std::lock_guard<std::mutex> lock(orderMutex);
+        return order;
+    };
+
+    std::string order = runQueued("Priorities", 0.0f, std::chrono::milliseconds(0));
+    Check(order == "HNL", "without aging the highest priority runs first, got " + order);
+
+    order = runQueued("Aging", 20.0f, std::chrono::milliseconds(40));
+    Check(order == "LHN", "a low priority task that waited past the aging delay runs first, got " + order);
+}
+
+// Every index once, nested loops from workers, ordered non-commutative folds and exceptions reaching the caller
+static void TestParallelAlgorithms()
+{
+    std::cout << "ParallelFor and Reduce" << std::endl;
+
+    const size_t count = 10000;
+    for (size_t grain : { size_t(0), size_t(1), size_t(7), count * 2 })
+    {
+        std::vector<std::atomic<int>> visits(count);
+        SimpleAsync::ParallelFor(0, count, grain, [&visits](size_t i) { visits[i]++; });
+
+        bool once = true;
+        for (auto& v : visits)
+            once = once && v == 1;
+        Check(once, "grain " + std::to_string(grain) + ": every index visited once");
+    }
+
+    // Outer iterations run on workers and start their own loops, which must not wait on each other
+    std::atomic<int> inner{ 0 };
+    SimpleAsync::ParallelFor(0, 16, 1, [&inner](size_t) { SimpleAsync::ParallelFor(0, 100, 10, [&inner](size_t) { inner++; }); });
+    Check(inner == 1600, "nested loops ran every inner index, got " + std::to_string(inner.load()));
+
+    std::vector<int> values(count);
+    for (size_t i = 0; i < count; i++)
+        values[i] = static_cast<int>(i);
+    std::vector<long long> squares(count);
+    SimpleAsync::Transform(values.begin(), values.end(), squares.begin(), [](int v) { return static_cast<long long>(v) * v; }, 64);
+    Check(squares[0] == 0 && squares[count - 1] == static_cast<long long>(count - 1) * (count - 1), "Transform wrote every element");
+
+    long long sum = SimpleAsync::Reduce(values.begin(), values.end(), 0LL, [](long long a, long long b) { return a + b; });
+    Check(sum == static_cast<long long>(count) * (count - 1) / 2, "Reduce summed the range, got " + std::to_string(sum));
+
+    // Concatenation is associative but not commutative, partials have to be combined in order
+    std::vector<std::string> digits;
+    std::string expected;
+    for (int i = 0; i < 500; i++)
+    {
+        digits.push_back(std::to_string(i % 10));
+        expected += digits.back();
+    }
+    std::string joined = SimpleAsync::Reduce(digits.begin(), digits.end(), std::string(), [](std::string a, const std::string& b) { return a + b; }, 13);
+    Check(joined == expected, "Reduce kept the order of a non-commutative op");
+
+    bool thrown = false;
+    try
+    {
+        SimpleAsync::ParallelFor(0, count, 16, [](size_t i)
+            {
+                if (i == 4321)
+                    throw std::runtime_error("failed index");
+            });
+    }
+    catch (const std::runtime_error& e)
+    {
+        thrown = std::string(e.what()) == "failed index";
+    }
+    Check(thrown, "the exception of a chunk was rethrown on the caller");
+}
+
+static CoTask<int> NestedCoroutine(int value)
+{
+    if (value < 0)
+        throw std::runtime_error("negative");
+    co_return value * 2;
+}
+
+// Moves to the target pool, awaits a task and nested coroutines, and reports which thread each step resumed on
+static CoTask<int> SwitchingCoroutine(std::thread::id target, std::atomic<int>* wrongThread)
+{
+    co_await SimpleAsync::SwitchTo("CoTarget");
+    if (std::this_thread::get_id() != target)
+        (*wrongThread)++;
+
+    int fromTask = co_await SimpleAsync::Async([](CancellationToken, Progress, int value) { return value + 1; }, 20);
+    if (std::this_thread::get_id() != target)
+        (*wrongThread)++;
+
+    int fromNested = co_await NestedCoroutine(fromTask);
+    try
+    {
+        co_await NestedCoroutine(-1);
+        (*wrongThread) += 100;
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+    co_return fromNested;
+}
+
+// Coroutines switched to another pool keep resuming there, and their result reaches the callback
+static void TestCoroutines()
+{
+    std::cout << "Coroutines and SwitchTo" << std::endl;
+
+    SimpleAsync::CreatePool("CoTarget", 1);
+    std::thread::id target;
+    SimpleAsync::ForceWait(SimpleAsync::CreateTaskInPool("CoTarget", [&target](CancellationToken, Progress)
+        {
+            target = std::this_thread::get_id();
+            return 0;
+        }, [](int) {}, AsyncOptions{}));
+    DrainUpdates();
+
+    const int count = 50;
+    std::atomic<int> wrongThread{ 0 };
+    std::vector<int> results;
+    std::vector<TaskHandle> handles;
+    for (int i = 0; i < count; i++)
+        handles.push_back(SimpleAsync::CreateCoroutine(SwitchingCoroutine(target, &wrongThread), [&results](int value) { results.push_back(value); }));
+
+    for (TaskHandle handle : handles)
+        SimpleAsync::ForceWait(handle);
+    DrainUpdates();
+
+    bool allRight = results.size() == count;
+    for (int value : results)
+        allRight = allRight && value == 42;
+    Check(allRight, "every coroutine called back with its result, got " + std::to_string(results.size()) + " callbacks");
+    Check(wrongThread == 0, "every step resumed on the pool switched to and nested errors were caught, got "
+        + std::to_string(wrongThread.load()));
+}
+
+// Workers pinned with Cores run on their core, a NumaAware submission goes to the queue of the submitting thread's node,
+// and placement the OS refuses is ignored. Checked on Linux, where the placement of a thread can be read back
+static void TestPlacement()
+{
+    std::cout << "Placement" << std::endl;
+
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    std::vector<uint32_t> cpus;
+    for (uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed))
+            cpus.push_back(cpu);
+    }
+
+    auto waitFor = [](std::atomic<int>& value, int expected)
+    {
+        for (int i = 0; i < 1000 && value < expected; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return value.load();
+    };
+
+    {
+        ThreadPoolOptions options;
+        options.Cores = { cpus.back() };
+        options.QoS = ThreadQoS::Background;
+        ThreadPool pool(2, "Pinned", options);
+
+        std::atomic<int> ran{ 0 };
+        std::atomic<int> elsewhere{ 0 };
+        std::atomic<int> niceValue{ 0 };
+        int target = static_cast<int>(cpus.back());
+        for (int i = 0; i < 20; i++)
+        {
+            pool.Enqueue([&, target]()
+                {
+                    if (sched_getcpu() != target)
+                        elsewhere++;
+                    niceValue = getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)));
+                    ran++;
+                });
+        }
+        Check(waitFor(ran, 20) == 20 && elsewhere == 0, "pinned workers ran on their core, " + std::to_string(elsewhere.load()) + " ran elsewhere");
+        Check(niceValue == 19, "background workers run at the lowest priority, got nice " + std::to_string(niceValue.load()));
+    }
+
+    {
+        // Past CPU_SETSIZE, and a CPU this machine most likely doesn't have
+        ThreadPoolOptions options;
+        options.Cores = { 5000000, CPU_SETSIZE - 1 };
+        options.NumaAware = true;
+        ThreadPool pool(2, "BadCores", options);
+
+        std::atomic<int> ran{ 0 };
+        for (int i = 0; i < 20; i++)
+            pool.Enqueue([&ran]() { ran++; });
+        Check(waitFor(ran, 20) == 20 && pool.GetThreadsCount() == 2, "workers with cores the OS refused still ran every task");
+    }
+
+    {
+        const CpuTopology& topology = CpuTopology::Get();
+        ThreadPoolOptions options;
+        options.NumaAware = true;
+        ThreadPool pool(topology.NodeCount(), "NumaQueues", options);
+
+        // Every worker held, so submissions stay in the queues
+        std::atomic<int> started{ 0 };
+        std::atomic<bool> open{ false };
+        int workers = static_cast<int>(topology.NodeCount());
+        for (int i = 0; i < workers; i++)
+        {
+            pool.Enqueue([&started, &open]()
+                {
+                    started++;
+                    while (!open)
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                });
+        }
+        waitFor(started, workers);
+
+        bool landed = true;
+        size_t nodesTried = 0;
+        for (size_t node = 0; node < topology.NodeCount(); node++)
+        {
+            auto cpu = std::find_if(cpus.begin(), cpus.end(), [&](uint32_t c) { return topology.NodeOfCpu(c) == node; });
+            if (cpu == cpus.end())
+                continue;
+
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(*cpu, &one);
+            pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+            size_t before = pool.GetNodeQueueDepth(node);
+            pool.Enqueue([]() {});
+            landed = landed && pool.GetNodeQueueDepth(node) == before + 1;
+            nodesTried++;
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(allowed), &allowed);
+        open = true;
+
+        Check(nodesTried > 0 && landed, "a submission went to the queue of its thread's node, tried " + std::to_string(nodesTried) + " nodes");
+    }
+#endif
+}
+
+// An elastic pool grows while its queue lags, up to MaxThreads, and shrinks back to the minimum once idle
+static void TestElasticSizing()
+{
+    std::cout << "Elastic sizing" << std::endl;
+
+    ThreadPoolOptions options;
+    options.MaxThreads = 4;
+    options.GrowLatencyMilliseconds = 5.0f;
+    options.RetireIdleMilliseconds = 50.0f;
+    SimpleAsync::CreatePool("Elastic", 1, options);
+
+    std::atomic<bool> release{ false };
+    std::atomic<int> running{ 0 };
+    std::atomic<int> maxRunning{ 0 };
+    AsyncOptions opt{};
+    opt.Executor = CallbackExecutor::Inline;
+    auto blocked = [&](CancellationToken, Progress)
+    {
+        int now = ++running;
+        int seen = maxRunning;
+        while (now > seen && !maxRunning.compare_exchange_weak(seen, now)) {}
+        while (!release)
+            std::this_thread::yield();
+        running--;
+        return 0;
+    };
+
+    // Blocked tasks submitted slower than the grow latency, every submission finds the oldest one lagging
+    std::vector<TaskHandle> handles;
+    uint32_t peakThreads = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        handles.push_back(SimpleAsync::CreateTaskInPool("Elastic", blocked, [](int) {}, opt));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        peakThreads = std::max(peakThreads, SimpleAsync::GetPoolMetrics("Elastic").Threads);
+    }
+
+    Check(peakThreads == 4, "the pool grew to MaxThreads and no further, got " + std::to_string(peakThreads));
+    Check(maxRunning == 4, "the added workers ran the lagging tasks, got " + std::to_string(maxRunning.load()) + " at once");
+
+    release = true;
+    for (TaskHandle handle : handles)
+        SimpleAsync::ForceWait(handle);
+    DrainUpdates();
+
+    uint32_t threads = 0;
+    for (int i = 0; i < 200; i++)
+    {
+        threads = SimpleAsync::GetPoolMetrics("Elastic").Threads;
+        if (threads == 1)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    Check(threads == 1, "idle workers retired down to the minimum, got " + std::to_string(threads));
+
+    // A burst submitted at once and nothing after it, the pool still grows while its only worker is blocked
+    release = false;
+    maxRunning = 0;
+    handles.clear();
+    for (int i = 0; i < 4; i++)
+        handles.push_back(SimpleAsync::CreateTaskInPool("Elastic", blocked, [](int) {}, opt));
+    for (int i = 0; i < 200 && maxRunning < 4; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    Check(maxRunning == 4, "the pool grew without new submissions, got " + std::to_string(maxRunning.load()) + " running at once");
+
+    release = true;
+    for (TaskHandle handle : handles)
+        SimpleAsync::ForceWait(handle);
+    DrainUpdates();
+}
+
+// Runs record during a binary profiler session and reads its events back, the trace is deleted afterwards
+template<typename Func>
+static std::vector<ProfileEventInfo> RecordSession(const std::string& name, Func&& record)
+{
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / ("SimpleAsyncTests_" + name);
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+
+    Profiler::Instance().StartSession((directory / name).string(), false, TraceFormat::Binary);
+    record();
+    Profiler::Instance().EndSession();
+
+    std::vector<ProfileEventInfo> events;
+    for (const auto& entry : std::filesystem::directory_iterator(directory))
+    {
+        BinaryTraceReader reader;
+        if (!reader.Open(entry.path().string()))
+            continue;
+
+        ProfileEventInfo info;
+        while (reader.Next(info))
+            events.push_back(info);
+        Check(!reader.Corrupt(), name + ": the session ended on a whole event");
+    }
+    std::filesystem::remove_all(directory);
+    return events;
+}
+
+static size_t CountEvents(const std::vector<ProfileEventInfo>& events, const char* name, char type)
+{
+    return std::count_if(events.begin(), events.end(), [&](const ProfileEventInfo& info)
+        {
+            return std::strcmp(info.EventName, name) == 0 && info.EventType == type;
+        });
+}
+
+// Threads record many times a ring's capacity, the writer has to keep up without losing or reordering any
+static void TestProfilerRings()
+{
+    std::cout << "Profiler rings" << std::endl;
+
+    const int threadCount = 4;
+    const int perThread = static_cast<int>(ProfileEventRing::Capacity) * 3;
+    std::vector<ProfileEventInfo> events = RecordSession("Rings", [&]()
+        {
+            std::vector<std::thread> threads;
+            for (int t = 0; t < threadCount; t++)
+            {
+                threads.emplace_back([perThread]()
+                    {
+                        for (int i = 0; i < perThread; i++)
+                            PROFILE_INSTANT("RingEvent", "i", i);
+                    });
+            }
+            for (std::thread& thread : threads)
+                thread.join();
+        });
+
+    // Each thread's events in the order it recorded them
+    std::map<uint32_t, int> nextByThread;
+    bool ordered = true;
+    for (const ProfileEventInfo& info : events)
+    {
+        if (std::strcmp(info.EventName, "RingEvent") != 0)
+            continue;
+
+        int& next = nextByThread[info.ThreadID];
+        ordered = ordered && info.ArgCount == 1 && info.Args[0].Int == next;
+        next++;
+    }
+
+    Check(CountEvents(events, "RingEvent", 'i') == static_cast<size_t>(threadCount * perThread), "every event was written, got "
+        + std::to_string(CountEvents(events, "RingEvent", 'i')));
+    Check(nextByThread.size() == threadCount, "the events came from every thread");
+    Check(ordered, "each thread's events kept their order");
+}
+
+// Events written to a binary trace read back field for field, and a file cut short keeps its whole events
+static void TestBinaryTraceFormat()
+{
+    std::cout << "Binary trace format" << std::endl;
+
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "SimpleAsyncTests_Format";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    std::string path = (directory / "events.satrace").string();
+
+    const int count = 100;
+    {
+        std::unique_ptr<TraceWriter> writer = TraceWriter::Create(TraceFormat::Binary);
+        Check(writer->Open(path), "the binary trace was created");
+        for (int i = 0; i < count; i++)
+        {
+            ProfileEventInfo info;
+            info.SetName(i % 2 ? "Odd" : "Even");
+            info.SetCategory("Format");
+            info.EventType = 'X';
+            info.ProcessID = 7;
+            info.ThreadID = 100 + i % 3;
+            info.TimePoint = 1000000000000LL + i;
+            if (i % 5 == 0)
+                info.Id = static_cast<std::uintptr_t>(i) << 20;
+            if (i % 7 == 0)
+                info.Scope = 'g';
+            info.BindToEnclosing = i % 11 == 0;
+            info.AddInt("index", -i);
+            info.AddString("label", "text " + std::to_string(i));
+            writer->Write(info);
+        }
+        writer->Close();
+    }
+
+    auto readAll = [&path](bool& corrupt)
+    {
+        std::vector<ProfileEventInfo> events;
+        BinaryTraceReader reader;
+        if (reader.Open(path))
+        {
+            ProfileEventInfo info;
+            while (reader.Next(info))
+                events.push_back(info);
+        }
+        corrupt = reader.Corrupt();
+        return events;
+    };
+
+    bool corrupt = false;
+    std::vector<ProfileEventInfo> events = readAll(corrupt);
+    bool same = events.size() == count && !corrupt;
+    for (int i = 0; same && i < count; i++)
+    {
+        const ProfileEventInfo& info = events[i];
+        same = std::strcmp(info.EventName, i % 2 ? "Odd" : "Even") == 0 && std::strcmp(info.Category, "Format") == 0
+            && info.EventType == 'X' && info.ProcessID == 7 && info.ThreadID == static_cast<uint32_t>(100 + i % 3)
+            && info.TimePoint == 1000000000000LL + i
+            && info.Id == (i % 5 == 0 ? std::optional<std::uintptr_t>(static_cast<std::uintptr_t>(i) << 20) : std::nullopt)
+            && info.Scope == (i % 7 == 0 ? std::optional<char>('g') : std::nullopt) && info.BindToEnclosing == (i % 11 == 0)
+            && info.ArgCount == 2 && info.ArgKey(info.Args[0]) == "index" && info.Args[0].Int == -i
+            && info.ArgString(info.Args[1]) == "text " + std::to_string(i);
+    }
+    Check(same, "every field read back as written, got " + std::to_string(events.size()) + " events");
+
+    // As after a crash in the middle of a block
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 3);
+    events = readAll(corrupt);
+    Check(events.size() == count - 1 && corrupt, "a truncated trace kept its whole events and reported the cut, got "
+        + std::to_string(events.size()));
+
+    std::ofstream(path, std::ios::binary) << "not a trace";
+    BinaryTraceReader reader;
+    Check(!reader.Open(path), "a file without the header was refused");
+    std::filesystem::remove_all(directory);
+
+    // A profiler session in the binary format, nested scopes give matching begin and end events
+    events = RecordSession("BinarySession", []()
+        {
+            for (int i = 0; i < 10; i++)
+            {
+                PROFILE_SCOPE("Outer");
+                {
+                    PROFILE_SCOPE("Inner", "i", i);
+                }
+            }
+        });
+    Check(CountEvents(events, "Outer", 'B') == 10 && CountEvents(events, "Outer", 'E') == 10 && CountEvents(events, "Inner", 'B') == 10
+        && CountEvents(events, "Inner", 'E') == 10, "a binary session holds every scope's begin and end");
+}
+
+// Runtime switches flipped in the middle of a session: disabled, masked and sampled events
+static void TestProfilerSwitches()
+{
+    std::cout << "Profiler switches and sampling" << std::endl;
+
+    Profiler& profiler = Profiler::Instance();
+    std::vector<ProfileEventInfo> events = RecordSession("Switches", [&profiler]()
+        {
+            for (int i = 0; i < 100; i++)
+            {
+                PROFILE_SCOPE("Kept");
+            }
+
+            {
+                // Begun while on, its end is still written
+                PROFILE_SCOPE("Straddling");
+                profiler.SetEnabled(false);
+            }
+            for (int i = 0; i < 100; i++)
+            {
+                PROFILE_SCOPE("Disabled");
+                PROFILE_COUNTER("DisabledCounter", { "value", 1.0 });
+            }
+            profiler.SetEnabled(true);
+
+            profiler.SetCategoryMask(ProfileCategory::Counter);
+            for (int i = 0; i < 100; i++)
+            {
+                PROFILE_SCOPE("Masked");
+                PROFILE_COUNTER("MaskedCounter", { "value", static_cast<double>(i) });
+            }
+            profiler.SetCategoryMask(ProfileCategory::All);
+
+            ProfileSampling everyFourth;
+            everyFourth.EveryN = 4;
+            profiler.SetSampling(everyFourth);
+            for (int i = 0; i < 400; i++)
+            {
+                PROFILE_SCOPE("Sampled");
+            }
+
+            ProfileSampling capped;
+            capped.MaxPerSecond = 20;
+            profiler.SetSampling(capped);
+            for (int i = 0; i < 1000; i++)
+                PROFILE_INSTANT("Capped");
+            profiler.SetSampling(ProfileSampling{});
+        });
+
+    Check(CountEvents(events, "Kept", 'B') == 100 && CountEvents(events, "Kept", 'E') == 100, "everything is recorded by default");
+    Check(CountEvents(events, "Straddling", 'B') == 1 && CountEvents(events, "Straddling", 'E') == 1, "a scope open while disabling got its end");
+    Check(CountEvents(events, "Disabled", 'B') == 0 && CountEvents(events, "DisabledCounter", 'C') == 0, "nothing is recorded while disabled");
+    Check(CountEvents(events, "Masked", 'B') == 0 && CountEvents(events, "MaskedCounter", 'C') == 100, "the category mask kept only counters");
+    Check(CountEvents(events, "Sampled", 'B') == 100 && CountEvents(events, "Sampled", 'E') == 100, "one scope in four was kept whole, got "
+        + std::to_string(CountEvents(events, "Sampled", 'B')));
+
+    // The loop takes well under a second, two windows at most
+    size_t capped = CountEvents(events, "Capped", 'i');
+    Check(capped >= 20 && capped <= 40, "the per second cap held, got " + std::to_string(capped));
+}
+
+// Timestamps follow the steady clock once calibrated, and events carry the OS ids and names of their threads
+static void TestProfilerClockAndThreads()
+{
+    std::cout << "Profiler clock and thread ids" << std::endl;
+
+    SimpleAsync::CreatePool("ProfNamed", 1);
+    uint32_t workerId = 0;
+    uint32_t mainId = ProfileThread::ThreadId();
+    std::vector<ProfileEventInfo> events = RecordSession("Clock", [&workerId]()
+        {
+            PROFILE_INSTANT("BeforeSleep");
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            PROFILE_INSTANT("AfterSleep");
+
+            SimpleAsync::ForceWait(SimpleAsync::CreateTaskInPool("ProfNamed", [&workerId](CancellationToken, Progress)
+                {
+                    workerId = ProfileThread::ThreadId();
+                    PROFILE_INSTANT("FromWorker");
+                    return 0;
+                }, [](int) {}, AsyncOptions{}));
+            DrainUpdates();
+        });
+
+    // Calibrated by the session, the scaled counter has to measure the same intervals as the clock it was measured against.
+    // Compared over a long sleep with a relative bound, a preemption between two reads must not fail it
+    auto steadyNow = []() { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); };
+    long long steadyStart = steadyNow();
+    long long profileStart = ProfileClock::Now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    long long profileElapsed = ProfileClock::Now() - profileStart;
+    long long steadyElapsed = steadyNow() - steadyStart;
+    double ratio = static_cast<double>(profileElapsed) / static_cast<double>(steadyElapsed);
+    Check(ratio > 0.9 && ratio < 1.1, "the profiler clock runs at the steady clock's rate, got " + std::to_string(profileElapsed) + "ns for "
+        + std::to_string(steadyElapsed) + "ns");
+
+    bool monotonic = true;
+    long long last = ProfileClock::Now();
+    for (int i = 0; i < 100000 && monotonic; i++)
+    {
+        long long next = ProfileClock::Now();
+        monotonic = next >= last;
+        last = next;
+    }
+    Check(monotonic, "the profiler clock never goes back");
+
+    const ProfileEventInfo* before = nullptr;
+    const ProfileEventInfo* after = nullptr;
+    const ProfileEventInfo* fromWorker = nullptr;
+    const ProfileEventInfo* workerName = nullptr;
+    for (const ProfileEventInfo& info : events)
+    {
+        if (std::strcmp(info.EventName, "BeforeSleep") == 0)
+            before = &info;
+        else if (std::strcmp(info.EventName, "AfterSleep") == 0)
+            after = &info;
+        else if (std::strcmp(info.EventName, "FromWorker") == 0)
+            fromWorker = &info;
+        else if (info.EventType == 'M' && info.ThreadID == workerId)
+            workerName = &info;
+    }
+
+    Check(before && after, "both instants were written");
+    if (before && after)
+    {
+        long long elapsed = after->TimePoint - before->TimePoint;
+        Check(elapsed >= 18000000 && elapsed < 1000000000, "a 20ms sleep measured at least 20ms within the clock's 10%, got " + std::to_string(elapsed) + "ns");
+        Check(before->ThreadID == mainId && before->ProcessID == ProfileThread::ProcessId(), "main thread events carry the OS ids");
+    }
+
+    Check(fromWorker && fromWorker->ThreadID == workerId && workerId != mainId, "the worker's event carries the worker's OS thread id");
+    Check(workerName && workerName->ArgCount == 1 && workerName->ArgString(workerName->Args[0]) == "ProfNamed-0",
+        "the worker's track is named after its pool");
+}
+
+struct StreamedPoint
+{
+    int X;
+    int Y;
+};
+
+static std::ostream& operator<<(std::ostream& out, const StreamedPoint& point)
+{
+    return out << "(" << point.X << ", " << point.Y << ")";
+}
+
+static const ProfileEventInfo* FindEvent(const std::vector<ProfileEventInfo>& events, const char* name, char type)
+{
+    for (const ProfileEventInfo& info : events)
+    {
+        if (std::strcmp(info.EventName, name) == 0 && info.EventType == type)
+            return &info;
+    }
+    return nullptr;
+}
+
+// Event arguments keep their types, anything else is streamed to a string, and numbers and literals never allocate
+static void TestProfilerArgs()
+{
+    std::cout << "Profiler typed args" << std::endl;
+
+    int allocations = -1;
+    std::vector<ProfileEventInfo> events = RecordSession("Args", [&allocations]()
+        {
+            PROFILE_INSTANT("Warmup");
+
+            t_allocations = 0;
+            t_countAllocations = true;
+            PROFILE_INSTANT("Typed", "int", -5, "big", std::numeric_limits<uint64_t>::max(), "ratio", 0.25, "flag", true, "letter", 'x', "text", "hello");
+            {
+                PROFILE_SCOPE("TypedScope", "view", std::string_view("viewed"), "count", 3u);
+            }
+            t_countAllocations = false;
+            allocations = t_allocations;
+
+            PROFILE_INSTANT("Converted", "name", std::string("dynamic"), "point", StreamedPoint{ 1, 2 });
+            PROFILE_INSTANT("Overflow", "a", 1, "b", 2, "c", 3, "d", 4, "e", 5, "f", 6, "g", 7);
+            PROFILE_INSTANT("TooLong", "long", std::string(200, 'z'), "short", 1);
+        });
+
+    Check(allocations == 0, "typed args were recorded without allocating, got " + std::to_string(allocations));
+
+    const ProfileEventInfo* typed = FindEvent(events, "Typed", 'i');
+    Check(typed && typed->ArgCount == 6, "all six typed args were recorded");
+    if (typed && typed->ArgCount == 6)
+    {
+        const ProfileArg* a = typed->Args;
+        Check(a[0].Type == ProfileArgType::Int && a[0].Int == -5 && typed->ArgKey(a[0]) == "int", "a signed int stays signed");
+        Check(a[1].Type == ProfileArgType::UInt && a[1].UInt == std::numeric_limits<uint64_t>::max(), "an unsigned 64-bit value keeps every bit");
+        Check(a[2].Type == ProfileArgType::Double && a[2].Double == 0.25, "a double stays a double");
+        Check(a[3].Type == ProfileArgType::Bool && a[3].Bool, "a bool stays a bool");
+        Check(a[4].Type == ProfileArgType::String && typed->ArgString(a[4]) == "x", "a char becomes a one letter string");
+        Check(a[5].Type == ProfileArgType::String && typed->ArgString(a[5]) == "hello", "a literal is copied as a string");
+    }
+
+    // A scope's args are added once its begin was written, they go out with its end
+    const ProfileEventInfo* scope = FindEvent(events, "TypedScope", 'E');
+    Check(scope && scope->ArgCount == 2 && scope->ArgString(scope->Args[0]) == "viewed" && scope->Args[1].Type == ProfileArgType::UInt
+        && scope->Args[1].UInt == 3, "scopes take the same typed args");
+
+    const ProfileEventInfo* converted = FindEvent(events, "Converted", 'i');
+    Check(converted && converted->ArgCount == 2 && converted->ArgString(converted->Args[0]) == "dynamic"
+        && converted->ArgString(converted->Args[1]) == "(1, 2)", "strings are copied and other types streamed");
+
+    const ProfileEventInfo* overflow = FindEvent(events, "Overflow", 'i');
+    Check(overflow && overflow->ArgCount == ProfileEventInfo::MaxArgs && overflow->Args[5].Int == 6, "args past the limit are dropped");
+
+    const ProfileEventInfo* tooLong = FindEvent(events, "TooLong", 'i');
+    Check(tooLong && tooLong->ArgCount == 1 && tooLong->ArgKey(tooLong->Args[0]) == "short", "an arg too long to fit is dropped whole");
+}
+
+// Counters with several series, a flow handed from the main thread to a worker, and a sampler run by the writer
+static void TestProfilerCountersAndFlows()
+{
+    std::cout << "Profiler counters and flows" << std::endl;
+
+    uint32_t workerId = 0;
+    std::vector<ProfileEventInfo> events = RecordSession("Counters", [&workerId]()
+        {
+            PROFILE_COUNTER("QueueDepth", { "queued", 3.0 }, { "active", 1.0 });
+
+            {
+                PROFILE_SCOPE("Producer");
+                PROFILE_FLOW_START("Handoff", 42);
+            }
+            SimpleAsync::ForceWait(SimpleAsync::CreateTask([&workerId](CancellationToken, Progress)
+                {
+                    workerId = ProfileThread::ThreadId();
+                    {
+                        PROFILE_SCOPE("Relay");
+                        PROFILE_FLOW_STEP("Handoff", 42);
+                    }
+                    PROFILE_SCOPE("Consumer");
+                    PROFILE_FLOW_END("Handoff", 42);
+                    return 0;
+                }, [](int) {}, AsyncOptions{}));
+            DrainUpdates();
+
+            std::atomic<int> samples{ 0 };
+            uint32_t sampler = Profiler::Instance().AddSampler([&samples]()
+                {
+                    samples++;
+                    PROFILE_COUNTER("Sampled", { "value", 1.0 });
+                }, 2.0f);
+            while (samples < 5)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            Profiler::Instance().RemoveSampler(sampler);
+            PROFILE_INSTANT("SamplerRemoved");
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        });
+
+    const ProfileEventInfo* counter = FindEvent(events, "QueueDepth", 'C');
+    Check(counter && std::strcmp(counter->Category, "Counter") == 0 && counter->ArgCount == 2 && counter->ArgKey(counter->Args[0]) == "queued"
+        && counter->Args[0].Double == 3.0 && counter->ArgKey(counter->Args[1]) == "active" && counter->Args[1].Double == 1.0,
+        "a counter holds one value per series");
+
+    const ProfileEventInfo* start = FindEvent(events, "Handoff", 's');
+    const ProfileEventInfo* step = FindEvent(events, "Handoff", 't');
+    const ProfileEventInfo* end = FindEvent(events, "Handoff", 'f');
+    Check(start && step && end, "the flow's start, step and end were written");
+    if (start && step && end)
+    {
+        Check(start->Id == std::optional<std::uintptr_t>(42) && step->Id == start->Id && end->Id == start->Id, "the flow events share their id");
+        Check(start->ThreadID == ProfileThread::ThreadId() && end->ThreadID == workerId && workerId != start->ThreadID,
+            "the flow went from the main thread to the worker");
+        Check(end->BindToEnclosing && !start->BindToEnclosing, "the end binds to the slice around it");
+    }
+
+    size_t sampled = CountEvents(events, "Sampled", 'C');
+    const ProfileEventInfo* removed = FindEvent(events, "SamplerRemoved", 'i');
+    bool beforeRemoval = removed != nullptr;
+    for (const ProfileEventInfo& info : events)
+    {
+        if (removed && std::strcmp(info.EventName, "Sampled") == 0)
+            beforeRemoval = beforeRemoval && info.TimePoint < removed->TimePoint;
+    }
+    Check(sampled >= 5, "the sampler recorded its counter, got " + std::to_string(sampled));
+    Check(beforeRemoval, "the sampler stopped once removed");
+}
+
+// Custom events begun on some threads and ended on others through their handles, plus handles that must end nothing
+static void TestProfilerCustomEvents()
+{
+    std::cout << "Profiler custom events" << std::endl;
+
+    const int threadCount = 4;
+    const int perThread = 500;
+    uint32_t mainId = ProfileThread::ThreadId();
+    std::vector<ProfileEventInfo> events = RecordSession("Custom", [&]()
+        {
+            std::mutex handlesMutex;
+            std::vector<ProfileEventHandle> handles;
+            std::vector<std::thread> threads;
+            for (int t = 0; t < threadCount; t++)
+            {
+                threads.emplace_back([&]()
+                    {
+                        for (int i = 0; i < perThread; i++)
+                        {
+                            ProfileEventHandle handle = PROFILE_CUSTOM_ASYNC_START("Request", "i", i);
+                            std::lock_guard<std::mutex> lock(handlesMutex);
+                            handles.push_back(handle);
+                        }
+                    });
+            }
+            for (std::thread& thread : threads)
+                thread.join();
+            threads.clear();
+
+            // Ended by other threads than the ones that began them
+            for (int t = 0; t < threadCount; t++)
+            {
+                threads.emplace_back([&, t]()
+                    {
+                        for (size_t i = t; i < handles.size(); i += threadCount)
+                            PROFILE_CUSTOM_ASYNC_END(handles[i], "ended", true);
+                    });
+            }
+            for (std::thread& thread : threads)
+                thread.join();
+
+            // A second end, a default handle and an event filtered out at its begin write nothing
+            PROFILE_CUSTOM_ASYNC_END(handles[0]);
+            PROFILE_CUSTOM_END(ProfileEventHandle{});
+            Profiler::Instance().SetEnabled(false);
+            ProfileEventHandle filtered = PROFILE_CUSTOM_START("Filtered");
+            Profiler::Instance().SetEnabled(true);
+            PROFILE_CUSTOM_END(filtered);
+
+            // A sync event stays on the track of the thread that began it
+            ProfileEventHandle sync = PROFILE_CUSTOM_START("Load", "file", "level.dat");
+            std::thread([sync]() { PROFILE_CUSTOM_END(sync, "bytes", 1024); }).join();
+        });
+
+    // Rings are drained one after the other, an end may be written before the begin recorded on another thread
+    std::map<std::uintptr_t, int> begins;
+    bool matched = true;
+    for (const ProfileEventInfo& info : events)
+    {
+        if (std::strcmp(info.EventName, "Request") == 0 && info.EventType == 'b')
+            matched = info.Id.has_value() && begins[info.Id.value()]++ == 0 && matched;
+    }
+
+    size_t ends = 0;
+    for (const ProfileEventInfo& info : events)
+    {
+        if (std::strcmp(info.EventName, "Request") != 0 || info.EventType != 'e')
+            continue;
+
+        ends++;
+        matched = matched && info.Id.has_value() && begins.count(info.Id.value()) == 1 && info.ArgCount == 1
+            && info.ArgKey(info.Args[0]) == "ended";
+    }
+    Check(begins.size() == threadCount * perThread, "every async event began once with its own id, got " + std::to_string(begins.size()));
+    Check(ends == threadCount * perThread, "every async event ended exactly once, got " + std::to_string(ends));
+    Check(matched, "each end carries its begin's id and only its own args");
+    Check(CountEvents(events, "Filtered", 'B') == 0 && CountEvents(events, "Filtered", 'E') == 0, "a filtered out event wrote nothing");
+
+    const ProfileEventInfo* loadBegin = FindEvent(events, "Load", 'B');
+    const ProfileEventInfo* loadEnd = FindEvent(events, "Load", 'E');
+    Check(loadBegin && loadEnd && loadBegin->ThreadID == mainId && loadEnd->ThreadID == mainId && loadEnd->TimePoint >= loadBegin->TimePoint,
+        "a sync event ended on another thread stays on its beginning thread");
+    Check(loadEnd && loadEnd->ArgCount == 1 && loadEnd->ArgKey(loadEnd->Args[0]) == "bytes" && loadEnd->Args[0].Int == 1024,
+        "the end of a sync event carries its own args");
+}
+
+// With SIMPLEASYNC_TRACE every task writes its submission, run and callback, without any PROFILE_SCOPE in its body
+static void TestProfilerTaskTrace()
+{
+    std::cout << "Profiler task trace" << std::endl;
+
+    const int taskCount = 3;
+    uint32_t mainId = ProfileThread::ThreadId();
+    std::vector<ProfileEventInfo> events = RecordSession("TaskTrace", [&]()
+        {
+            int called = 0;
+            auto runTasks = [&called](const char* name, int count)
+            {
+                AsyncOptions opt{};
+                opt.Name = name;
+                called = 0;
+                for (int i = 0; i < count; i++)
+                    SimpleAsync::CreateTask([](CancellationToken, Progress) { return 1; }, [&called](int) { called++; }, opt);
+                while (called < count)
+                {
+                    SimpleAsync::Update();
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            };
+            runTasks("Traced", taskCount);
+
+            // Nothing is written while the Task category is off
+            Profiler::Instance().SetCategoryMask(ProfileCategory::All & ~ProfileCategory::Task);
+            runTasks("Untraced", 1);
+            Profiler::Instance().SetCategoryMask(ProfileCategory::All);
+
+            // Long enough for the pool counter sampler to run
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        });
+
+    auto count = [&events](const char* name, const char* category, char type)
+    {
+        return std::count_if(events.begin(), events.end(), [&](const ProfileEventInfo& info)
+            {
+                return std::strcmp(info.EventName, name) == 0 && std::strcmp(info.Category, category) == 0 && info.EventType == type;
+            });
+    };
+    Check(count("Traced", "Task", 'b') == taskCount && count("Traced", "Task", 'e') == taskCount, "every submission began and ended an async span");
+    Check(count("Traced", "TaskRun", 'B') == taskCount && count("Traced", "TaskRun", 'E') == taskCount, "every run was a slice on its worker");
+    Check(count("Traced", "TaskCallback", 'B') == taskCount && count("Traced", "TaskCallback", 'E') == taskCount, "every callback was a slice");
+    Check(count("Traced", "TaskFlow", 's') == taskCount && count("Traced", "TaskFlow", 'f') == taskCount, "every callback got a flow from its submission");
+
+    auto find = [&events](const char* category, char type) -> const ProfileEventInfo*
+    {
+        for (const ProfileEventInfo& info : events)
+        {
+            if (std::strcmp(info.EventName, "Traced") == 0 && std::strcmp(info.Category, category) == 0 && info.EventType == type)
+                return &info;
+        }
+        return nullptr;
+    };
+    const ProfileEventInfo* submitted = find("Task", 'b');
+    const ProfileEventInfo* started = find("TaskRun", 'B');
+    const ProfileEventInfo* finished = find("Task", 'e');
+    const ProfileEventInfo* called = find("TaskCallback", 'B');
+    Check(submitted && started && finished && called && submitted->TimePoint <= started->TimePoint && started->TimePoint <= finished->TimePoint
+        && finished->TimePoint <= called->TimePoint, "a task was submitted, started, finished and called back in that order");
+    Check(submitted && started && called && submitted->ThreadID == mainId && started->ThreadID != mainId && called->ThreadID == mainId,
+        "the task ran on a worker and was called back by Update()");
+    Check(submitted && finished && submitted->Id.has_value() && submitted->Id == finished->Id, "the async span's ends share the task's id");
+
+    size_t untraced = std::count_if(events.begin(), events.end(), [](const ProfileEventInfo& info) { return std::strcmp(info.EventName, "Untraced") == 0; });
+    Check(untraced == 0, "a task wrote nothing with the Task category off, got " + std::to_string(untraced));
+    Check(count(DefaultPoolName.c_str(), "Counter", 'C') >= 1, "the default pool's counter was sampled");
+}
+
+int main()
+{
+    std::thread([]()
+        {
+            std::this_thread::sleep_for(std::chrono::minutes(1));
+            std::cout << "FAILED: timed out, a test hangs" << std::endl;
+            std::_Exit(1);
+        }).detach();
+
+    SimpleAsync::Initialize(DefaultPoolName, 4);
+
+    TestConcurrentCompletions();
+    TestProgressWhileRetiring();
+    TestProgressThrottling();
+    TestContinuations();
+    TestContinuationsOfFailedParents();
+    TestOverflowPolicies();
+    TestEnqueueBatch();
+    TestOverflowOfBatchesAndDeques();
+    TestForceWaitFromAnotherThread();
+    TestSharedLeaderCanceled();
+    TestResultCache();
+    TestGroupsWithWorkerCallbacks();
+    TestParentTokenTeardown();
+    TestCancelCallbacksReenter();
+    TestSlabCoversCommonResults();
+    TestCreatePoolWhileSubmitting();
+    TestWorkStealing();
+    TestTimeouts();
+    TestPoolMetrics();
+    TestIdlePolicies();
+    TestStaleHandles();
+    TestBudgetedUpdate();
+    TestProgressOfFinishedTasks();
+    TestPrioritiesAndAging();
+    TestParallelAlgorithms();
+    TestCoroutines();
+    TestPlacement();
+    TestElasticSizing();
+    TestProfilerRings();
+    TestBinaryTraceFormat();
+    TestProfilerSwitches();
+    TestProfilerClockAndThreads();
+    TestProfilerArgs();
+    TestProfilerCountersAndFlows();
+    TestProfilerCustomEvents();
+    TestProfilerTaskTrace();
+
+    SimpleAsync::Destroy();
+
+    if (s_failures > 0)
+    {
+        std::cout << s_failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All tests passed" << std::endl;
+    return 0;
+}
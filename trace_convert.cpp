@@ -0,0 +1,61 @@
+#include "ProfileTrace.h"
+#include <iostream>
+#include <string>
+
+// Converts a binary profiler session into Chrome trace JSON.
+//
+//   trace_convert session.satrace [output.json]
+//
+// Without an output path the JSON is written next to the input, with its extension replaced.
+// A session cut short (e.g. the process crashed) is converted up to its last whole event.
+// Build with e.g. g++ -std=c++20 -O2 trace_convert.cpp -o trace_convert
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || argc > 3)
+    {
+        std::cout << "Usage: trace_convert session.satrace [output.json]" << std::endl;
+        return 2;
+    }
+
+    std::string inputPath = argv[1];
+    std::string outputPath;
+    if (argc == 3)
+        outputPath = argv[2];
+    else
+    {
+        size_t dot = inputPath.find_last_of('.');
+        size_t slash = inputPath.find_last_of("/\\");
+        bool hasExtension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+        outputPath = (hasExtension ? inputPath.substr(0, dot) : inputPath) + ".json";
+    }
+
+    BinaryTraceReader reader;
+    if (!reader.Open(inputPath))
+    {
+        std::cout << "Could not read a binary session from " << inputPath << std::endl;
+        return 1;
+    }
+
+    JsonTraceWriter writer;
+    if (!writer.Open(outputPath))
+    {
+        std::cout << "Could not write " << outputPath << std::endl;
+        return 1;
+    }
+
+    size_t events = 0;
+    ProfileEventInfo info;
+    while (reader.Next(info))
+    {
+        writer.Write(info);
+        events++;
+    }
+    writer.Close();
+
+    std::cout << "Wrote " << events << " events to " << outputPath << std::endl;
+    if (reader.Corrupt())
+        std::cout << "The session ends inside a record, everything after the last whole event was skipped" << std::endl;
+
+    return 0;
+}